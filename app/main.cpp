@@ -1,14 +1,18 @@
+#include <chrono>
+#include <filesystem>
 #include <iostream>
 #include <fstream>
 #include <limits>
 #include <sstream>
 
+#include <core/rom_library.h>
 #include <core/vm.h>
 
 #include <impl_basic/keyboard_fake.h>
 #include <impl_basic/timers_basic.h>
 #include <impl_basic/video_ascii.h>
 #include <impl_basic/sound_none.h>
+#include <impl_basic/sound_stream.h>
 
 #include <impl_sdl/platform.h>
 
@@ -16,7 +20,7 @@
 int main(int argc, char** argv)
 {
     if (argc < 4) {
-        std::cerr << "usage: " << argv[0] << " <sdl|ascii> <ch8|sch|xoch> <rom>" << std::endl;
+        std::cerr << "usage: " << argv[0] << " <sdl|ascii> <ch8|sch|xoch> <rom> [audio latency ms]" << std::endl;
         return 1;
     }
 
@@ -24,15 +28,14 @@ int main(int argc, char** argv)
     auto emulator_type = std::string_view(argv[2]);
     auto rom_filename = std::string_view(argv[3]);
 
-    // read rom from file
-    auto rom = std::invoke([rom_filename]() {
-        std::ifstream file(rom_filename.data(), std::ios::in | std::ios::binary);
-        if (!file.is_open()) {
-            throw std::runtime_error("failed to open file");
-        }
+    auto audio = chip8::sound_system_stream_t::settings_t{};
+    if (argc > 4) {
+        audio.latency = std::chrono::milliseconds(std::stoul(argv[4]));
+    }
 
-        return chip8::bytes_owned(std::istreambuf_iterator<char>(file), {});
-    });
+    // mapped, the vm copies it straight from the file
+    chip8::rom_library_t library;
+    const auto& rom = library.add_file(std::filesystem::path(rom_filename));
 
     auto settings = chip8::vm_t::settings_t{
         .emulator_type = std::invoke([emulator_type]() {
@@ -49,8 +52,8 @@ int main(int argc, char** argv)
         }),
     };
 
-    auto run_with_sdl = [settings, &rom]() mutable {
-        auto sdl_impl = std::make_unique<chip8::sdl::sdl_system_facade_t>();
+    auto run_with_sdl = [settings, audio, &rom]() mutable {
+        auto sdl_impl = std::make_unique<chip8::sdl::sdl_system_facade_t>(false, audio);
 
         auto vm = std::make_unique<chip8::vm_t>(
             std::move(settings),
@@ -61,10 +64,10 @@ int main(int argc, char** argv)
             *sdl_impl
         );
 
-        vm->load_data(rom, chip8::ROM_OFFSET);
+        vm->load_data(rom.data, chip8::ROM_OFFSET);
         vm->load_data(chip8::CHIP8_STANDARD_FONTSET_VIEW, 0);
 
-        vm->emulate_duration();
+        return vm->emulate_duration();
     };
 
     auto run_with_ascii = [settings, &rom]() mutable {
@@ -83,20 +86,26 @@ int main(int argc, char** argv)
             *sound_system
         );
 
-        vm->load_data(rom, chip8::ROM_OFFSET);
+        vm->load_data(rom.data, chip8::ROM_OFFSET);
         vm->load_data(chip8::CHIP8_STANDARD_FONTSET_VIEW, 0);
 
-        vm->emulate_duration();
+        return vm->emulate_duration();
     };
 
+    chip8::fault_t fault;
     if (renderer == "sdl") {
-        run_with_sdl();
+        fault = run_with_sdl();
     } else if (renderer == "ascii") {
-        run_with_ascii();
+        fault = run_with_ascii();
     } else {
         std::cerr << "invalid frontend type" << std::endl;
         return 1;
     }
 
+    if (fault) {
+        std::cerr << fault.describe() << std::endl;
+        return 1;
+    }
+
     return 0;
 }
@@ -0,0 +1,354 @@
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include <core/audio.h>
+#include <core/common.h>
+#include <core/instruction_decoder.h>
+#include <core/rom_library.h>
+#include <core/static_vm.h>
+#include <core/vm.h>
+#include <core/vm_batch.h>
+
+#include <impl_basic/keyboard_fake.h>
+#include <impl_basic/random_crand.h>
+#include <impl_basic/sound_none.h>
+#include <impl_basic/timers_instant.h>
+#include <impl_basic/video_none.h>
+
+
+namespace {
+
+using settings_t = chip8::vm_t::settings_t;
+
+// headless peripherals, timers never sleep
+struct env_t {
+    std::unique_ptr<chip8::keyboard_system_fake_t> keyboard_system = std::make_unique<chip8::keyboard_system_fake_t>();
+    std::unique_ptr<chip8::timers_system_instant_t> timers_system = std::make_unique<chip8::timers_system_instant_t>();
+    std::unique_ptr<chip8::video_system_none_t> video_system = std::make_unique<chip8::video_system_none_t>();
+    std::unique_ptr<chip8::random_system_crand_t> random_system = std::make_unique<chip8::random_system_crand_t>();
+    std::unique_ptr<chip8::sound_system_none_t> sound_system = std::make_unique<chip8::sound_system_none_t>();
+
+    chip8::vm_t vm;
+
+    explicit env_t(settings_t settings)
+        : vm(
+            std::move(settings),
+            *keyboard_system,
+            *timers_system,
+            *video_system,
+            *random_system,
+            *sound_system
+        )
+    {
+        vm.load_data(chip8::CHIP8_STANDARD_FONTSET_VIEW, 0);
+    }
+};
+
+inline constexpr settings_t::engine_t ENGINES[] = {
+    settings_t::INTERPRETER,
+    settings_t::JIT,
+    settings_t::BLOCK_CACHE,
+    settings_t::THREADED,
+};
+
+inline constexpr const char* ENGINE_NAMES[] = {"interpreter", "jit", "block_cache", "threaded"};
+
+// instructions per iteration, long enough to hide the call into the engine
+inline constexpr uint64_t BATCH = 100000;
+
+// programs end before it, memory above is scratch for the stores of benchmarks
+inline constexpr size_t SCRATCH_OFFSET = 0xE00;
+
+// program at ROM_OFFSET: `prologue` once, then `body` repeated up to SCRATCH_OFFSET, then jump to the first body
+chip8::bytes_owned make_program(const std::vector<uint16_t>& prologue, const std::vector<uint16_t>& body) {
+    chip8::bytes_owned program;
+    auto push = [&program](uint16_t opcode) {
+        program.push_back(static_cast<uint8_t>(opcode >> 8));
+        program.push_back(static_cast<uint8_t>(opcode & 0xFF));
+    };
+
+    for (auto opcode : prologue) {
+        push(opcode);
+    }
+    const auto loop = chip8::ROM_OFFSET + program.size();
+
+    const auto room = SCRATCH_OFFSET - chip8::ROM_OFFSET - program.size() - 2;
+    for (size_t i = 0; i + body.size() * 2 <= room; i += body.size() * 2) {
+        for (auto opcode : body) {
+            push(opcode);
+        }
+    }
+    push(static_cast<uint16_t>(0x1000 | loop));
+
+    return program;
+}
+
+void run_program(benchmark::State& state, settings_t::engine_t engine, const chip8::bytes_owned& program) {
+    env_t env({.emulator_type = settings_t::CHIP_8, .engine = engine});
+    env.vm.load_data(program, chip8::ROM_OFFSET);
+
+    for (auto _ : state) {
+        env.vm.emulate_instructions(BATCH);
+    }
+
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * BATCH));
+}
+
+// interpreter with the peripherals of env_t bound at compile time
+void run_program_static(benchmark::State& state, const chip8::bytes_owned& program) {
+    env_t env({});
+    chip8::static_vm_t static_vm(
+        settings_t{.emulator_type = settings_t::CHIP_8},
+        *env.keyboard_system,
+        *env.timers_system,
+        *env.video_system,
+        *env.random_system,
+        *env.sound_system
+    );
+    static_vm.vm.load_data(chip8::CHIP8_STANDARD_FONTSET_VIEW, 0);
+    static_vm.vm.load_data(program, chip8::ROM_OFFSET);
+
+    for (auto _ : state) {
+        static_vm.emulate_instructions(BATCH);
+    }
+
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * BATCH));
+}
+
+// one class of opcodes, one benchmark per engine
+void register_opcode_class(const std::string& name, std::vector<uint16_t> prologue, std::vector<uint16_t> body) {
+    const auto program = make_program(prologue, body);
+    for (size_t i = 0; i < std::size(ENGINES); ++i) {
+        const auto engine = ENGINES[i];
+        benchmark::RegisterBenchmark(
+            ("Opcode/" + name + "/" + ENGINE_NAMES[i]).c_str(),
+            [program, engine](benchmark::State& state) { run_program(state, engine, program); }
+        );
+    }
+    benchmark::RegisterBenchmark(
+        ("Opcode/" + name + "/static").c_str(),
+        [program](benchmark::State& state) { run_program_static(state, program); }
+    );
+}
+
+void register_opcode_classes() {
+    register_opcode_class("load", {}, {0x6012, 0x6134, 0x6256, 0x6378});
+    register_opcode_class("add", {}, {0x7001, 0x7102, 0x7203, 0x7304});
+    register_opcode_class("alu", {0x6003, 0x6105}, {0x8014, 0x8102, 0x8013, 0x8105, 0x8011, 0x810E, 0x8016});
+    // skips are never taken, pc runs straight through
+    register_opcode_class("skip", {0x6001}, {0x3000, 0x4001, 0x5010, 0x9000});
+    register_opcode_class("index", {0x6001}, {0xA300, 0xF01E, 0xF029, 0xA400});
+    register_opcode_class("memory", {0xAE00}, {0xF333, 0xF355, 0xF365, 0xAE00});
+    register_opcode_class("timers", {}, {0xF015, 0xF107, 0xF018});
+    register_opcode_class("random", {}, {0xC0FF, 0xC10F});
+    // every call returns right away: 2nnn to the RET just behind the body of the loop
+    register_opcode_class("call", {0x1206, 0x00EE, 0x00EE}, {0x2202, 0x2204});
+}
+
+
+// lanes of a batch against as many separate vms with the interpreter, all run the same alu loop, so the batch stays in lockstep
+inline constexpr size_t LANES[] = {1, 4, 16, 64};
+// steps of every lane per iteration
+inline constexpr uint64_t LANE_STEPS = 10000;
+
+chip8::bytes_owned make_lanes_program() {
+    return make_program({0x6003, 0x6105}, {0x8014, 0x8102, 0x8013, 0x8105, 0x8011, 0x810E, 0x8016});
+}
+
+void run_batch(benchmark::State& state, size_t lanes) {
+    env_t env({.emulator_type = settings_t::CHIP_8});
+    env.vm.load_data(make_lanes_program(), chip8::ROM_OFFSET);
+    chip8::vm_batch_t batch(
+        lanes,
+        env.vm,
+        *env.keyboard_system,
+        *env.timers_system,
+        *env.video_system,
+        *env.random_system,
+        *env.sound_system
+    );
+
+    for (auto _ : state) {
+        batch.run(LANE_STEPS);
+    }
+
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * LANE_STEPS * lanes));
+}
+
+void run_separate(benchmark::State& state, size_t lanes) {
+    std::vector<std::unique_ptr<env_t>> envs;
+    for (size_t lane = 0; lane < lanes; ++lane) {
+        envs.push_back(std::make_unique<env_t>(settings_t{.emulator_type = settings_t::CHIP_8}));
+        envs.back()->vm.load_data(make_lanes_program(), chip8::ROM_OFFSET);
+    }
+
+    for (auto _ : state) {
+        for (auto& env : envs) {
+            env->vm.emulate_instructions(LANE_STEPS);
+        }
+    }
+
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * LANE_STEPS * lanes));
+}
+
+void register_lanes() {
+    for (auto lanes : LANES) {
+        benchmark::RegisterBenchmark(
+            ("Batch/" + std::to_string(lanes)).c_str(),
+            [lanes](benchmark::State& state) { run_batch(state, lanes); }
+        );
+        benchmark::RegisterBenchmark(
+            ("Separate/" + std::to_string(lanes)).c_str(),
+            [lanes](benchmark::State& state) { run_separate(state, lanes); }
+        );
+    }
+}
+
+
+// DRW of the font glyph `0` at (x, y), height and position come from args
+void BM_Draw(benchmark::State& state) {
+    const auto height = static_cast<uint16_t>(state.range(0));
+    const auto x = static_cast<uint16_t>(state.range(1));
+    const auto y = static_cast<uint16_t>(state.range(2));
+    // the glyph is only 5 bytes, taller sprites draw the next glyphs too
+    const auto program = make_program({static_cast<uint16_t>(0x6000 | x), static_cast<uint16_t>(0x6100 | y), 0xA000},
+                                      {static_cast<uint16_t>(0xD010 | height)});
+
+    env_t env({.emulator_type = settings_t::CHIP_8, .engine = settings_t::INTERPRETER});
+    env.vm.load_data(program, chip8::ROM_OFFSET);
+
+    for (auto _ : state) {
+        env.vm.emulate_instructions(BATCH);
+    }
+
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * BATCH));
+    state.counters["rows"] = benchmark::Counter(static_cast<double>(state.iterations() * BATCH * height),
+                                                benchmark::Counter::kIsRate);
+}
+BENCHMARK(BM_Draw)
+    ->ArgNames({"height", "x", "y"})
+    // inside the screen, byte-aligned and not
+    ->Args({1, 8, 8})->Args({5, 8, 8})->Args({15, 8, 8})->Args({15, 11, 8})
+    // clipped by the right and the bottom edge
+    ->Args({15, 60, 8})->Args({15, 11, 28})->Args({15, 60, 28});
+
+
+// decoder alone: every 16-bit opcode once per iteration
+void BM_Decode(benchmark::State& state) {
+    for (auto _ : state) {
+        for (uint32_t opcode = 0; opcode < chip8::OPCODES_COUNT; ++opcode) {
+            auto instruction = chip8::decode_instruction(chip8::opcode_t{static_cast<uint16_t>(opcode)});
+            benchmark::DoNotOptimize(instruction);
+        }
+    }
+
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * chip8::OPCODES_COUNT));
+}
+BENCHMARK(BM_Decode);
+
+
+// one second of sound at 48 kHz per iteration, a frame at a time, as vm plays it
+void BM_Audio(benchmark::State& state) {
+    chip8::audio_t audio;
+    audio.pitch = static_cast<uint8_t>(state.range(0));
+    chip8::audio_generator_t generator(48000);
+    std::vector<int16_t> samples;
+    samples.reserve(48000 + 1024);
+
+    for (auto _ : state) {
+        samples.clear();
+        for (size_t frame = 0; frame < 60; ++frame) {
+            generator.generate(settings_t{}.timer_duration, settings_t{}.timer_duration, audio, samples);
+        }
+        benchmark::DoNotOptimize(samples.data());
+    }
+
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * samples.size()));
+}
+BENCHMARK(BM_Audio)->ArgName("pitch")->Arg(0)->Arg(64)->Arg(255);
+
+
+inline constexpr std::string_view ROMS[] = {
+    "tests/data/1-chip8-logo.ch8",
+    "tests/data/2-ibm-logo.ch8",
+    "tests/data/3-corax+.ch8",
+    "tests/data/4-flags.ch8",
+    "tests/data/5-quirks.ch8",
+};
+
+// frames of guest time, emulated by one iteration of rom benchmarks
+inline constexpr uint64_t ROM_FRAMES = 60;
+
+void run_rom(benchmark::State& state, std::string_view filename, settings_t::engine_t engine) {
+    // loaded as by the runner and the tests, the library maps the file, the vm gets its copy
+    chip8::rom_library_t library;
+    const chip8::rom_t* rom = nullptr;
+    try {
+        rom = &library.add_file(std::string(filename));
+    } catch (const std::exception& e) {
+        state.SkipWithError(e.what());
+        return;
+    }
+
+    env_t env(rom->apply_profile({.emulator_type = settings_t::CHIP_8, .engine = engine}));
+    env.vm.load_data(rom->data, chip8::ROM_OFFSET);
+
+    for (auto _ : state) {
+        if (auto fault = env.vm.emulate_duration(env.vm.settings.timer_duration * ROM_FRAMES)) {
+            // a faulted vm stays at the faulting instruction, there is nothing left to measure
+            state.SkipWithError(fault.describe().c_str());
+            break;
+        }
+    }
+
+    state.counters["frames"] = benchmark::Counter(static_cast<double>(state.iterations() * ROM_FRAMES),
+                                                  benchmark::Counter::kIsRate);
+}
+
+void register_roms() {
+    for (auto rom : ROMS) {
+        const auto name = std::string(rom.substr(rom.find_last_of('/') + 1));
+        for (size_t i = 0; i < std::size(ENGINES); ++i) {
+            const auto engine = ENGINES[i];
+            benchmark::RegisterBenchmark(
+                ("Rom/" + name + "/" + ENGINE_NAMES[i]).c_str(),
+                [rom, engine](benchmark::State& state) { run_rom(state, rom, engine); }
+            );
+        }
+    }
+}
+
+} // namespace
+
+
+// results are json by default, so runs of different builds can be compared with tools/compare.py of benchmark
+int main(int argc, char** argv) {
+    std::vector<char*> args(argv, argv + argc);
+    std::string format = "--benchmark_format=json";
+    bool has_format = false;
+    for (int i = 1; i < argc; ++i) {
+        has_format = has_format || std::string_view(argv[i]).starts_with("--benchmark_format");
+    }
+    if (!has_format) {
+        args.insert(args.begin() + 1, format.data());
+    }
+    int args_count = static_cast<int>(args.size());
+
+    register_opcode_classes();
+    register_lanes();
+    register_roms();
+
+    benchmark::Initialize(&args_count, args.data());
+    if (benchmark::ReportUnrecognizedArguments(args_count, args.data())) {
+        return 1;
+    }
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
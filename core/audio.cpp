@@ -0,0 +1,73 @@
+#include <core/audio.h>
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cmath>
+
+
+namespace chip8 {
+
+namespace {
+
+inline constexpr uint64_t NANOSECONDS_PER_SECOND = 1'000'000'000;
+
+// bits of phase below the index of the bit in the pattern
+inline constexpr int PHASE_SHIFT = 32 - std::countr_zero(audio_t::PATTERN_BITS);
+// samples per bit, that are filled as runs
+inline constexpr uint32_t MIN_RUN = 24;
+static_assert((audio_t::PATTERN_BITS & (audio_t::PATTERN_BITS - 1)) == 0, "pattern must split the phase evenly");
+
+} // namespace
+
+audio_generator_t::audio_generator_t(uint32_t sample_rate) noexcept
+    : sample_rate(sample_rate)
+{}
+
+void audio_generator_t::generate(std::chrono::nanoseconds duration, std::chrono::nanoseconds audible, const audio_t& audio, std::vector<int16_t>& samples) {
+    const auto count = take_samples(duration);
+    const auto audible_count = std::min<size_t>(count, static_cast<size_t>(std::max<int64_t>(audible.count(), 0) * sample_rate / NANOSECONDS_PER_SECOND));
+
+    const auto offset = samples.size();
+    samples.resize(offset + count);
+    resample(audio, samples.data() + offset, audible_count);
+    std::fill(samples.begin() + static_cast<std::ptrdiff_t>(offset + audible_count), samples.end(), int16_t{0});
+}
+
+size_t audio_generator_t::take_samples(std::chrono::nanoseconds duration) noexcept {
+    fraction += static_cast<uint64_t>(std::max<int64_t>(duration.count(), 0)) * sample_rate;
+    const auto count = fraction / NANOSECONDS_PER_SECOND;
+    fraction %= NANOSECONDS_PER_SECOND;
+    return static_cast<size_t>(count);
+}
+
+void audio_generator_t::resample(const audio_t& audio, int16_t* samples, size_t count) noexcept {
+    // phase advance per sample, at least one, so every run ends
+    const auto step = static_cast<uint32_t>(std::max(1.0, std::round(audio.get_rate() / sample_rate * static_cast<double>(uint64_t{1} << PHASE_SHIFT))));
+
+    // short runs do not pay for their fills, every sample is looked up in the pattern then
+    if (step > (uint32_t{1} << PHASE_SHIFT) / MIN_RUN) {
+        std::array<int16_t, audio_t::PATTERN_BITS> levels;
+        for (size_t bit = 0; bit < levels.size(); ++bit) {
+            levels[bit] = audio.get_bit(bit) ? AMPLITUDE : static_cast<int16_t>(-AMPLITUDE);
+        }
+        for (size_t i = 0; i < count; ++i) {
+            samples[i] = levels[static_cast<uint32_t>(phase + static_cast<uint32_t>(i) * step) >> PHASE_SHIFT];
+        }
+        phase += static_cast<uint32_t>(count) * step;
+        return;
+    }
+
+    for (size_t written = 0; written < count;) {
+        const auto bit = phase >> PHASE_SHIFT;
+        // samples, that still fall into the bit
+        const auto until_next_bit = (uint64_t{bit + 1} << PHASE_SHIFT) - phase;
+        const auto run = std::min<size_t>(count - written, static_cast<size_t>((until_next_bit + step - 1) / step));
+
+        std::fill_n(samples + written, run, audio.get_bit(bit) ? AMPLITUDE : static_cast<int16_t>(-AMPLITUDE));
+        written += run;
+        phase += static_cast<uint32_t>(run) * step;
+    }
+}
+
+} // namespace chip8
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+#include <core/common.h>
+
+
+namespace chip8 {
+
+/**
+ * Expands the buzzer into signed 16-bit mono PCM at the sample rate of the host, e.g. for sound_system_iface_t::play_sound.
+ * Every bit of the pattern covers a run of equal samples: long runs of low pitches are filled with wide stores,
+ * high pitches look every sample up in a table of the pattern, so a frame of sound costs about as much as writing it.
+ * Position in the pattern carries over between calls, consecutive frames join without clicks.
+ */
+struct audio_generator_t {
+    static inline constexpr int16_t AMPLITUDE = 8192;
+
+    explicit audio_generator_t(uint32_t sample_rate) noexcept;
+
+    // appends samples of `duration`: the pattern through the first `audible` part of it, silence after it
+    void generate(std::chrono::nanoseconds duration, std::chrono::nanoseconds audible, const audio_t& audio, std::vector<int16_t>& samples);
+
+    uint32_t get_sample_rate() const noexcept {
+        return sample_rate;
+    }
+
+private:
+    // samples, that `duration` takes from now, the fractions are carried over to the next call
+    size_t take_samples(std::chrono::nanoseconds duration) noexcept;
+
+    void resample(const audio_t& audio, int16_t* samples, size_t count) noexcept;
+
+    uint32_t sample_rate;
+    // position in the pattern, the whole range of uint32_t is one loop through its bits
+    uint32_t phase = 0;
+    // nanoseconds times sample rate, that did not make a whole sample yet
+    uint64_t fraction = 0;
+};
+
+} // namespace chip8
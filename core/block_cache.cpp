@@ -0,0 +1,197 @@
+#include <core/block_cache.h>
+
+#include <algorithm>
+
+#include <core/idle_loop.h>
+#include <core/instruction_decoder.h>
+#include <core/instructions.h>
+#include <core/profiler.h>
+
+
+namespace chip8 {
+
+namespace {
+
+using flow_t = block_cache_t::flow_t;
+
+// how control leaves the instruction, see block_cache_t::flow_t
+flow_t get_flow(opcode_t opcode, vm_t::settings_t::emulator_type_t emulator_type, const quirks_t& quirks) noexcept {
+    static constexpr dispatch_table_t::value_type SKIPS[] = {
+        instructions::SE_VX_BYTE.executor,
+        instructions::SNE_VX_BYTE.executor,
+        instructions::SE_VX_VY.executor,
+        instructions::SNE_VX_VY.executor,
+        instructions::SKP_VX.executor,
+        instructions::SKNP_VX.executor,
+    };
+    static constexpr dispatch_table_t::value_type ENDS[] = {
+        instructions::RET.executor,
+        instructions::JP_ADDR.executor,
+        instructions::CALL_ADDR.executor,
+        instructions::JP_V0_ADDR.executor,
+        instructions::LD_VX_K.executor,
+        instructions::LD_B_VX.executor,
+        instructions::LD_I_VX.executor,
+    };
+
+    // dispatch table might hold executors, specialized for the quirks, decoder has the generic ones
+    const auto instruction = decode_instruction(opcode, emulator_type);
+    if (!instruction) {
+        return flow_t::END;
+    }
+
+    const auto executor = instruction->get().executor;
+    if (quirks.display_wait && (executor == instructions::DRW_VX_VY_N.executor || executor == instructions::DRW_VX_VY_0.executor)) {
+        return flow_t::END;
+    }
+    if (std::find(std::begin(ENDS), std::end(ENDS), executor) != std::end(ENDS)) {
+        return flow_t::END;
+    }
+    if (std::find(std::begin(SKIPS), std::end(SKIPS), executor) != std::end(SKIPS)) {
+        return flow_t::SKIP;
+    }
+    return flow_t::NEXT;
+}
+
+} // namespace
+
+
+block_cache_t::block_cache_t(vm_t& vm)
+    : vm(vm)
+{}
+
+fault_t block_cache_t::run(uint64_t count) {
+    // local reference is kept in a register, the member one is loaded again after every executor
+    auto& vm = this->vm;
+
+    // memory might have been loaded since last run
+    consume_written_memory();
+
+    // blocks run back to back, timers are advanced once per chunk up to the next tick, as in the interpreter
+    while (count > 0) {
+        const auto chunk = std::min(count, vm.instructions_until_tick());
+        uint64_t executed = 0;
+
+        while (executed < chunk) {
+            const auto pc = vm.pc;
+            if ((pc & ~(MEMORY_SIZE - 2)) != 0) [[unlikely]] {
+                // odd or out of memory pc, instruction is fetched as the interpreter does
+                const auto opcode = opcode_t{static_cast<uint16_t>(vm.memory[pc & (MEMORY_SIZE - 1)] << 8 | vm.memory[(pc + 1u) & (MEMORY_SIZE - 1)])};
+                profile_instruction(vm, pc, opcode);
+                vm.dispatch_table[opcode.bytes](vm, opcode);
+                if (vm.fault != fault_kind_t::NONE) {
+                    vm.advance_timers(executed);
+                    consume_written_memory();
+                    return vm.take_fault();
+                }
+                ++executed;
+                consume_written_memory();
+                continue;
+            }
+
+            if (entries[pc / 2].flow == flow_t::NONE) {
+                decode(pc / 2);
+            }
+
+            // instructions of the block up to its end, or up to the end of the chunk
+            const auto* entry = &entries[pc / 2];
+            for (;;) {
+                const auto at = vm.pc;
+                const auto opcode = entry->opcode;
+                profile_instruction(vm, at, opcode);
+                vm.dispatch_table[opcode.bytes](vm, opcode);
+
+                if (entry->flow == flow_t::END) {
+                    // faulted instruction stays at its pc, so it did not run
+                    if (vm.fault != fault_kind_t::NONE) [[unlikely]] {
+                        vm.advance_timers(executed);
+                        consume_written_memory();
+                        return vm.take_fault();
+                    }
+                    ++executed;
+
+                    // jump at the end of the block might close an idle loop
+                    if (is_idle_loop_jump(opcode, at)) {
+                        executed += skip_idle_loop(vm, chunk - executed);
+                    }
+
+                    // the rest of the block and the ones after it might be stale now
+                    if ((vm.written_memory.dirty_words & code_words) != 0) [[unlikely]] {
+                        consume_written_memory();
+                    }
+                    break;
+                }
+
+                ++executed;
+                if (executed == chunk) {
+                    break;
+                }
+                // taken skip stays in the block, unless the skipped instruction is the last one of it
+                if (entry->flow == flow_t::SKIP && vm.pc != at + 2 && (++entry)->flow == flow_t::END) {
+                    break;
+                }
+                ++entry;
+            }
+        }
+
+        vm.advance_timers(chunk);
+        count -= chunk;
+    }
+
+    return fault_t{};
+}
+
+void block_cache_t::decode(size_t index) {
+    // up to the end of the block or up to the first decoded instruction, the rest of the block is decoded already
+    for (; index < entries.size() && entries[index].flow == flow_t::NONE; ++index) {
+        const size_t address = index * 2;
+        code_words |= uint64_t{1} << (address / memory_bitmap_t::WORD_BITS);
+        const auto opcode = opcode_t{static_cast<uint16_t>(vm.memory[address] << 8 | vm.memory[address + 1])};
+        entries[index] = entry_t{
+            .opcode = opcode,
+            // next_instruction() leaves the memory at the last one
+            .flow = index + 1 == entries.size() ? flow_t::END : get_flow(opcode, vm.settings.emulator_type, vm.quirks),
+        };
+
+        if (entries[index].flow == flow_t::END) {
+            break;
+        }
+    }
+}
+
+void block_cache_t::drop(size_t index) noexcept {
+    // every instruction, that runs into this one, is dropped with it
+    entries[index].flow = flow_t::NONE;
+    while (index > 0 && entries[index - 1].flow != flow_t::NONE && entries[index - 1].flow != flow_t::END) {
+        entries[--index].flow = flow_t::NONE;
+    }
+}
+
+void block_cache_t::consume_written_memory() noexcept {
+    // stores into data, that is not near any decoded instruction, are the common case,
+    // they are left marked, as the interpreter leaves them
+    if ((vm.written_memory.dirty_words & code_words) == 0) {
+        return;
+    }
+    vm.written_memory.for_each([this](size_t address) { invalidate(address, 1); });
+    vm.written_memory.clear();
+}
+
+void block_cache_t::invalidate(size_t offset, size_t size) noexcept {
+    size = std::min(size, MEMORY_SIZE);
+    for (size_t i = 0; i < size; ++i) {
+        const size_t index = (offset + i) % MEMORY_SIZE / 2;
+        if (entries[index].flow != flow_t::NONE) {
+            drop(index);
+        }
+    }
+}
+
+void block_cache_t::flush() noexcept {
+    for (auto& entry : entries) {
+        entry.flow = flow_t::NONE;
+    }
+    code_words = 0;
+}
+
+} // namespace chip8
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+#include <core/common.h>
+#include <core/vm.h>
+
+
+namespace chip8 {
+
+/**
+ * Cache of pre-decoded basic blocks, portable middle tier between the interpreter and the JIT.
+ *
+ * Instructions are decoded once per even address into the opcode and the way control leaves it,
+ * executors come from the dispatch table, so the whole cache is 4 bytes per instruction and stays in L1.
+ * Block runs from any pc up to the first jump, call, return, wait or store, so a block is entered
+ * in the middle without decoding it again; taken skips stay inside of the block.
+ * Blocks are executed in a tight loop. Instructions at odd addresses are interpreted.
+ *
+ * Stores of the guest and vm_t::load_data mark vm_t::written_memory,
+ * blocks, that overlap marked addresses, are dropped before the next instruction.
+ */
+struct block_cache_t {
+    explicit block_cache_t(vm_t& vm);
+
+    block_cache_t(const block_cache_t&) = delete;
+    block_cache_t& operator=(const block_cache_t&) = delete;
+
+    // runs exactly `count` guest instructions, unless guest faults
+    fault_t run(uint64_t count);
+
+    // drops blocks, that overlap [offset, offset + size) of guest memory
+    void invalidate(size_t offset, size_t size) noexcept;
+
+    // drops all blocks
+    void flush() noexcept;
+
+    enum class flow_t : uint8_t {
+        // not decoded yet
+        NONE,
+        // goes on to the next instruction
+        NEXT,
+        // goes on to the next instruction or the one after it
+        SKIP,
+        // last instruction of the block
+        END,
+    };
+
+    struct entry_t {
+        opcode_t opcode;
+        flow_t flow;
+    };
+
+private:
+    void decode(size_t index);
+    void drop(size_t index) noexcept;
+    void consume_written_memory() noexcept;
+
+    vm_t& vm;
+
+    // instructions by pc / 2
+    std::array<entry_t, MEMORY_SIZE / 2> entries{};
+    // one bit per word of vm_t::written_memory, that has decoded instructions in it, dropping them leaves it set
+    uint64_t code_words = 0;
+};
+
+} // namespace chip8
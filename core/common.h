@@ -1,8 +1,13 @@
 #pragma once
 
+#include <algorithm>
 #include <array>
+#include <bit>
+#include <bitset>
+#include <cmath>
 #include <cstdint>
 #include <string_view>
+#include <utility>
 
 
 namespace chip8 {
@@ -12,18 +17,216 @@ using bytes_owned = std::basic_string<uint8_t>;
 using bytes_stream = std::basic_stringstream<uint8_t>;
 
 inline constexpr size_t MEMORY_SIZE = 4096;
+static_assert((MEMORY_SIZE & (MEMORY_SIZE - 1)) == 0, "guest addresses are masked with MEMORY_SIZE - 1");
 inline constexpr size_t ROM_OFFSET = 0x200;
-inline constexpr size_t VIDEO_WIDTH = 64;
-inline constexpr size_t VIDEO_HEIGHT = 32;
+// the largest screen, hi-res of SCHIP and XO-CHIP; low resolution uses its top left quarter
+inline constexpr size_t VIDEO_WIDTH = 128;
+inline constexpr size_t VIDEO_HEIGHT = 64;
 inline constexpr size_t VIDEO_SIZE = VIDEO_WIDTH * VIDEO_HEIGHT;
+inline constexpr size_t LORES_VIDEO_WIDTH = 64;
+inline constexpr size_t LORES_VIDEO_HEIGHT = 32;
+// bit planes of XO-CHIP, CHIP-8 and SCHIP draw on the first one only
+inline constexpr size_t VIDEO_PLANES = 2;
 inline constexpr size_t STACK_SIZE = 16;
 inline constexpr size_t KEYPAD_SIZE = 16;
 inline constexpr size_t REGISTERS_SIZE = 16;
 inline constexpr size_t KEYBOARD_SIZE = 16;
 
 inline constexpr size_t FONTSET_SIZE = 80;
+inline constexpr size_t AUDIO_PATTERN_SIZE = 16;
 
-using video_memory_t = std::array<std::array<bool, VIDEO_WIDTH>, VIDEO_HEIGHT>;
+inline constexpr size_t OPCODES_COUNT = 0x10000;
+
+// set of rows of the screen, bit i stands for row i
+using video_rows_t = std::bitset<VIDEO_HEIGHT>;
+
+// one bit per pixel in every plane, packed into words, the most significant bit is the leftmost pixel.
+// Low resolution keeps to the first word of the first LORES_VIDEO_HEIGHT rows, the rest stays zero
+struct video_memory_t {
+    using word_t = uint64_t;
+    static inline constexpr size_t WORD_BITS = 64;
+    static inline constexpr size_t ROW_WORDS = VIDEO_WIDTH / WORD_BITS;
+    static_assert(LORES_VIDEO_WIDTH == WORD_BITS, "low resolution row must fit one word exactly");
+
+    using row_t = std::array<word_t, ROW_WORDS>;
+    using plane_t = std::array<row_t, VIDEO_HEIGHT>;
+
+    std::array<plane_t, VIDEO_PLANES> planes{};
+    bool hires = false;
+    // mask of planes, that instructions draw on, clear and scroll
+    uint8_t selected_planes = 0x1;
+
+    size_t width() const noexcept {
+        return hires ? VIDEO_WIDTH : LORES_VIDEO_WIDTH;
+    }
+
+    size_t height() const noexcept {
+        return hires ? VIDEO_HEIGHT : LORES_VIDEO_HEIGHT;
+    }
+
+    // bit p of the color is the pixel in plane p
+    uint8_t get_color(size_t row, size_t col) const noexcept {
+        uint8_t color = 0;
+        for (size_t plane = 0; plane < VIDEO_PLANES; ++plane) {
+            const auto word = planes[plane][row][col / WORD_BITS];
+            color |= ((word >> (WORD_BITS - 1 - col % WORD_BITS)) & 0x1) << plane;
+        }
+        return color;
+    }
+
+    bool get_pixel(size_t row, size_t col) const noexcept {
+        return get_color(row, col) != 0;
+    }
+
+    bool is_same_row(const video_memory_t& other, size_t row) const noexcept {
+        for (size_t plane = 0; plane < VIDEO_PLANES; ++plane) {
+            if (planes[plane][row] != other.planes[plane][row]) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void clear() noexcept {
+        clear(static_cast<uint8_t>((1u << VIDEO_PLANES) - 1));
+    }
+
+    void clear(uint8_t mask) noexcept {
+        for (size_t plane = 0; plane < VIDEO_PLANES; ++plane) {
+            if (mask & (1u << plane)) {
+                planes[plane].fill(row_t{});
+            }
+        }
+    }
+
+    // switches resolution, the screen is cleared then
+    void set_hires(bool value) noexcept {
+        hires = value;
+        clear();
+    }
+
+    // scrolls move whole rows or shift whole words of selected planes, pixels, that leave the screen, are lost
+
+    void scroll_down(size_t count) noexcept {
+        const auto rows = height();
+        count = std::min(count, rows);
+        for_each_selected([rows, count](plane_t& plane) {
+            std::copy_backward(plane.begin(), plane.begin() + (rows - count), plane.begin() + rows);
+            std::fill_n(plane.begin(), count, row_t{});
+        });
+    }
+
+    // count of pixels is in (0, WORD_BITS)
+    void scroll_right(size_t count) noexcept {
+        const bool wide = hires;
+        for_each_selected([wide, count](plane_t& plane) {
+            for (auto& row : plane) {
+                if (wide) {
+                    row[1] = (row[1] >> count) | (row[0] << (WORD_BITS - count));
+                }
+                row[0] >>= count;
+            }
+        });
+    }
+
+    void scroll_left(size_t count) noexcept {
+        for_each_selected([count](plane_t& plane) {
+            for (auto& row : plane) {
+                row[0] = (row[0] << count) | (row[1] >> (WORD_BITS - count));
+                row[1] <<= count;
+            }
+        });
+    }
+
+    bool operator==(const video_memory_t&) const noexcept = default;
+
+private:
+    template <typename F>
+    void for_each_selected(F&& f) {
+        for (size_t plane = 0; plane < VIDEO_PLANES; ++plane) {
+            if (selected_planes & (1u << plane)) {
+                f(planes[plane]);
+            }
+        }
+    }
+};
+
+// XO-CHIP buzzer: pattern of 1-bit samples, the most significant bit first, is played in a loop at the rate of pitch
+struct audio_t {
+    static inline constexpr uint8_t DEFAULT_PITCH = 64;
+    static inline constexpr size_t PATTERN_BITS = AUDIO_PATTERN_SIZE * 8;
+
+    // square wave, until the guest loads its own pattern
+    std::array<uint8_t, AUDIO_PATTERN_SIZE> pattern{
+        0x00, 0xFF, 0x00, 0xFF, 0x00, 0xFF, 0x00, 0xFF, 0x00, 0xFF, 0x00, 0xFF, 0x00, 0xFF, 0x00, 0xFF,
+    };
+    uint8_t pitch = DEFAULT_PITCH;
+
+    // bits of the pattern per second: 4000 at the default pitch, twice as many every 48 steps up
+    double get_rate() const noexcept {
+        return 4000.0 * std::exp2((static_cast<int>(pitch) - DEFAULT_PITCH) / 48.0);
+    }
+
+    bool get_bit(size_t bit) const noexcept {
+        return (pattern[bit / 8] >> (7 - bit % 8)) & 0x1;
+    }
+
+    bool operator==(const audio_t&) const noexcept = default;
+};
+
+// one bit per byte of guest memory, addresses wrap around memory size
+struct memory_bitmap_t {
+    static inline constexpr size_t WORD_BITS = 64;
+    static inline constexpr size_t PAGE_SIZE = WORD_BITS;
+    static_assert(MEMORY_SIZE / PAGE_SIZE <= 64, "pages must fit one word");
+
+    std::array<uint64_t, MEMORY_SIZE / WORD_BITS> words{};
+    // one bit per word, that has bits set, so clear() and for_each() touch only those
+    uint64_t dirty_words = 0;
+    // one bit per page, clear() leaves it as is, take_pages() resets it
+    uint64_t pages = 0;
+
+    void set(size_t offset, size_t size) noexcept {
+        for (size_t i = 0; i < size && i < MEMORY_SIZE; ++i) {
+            const size_t address = (offset + i) % MEMORY_SIZE;
+            words[address / WORD_BITS] |= uint64_t{1} << (address % WORD_BITS);
+            dirty_words |= uint64_t{1} << (address / WORD_BITS);
+            pages |= uint64_t{1} << (address / PAGE_SIZE);
+        }
+    }
+
+    // pages, written since the previous call
+    uint64_t take_pages() noexcept {
+        return std::exchange(pages, 0);
+    }
+
+    bool any() const noexcept {
+        return dirty_words != 0;
+    }
+
+    bool test(size_t address) const noexcept {
+        address %= MEMORY_SIZE;
+        return (words[address / WORD_BITS] >> (address % WORD_BITS)) & 0x1;
+    }
+
+    void clear() noexcept {
+        for (uint64_t dirty = dirty_words; dirty != 0; dirty &= dirty - 1) {
+            words[static_cast<size_t>(std::countr_zero(dirty))] = 0;
+        }
+        dirty_words = 0;
+    }
+
+    // calls f(address) for every set bit
+    template <typename F>
+    void for_each(F&& f) const {
+        for (uint64_t dirty = dirty_words; dirty != 0; dirty &= dirty - 1) {
+            const auto word = static_cast<size_t>(std::countr_zero(dirty));
+            for (uint64_t bits = words[word]; bits != 0; bits &= bits - 1) {
+                f(word * WORD_BITS + static_cast<size_t>(std::countr_zero(bits)));
+            }
+        }
+    }
+};
 
 inline constexpr uint8_t CHIP8_STANDARD_FONTSET[FONTSET_SIZE] = {
 	0xF0, 0x90, 0x90, 0x90, 0xF0,		// 0
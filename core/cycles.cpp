@@ -0,0 +1,52 @@
+#include <core/cycles.h>
+
+#include <memory>
+#include <string_view>
+
+#include <core/instruction_decoder.h>
+
+
+namespace chip8 {
+
+namespace {
+
+uint16_t get_cosmac_vip_cycles(std::string_view name, opcode_t opcode) {
+    // sprites and register dumps take longer with every row or register
+    if (name == "DRW_VX_VY_N") return static_cast<uint16_t>(280 + 100 * opcode.get_n());
+    if (name == "LD_I_VX" || name == "LD_VX_I") return static_cast<uint16_t>(120 + 40 * (opcode.get_x() + 1));
+
+    if (name == "CLS") return 3100;
+    if (name == "LD_B_VX") return 900;
+    if (name == "RND_VX_BYTE") return 190;
+    if (name == "OR_VX_VY" || name == "AND_VX_VY" || name == "XOR_VX_VY" || name == "ADD_VX_VY"
+        || name == "SUB_VX_VY" || name == "SHR_VX_VY" || name == "SUBN_VX_VY" || name == "SHL_VX_VY") return 160;
+    if (name == "LD_VX_K") return 150;
+    if (name == "CALL_ADDR") return 130;
+    if (name == "JP_V0_ADDR" || name == "SKP_VX" || name == "SKNP_VX") return 120;
+    if (name == "RET" || name == "SE_VX_VY" || name == "SNE_VX_VY" || name == "LD_VX_VY"
+        || name == "ADD_I_VX" || name == "LD_F_VX") return 110;
+    if (name == "JP_ADDR" || name == "SE_VX_BYTE" || name == "SNE_VX_BYTE" || name == "ADD_VX_BYTE"
+        || name == "LD_I_ADDR") return 100;
+    if (name == "LD_VX_DT" || name == "LD_DT_VX" || name == "LD_ST_VX") return 90;
+
+    // LD_VX_BYTE and UNKNOWN
+    return 80;
+}
+
+} // namespace
+
+
+const cycle_costs_t& get_cosmac_vip_cycle_costs() {
+    static const auto costs = [] {
+        auto costs = std::make_unique<cycle_costs_t>();
+        for (size_t bytes = 0; bytes < OPCODES_COUNT; ++bytes) {
+            const auto opcode = opcode_t{static_cast<uint16_t>(bytes)};
+            const auto name = visit_instruction(opcode, [](const auto& instruction) { return instruction.name; });
+            (*costs)[bytes] = get_cosmac_vip_cycles(name, opcode);
+        }
+        return costs;
+    }();
+    return *costs;
+}
+
+} // namespace chip8
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstdint>
+
+#include <core/vm.h>
+
+
+namespace chip8 {
+
+/**
+ * Timing of the original COSMAC VIP interpreter, for settings.cycles_per_frame and settings.cycle_costs.
+ * Costs are rough machine cycles of the interpreter routines with fetch and decode, taken branches
+ * and waits for display interrupt are not modelled; it is close enough for games, that were tuned on VIP.
+ */
+inline constexpr uint32_t COSMAC_VIP_CYCLES_PER_FRAME = 3668;
+
+// table is built on first request and lives forever
+const cycle_costs_t& get_cosmac_vip_cycle_costs();
+
+} // namespace chip8
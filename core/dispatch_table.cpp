@@ -0,0 +1,63 @@
+#include <core/dispatch_table.h>
+
+#include <memory>
+#include <stdexcept>
+#include <type_traits>
+
+#include <core/instruction_decoder.h>
+#include <core/instructions.h>
+
+
+namespace chip8 {
+
+namespace {
+
+template <typename Quirks>
+std::unique_ptr<const dispatch_table_t> build_dispatch_table(vm_t::settings_t::emulator_type_t emulator_type) {
+    auto table = std::make_unique<dispatch_table_t>();
+
+    for (size_t bytes = 0; bytes < OPCODES_COUNT; ++bytes) {
+        (*table)[bytes] = visit_instruction(opcode_t{static_cast<uint16_t>(bytes)}, [](const auto& instruction) -> dispatch_table_t::value_type {
+            if constexpr (std::is_same_v<Quirks, quirks_t>) {
+                return instruction.executor;
+            } else {
+                using impl_t = decltype(instruction.impl);
+                return [](vm_t& vm, const opcode_t& opcode) { impl_t{}(vm, opcode, Quirks{}); };
+            }
+        }, emulator_type);
+    }
+
+    return table;
+}
+
+template <typename Quirks>
+const dispatch_table_t& get_dispatch_table_for_type(vm_t::settings_t::emulator_type_t emulator_type) {
+    // every type gets its own table, so type-specific opcodes do not leak into other types
+    switch (emulator_type) {
+        case vm_t::settings_t::CHIP_8: {
+            static const auto table = build_dispatch_table<Quirks>(emulator_type);
+            return *table;
+        }
+        case vm_t::settings_t::SCHIP1_1: {
+            static const auto table = build_dispatch_table<Quirks>(emulator_type);
+            return *table;
+        }
+        case vm_t::settings_t::XO_CHIP: {
+            static const auto table = build_dispatch_table<Quirks>(emulator_type);
+            return *table;
+        }
+    }
+
+    throw std::invalid_argument("unknown emulator type");
+}
+
+} // namespace
+
+
+const dispatch_table_t& get_dispatch_table(vm_t::settings_t::emulator_type_t emulator_type, const quirks_t& quirks) {
+    return visit_quirks(quirks, [emulator_type](auto profile) -> const dispatch_table_t& {
+        return get_dispatch_table_for_type<decltype(profile)>(emulator_type);
+    });
+}
+
+} // namespace chip8
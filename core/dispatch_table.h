@@ -0,0 +1,19 @@
+#pragma once
+
+#include <core/common.h>
+#include <core/quirks.h>
+#include <core/vm.h>
+
+
+namespace chip8 {
+
+/**
+ * Returns the decoder table for given emulator type and quirks.
+ * Table is built from decode_instruction once per type and quirks profile, on first request, and lives forever.
+ * Profiles from quirks.h get instructions instantiated with their quirks, any other combination
+ * gets instructions, that check quirks at runtime.
+ * Opcodes, that are not recognized by decoder, are mapped to instructions::UNKNOWN.
+ */
+const dispatch_table_t& get_dispatch_table(vm_t::settings_t::emulator_type_t emulator_type, const quirks_t& quirks);
+
+} // namespace chip8
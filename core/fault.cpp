@@ -0,0 +1,38 @@
+#include <core/fault.h>
+
+#include <iomanip>
+#include <sstream>
+
+#include <core/instruction_decoder.h>
+
+
+namespace chip8 {
+
+std::string_view to_string(fault_kind_t kind) noexcept {
+    switch (kind) {
+        case fault_kind_t::NONE: return "none";
+        case fault_kind_t::UNKNOWN_OPCODE: return "unknown opcode";
+        case fault_kind_t::STACK_UNDERFLOW: return "stack underflow";
+        case fault_kind_t::STACK_OVERFLOW: return "stack overflow";
+        case fault_kind_t::KEY_WAIT: return "key wait";
+    }
+    return "invalid fault";
+}
+
+std::string fault_t::describe() const {
+    const auto name = visit_instruction(opcode, [](const auto& instruction) { return instruction.name; });
+
+    std::stringstream report;
+    report << "fault: " << to_string(kind) << " in " << name << std::endl;
+    report << "pc: 0x" << std::hex << std::setw(4) << std::setfill('0') << pc << std::endl;
+    report << "opcode: 0x" << std::hex << std::setw(4) << std::setfill('0') << opcode.bytes << std::endl;
+    report << "sp: 0x" << std::hex << std::setw(2) << std::setfill('0') << static_cast<uint16_t>(sp) << std::endl;
+    report << "I: 0x" << std::hex << std::setw(4) << std::setfill('0') << I << std::endl;
+    report << "V: ";
+    for (const auto& v : V) {
+        report << std::hex << std::setw(2) << std::setfill('0') << static_cast<uint16_t>(v) << " ";
+    }
+    return report.str();
+}
+
+} // namespace chip8
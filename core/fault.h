@@ -0,0 +1,49 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include <core/common.h>
+
+
+namespace chip8 {
+
+enum class fault_kind_t : uint8_t {
+    NONE,
+    UNKNOWN_OPCODE,     // decoder does not know the opcode
+    STACK_UNDERFLOW,    // RET with empty stack
+    STACK_OVERFLOW,     // CALL_ADDR with full stack
+    KEY_WAIT,           // not an error: LD_VX_K found no key on a keyboard, that does not block
+};
+
+std::string_view to_string(fault_kind_t kind) noexcept;
+
+/**
+ * Guest fault, returned by the run APIs instead of an exception.
+ * Faulted instruction changes nothing and is not counted as executed, pc stays at it,
+ * so the next run faults again right away (or gets the key after KEY_WAIT).
+ */
+struct fault_t {
+    fault_kind_t kind = fault_kind_t::NONE;
+    uint16_t pc = 0;
+    opcode_t opcode{0};
+    uint16_t I = 0;
+    uint8_t sp = 0;
+    std::array<uint8_t, REGISTERS_SIZE> V{};
+
+    explicit operator bool() const noexcept {
+        return kind != fault_kind_t::NONE;
+    }
+
+    bool operator==(const fault_t& other) const noexcept {
+        return kind == other.kind && pc == other.pc && opcode.bytes == other.opcode.bytes
+            && I == other.I && sp == other.sp && V == other.V;
+    }
+
+    // report for humans, with all registers
+    std::string describe() const;
+};
+
+} // namespace chip8
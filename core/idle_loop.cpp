@@ -0,0 +1,114 @@
+#include <core/idle_loop.h>
+
+#include <algorithm>
+
+#include <core/instruction_decoder.h>
+#include <core/instructions.h>
+
+
+namespace chip8 {
+
+namespace {
+
+opcode_t get_opcode(const vm_t& vm, size_t address) noexcept {
+    return opcode_t{static_cast<uint16_t>(vm.memory[address] << 8 | vm.memory[address + 1])};
+}
+
+dispatch_table_t::value_type get_executor(opcode_t opcode) noexcept {
+    const auto instruction = decode_instruction(opcode);
+    return instruction ? instruction->get().executor : nullptr;
+}
+
+bool is_load(dispatch_table_t::value_type executor) noexcept {
+    return executor == instructions::LD_VX_DT.executor || executor == instructions::LD_VX_BYTE.executor;
+}
+
+bool is_skip(dispatch_table_t::value_type executor) noexcept {
+    static constexpr dispatch_table_t::value_type SKIPS[] = {
+        instructions::SE_VX_BYTE.executor,
+        instructions::SNE_VX_BYTE.executor,
+        instructions::SE_VX_VY.executor,
+        instructions::SNE_VX_VY.executor,
+        instructions::SKP_VX.executor,
+        instructions::SKNP_VX.executor,
+    };
+    return std::find(std::begin(SKIPS), std::end(SKIPS), executor) != std::end(SKIPS);
+}
+
+} // namespace
+
+
+std::optional<idle_loop_t> find_idle_loop(const vm_t& vm, uint16_t head) {
+    for (uint8_t length = 1; length <= idle_loop_t::MAX_LENGTH; ++length) {
+        const size_t address = head + 2u * (length - 1);
+        if (address + 1 >= MEMORY_SIZE) {
+            return std::nullopt;
+        }
+
+        const auto opcode = get_opcode(vm, address);
+        const auto executor = get_executor(opcode);
+        if (executor == instructions::JP_ADDR.executor) {
+            if (opcode.get_nnn() != head) {
+                return std::nullopt;
+            }
+            return idle_loop_t{.head = head, .length = length};
+        }
+
+        // loads go first, the skip is right before the jump
+        const bool previous_is_skip = length > 1 && is_skip(get_executor(get_opcode(vm, address - 2)));
+        if (previous_is_skip || !(is_load(executor) || is_skip(executor))) {
+            return std::nullopt;
+        }
+    }
+    return std::nullopt;
+}
+
+uint64_t skip_idle_loop(vm_t& vm, uint64_t budget) {
+#if PIEX_PROFILING
+    // profile counts every instruction
+    if (vm.profiler != nullptr) {
+        return 0;
+    }
+#endif
+
+    const auto loop = find_idle_loop(vm, vm.pc);
+    if (!loop || budget < loop->length) {
+        return 0;
+    }
+
+    // registers after one iteration, they stay the same after any number of them
+    auto V = vm.V;
+    for (uint8_t i = 0; i + 1 < loop->length; ++i) {
+        const auto opcode = get_opcode(vm, loop->head + 2u * i);
+        const auto executor = get_executor(opcode);
+        const auto x = opcode.get_x();
+        bool skipped = false;
+
+        if (executor == instructions::LD_VX_DT.executor) {
+            V[x] = vm.delay_timer;
+        } else if (executor == instructions::LD_VX_BYTE.executor) {
+            V[x] = opcode.get_kk();
+        } else if (executor == instructions::SE_VX_BYTE.executor) {
+            skipped = V[x] == opcode.get_kk();
+        } else if (executor == instructions::SNE_VX_BYTE.executor) {
+            skipped = V[x] != opcode.get_kk();
+        } else if (executor == instructions::SE_VX_VY.executor) {
+            skipped = V[x] == V[opcode.get_y()];
+        } else if (executor == instructions::SNE_VX_VY.executor) {
+            skipped = V[x] != V[opcode.get_y()];
+        } else {
+            const bool pressed = vm.keyboard_system.is_pressed(static_cast<keyboard_key_t>(V[x]));
+            skipped = (executor == instructions::SKP_VX.executor) == pressed;
+        }
+
+        // loop is left in this iteration, it runs as usual
+        if (skipped) {
+            return 0;
+        }
+    }
+
+    vm.V = V;
+    return budget / loop->length * loop->length;
+}
+
+} // namespace chip8
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+
+#include <core/common.h>
+#include <core/vm.h>
+
+
+namespace chip8 {
+
+/**
+ * Idle loop: a short loop, that only polls delay timer or keys, e.g. `LD Vx, DT; SE Vx, 0; JP back`.
+ * Loads into registers (LD_VX_DT, LD_VX_BYTE), then at most one skip (SE, SNE, SKP, SKNP), that leaves the loop,
+ * then JP_ADDR back to the first instruction. `JP` to itself, that ends many ROMs, is an idle loop too.
+ *
+ * Delay timer only changes at ticks and every iteration loads the same values, so until the next tick
+ * every iteration does the same as the first one. Engines skip whole iterations at once instead of running them,
+ * vm ends up in the same state, as if they were run. Keys are polled once for all skipped iterations,
+ * with real time timers vm then sleeps in the tick until the next frame.
+ */
+struct idle_loop_t {
+    static inline constexpr uint8_t MAX_LENGTH = 4;
+
+    uint16_t head;
+    // instructions, the jump back included
+    uint8_t length;
+};
+
+// loop, that starts at head, if it is an idle one
+std::optional<idle_loop_t> find_idle_loop(const vm_t& vm, uint16_t head);
+
+// true, if opcode at pc is a jump back, that might close an idle loop; cheap check for engines before skip_idle_loop
+inline bool is_idle_loop_jump(opcode_t opcode, uint16_t pc) noexcept {
+    return (opcode.bytes & 0xF000) == 0x1000 && opcode.get_nnn() <= pc
+        && pc - opcode.get_nnn() < 2 * idle_loop_t::MAX_LENGTH;
+}
+
+// skips up to `budget` instructions of the idle loop at vm.pc, whole iterations only, timers are left to the caller;
+// returns, how many instructions were skipped, 0 if there is no idle loop or it would be left now
+uint64_t skip_idle_loop(vm_t& vm, uint64_t budget);
+
+} // namespace chip8
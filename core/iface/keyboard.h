@@ -3,6 +3,7 @@
 #include <cstdint>
 #include <functional>
 #include <memory>
+#include <optional>
 
 #include <core/common.h>
 
@@ -14,6 +15,11 @@ struct keyboard_system_iface_t {
 
     virtual bool is_pressed(keyboard_key_t key) = 0;
     virtual keyboard_key_t wait_for_keypress() = 0;
+
+    // key for LD_VX_K; keyboards, that must not block, return nothing, if there is no key yet
+    virtual std::optional<keyboard_key_t> take_keypress() {
+        return wait_for_keypress();
+    }
 };
 
 using keyboard_system_ptr = std::unique_ptr<keyboard_system_iface_t>;
@@ -13,7 +13,9 @@ namespace chip8 {
 struct sound_system_iface_t {
     virtual ~sound_system_iface_t() = default;
 
-    virtual void play_sound(std::chrono::nanoseconds duration) = 0;
+    // called for every `duration` of ticks of timers; the buzzer sounds through the first `audible` part of it
+    // and plays the pattern of `audio`, the rest is silence
+    virtual void play_sound(std::chrono::nanoseconds duration, std::chrono::nanoseconds audible, const audio_t& audio) = 0;
 };
 
 using sound_system_ptr = std::unique_ptr<sound_system_iface_t>;
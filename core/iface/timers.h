@@ -14,6 +14,13 @@ struct timers_system_iface_t {
     virtual ~timers_system_iface_t() = default;
 
     virtual void tick(std::chrono::nanoseconds duration) = 0;
+
+    // `count` ticks in a row, engines advance timers by many frames at once
+    virtual void tick_many(std::chrono::nanoseconds duration, uint64_t count) {
+        for (; count > 0; --count) {
+            tick(duration);
+        }
+    }
 };
 
 using timers_system_ptr = std::unique_ptr<timers_system_iface_t>;
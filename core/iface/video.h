@@ -11,7 +11,9 @@ namespace chip8 {
 struct video_system_iface_t {
     virtual ~video_system_iface_t() = default;
 
-    virtual void render(const video_memory_t&) = 0;
+    // called at most once per tick of timers, only when some rows differ from the previous frame,
+    // dirty_rows are the ones, that changed since then
+    virtual void render(const video_memory_t& video_memory, const video_rows_t& dirty_rows) = 0;
 };
 
 using video_system_ptr = std::unique_ptr<video_system_iface_t>;
@@ -5,56 +5,88 @@
 
 namespace chip8 {
 
-inline std::optional<std::reference_wrapper<const instruction_t>> decode_instruction(opcode_t opcode) {
+/**
+ * Calls visitor with the instruction, that opcode decodes to, or with instructions::UNKNOWN.
+ * Visitor gets the concrete instruction, so it can instantiate generic implementation for its own vm.
+ * SCHIP adds its display opcodes to CHIP-8, XO-CHIP adds plane selection and audio to SCHIP.
+ */
+template <typename Visitor>
+decltype(auto) visit_instruction(opcode_t opcode, Visitor&& visitor, vm_t::settings_t::emulator_type_t emulator_type = vm_t::settings_t::CHIP_8) {
+    const bool schip = emulator_type != vm_t::settings_t::CHIP_8;
+    const bool xo_chip = emulator_type == vm_t::settings_t::XO_CHIP;
+
     switch (opcode.get_nibble<3>()) {
         case 0x0: switch (opcode.get_kk()) {
-            case 0xE0: return std::cref(instructions::CLS);
-            case 0xEE: return std::cref(instructions::RET);
-            default: return std::nullopt;
+            case 0xC0: case 0xC1: case 0xC2: case 0xC3: case 0xC4: case 0xC5: case 0xC6: case 0xC7:
+            case 0xC8: case 0xC9: case 0xCA: case 0xCB: case 0xCC: case 0xCD: case 0xCE: case 0xCF:
+                return schip ? visitor(instructions::SCD_N) : visitor(instructions::UNKNOWN);
+            case 0xE0: return visitor(instructions::CLS);
+            case 0xEE: return visitor(instructions::RET);
+            case 0xFB: return schip ? visitor(instructions::SCR) : visitor(instructions::UNKNOWN);
+            case 0xFC: return schip ? visitor(instructions::SCL) : visitor(instructions::UNKNOWN);
+            case 0xFE: return schip ? visitor(instructions::LOW) : visitor(instructions::UNKNOWN);
+            case 0xFF: return schip ? visitor(instructions::HIGH) : visitor(instructions::UNKNOWN);
+            default: return visitor(instructions::UNKNOWN);
         }
-        case 0x1: return std::cref(instructions::JP_ADDR);
-        case 0x2: return std::cref(instructions::CALL_ADDR);
-        case 0x3: return std::cref(instructions::SE_VX_BYTE);
-        case 0x4: return std::cref(instructions::SNE_VX_BYTE);
-        case 0x5: return std::cref(instructions::SE_VX_VY);
-        case 0x6: return std::cref(instructions::LD_VX_BYTE);
-        case 0x7: return std::cref(instructions::ADD_VX_BYTE);
+        case 0x1: return visitor(instructions::JP_ADDR);
+        case 0x2: return visitor(instructions::CALL_ADDR);
+        case 0x3: return visitor(instructions::SE_VX_BYTE);
+        case 0x4: return visitor(instructions::SNE_VX_BYTE);
+        case 0x5: return visitor(instructions::SE_VX_VY);
+        case 0x6: return visitor(instructions::LD_VX_BYTE);
+        case 0x7: return visitor(instructions::ADD_VX_BYTE);
         case 0x8: switch (opcode.get_n()) {
-            case 0x0: return std::cref(instructions::LD_VX_VY);
-            case 0x1: return std::cref(instructions::OR_VX_VY);
-            case 0x2: return std::cref(instructions::AND_VX_VY);
-            case 0x3: return std::cref(instructions::XOR_VX_VY);
-            case 0x4: return std::cref(instructions::ADD_VX_VY);
-            case 0x5: return std::cref(instructions::SUB_VX_VY);
-            case 0x6: return std::cref(instructions::SHR_VX_VY);
-            case 0x7: return std::cref(instructions::SUBN_VX_VY);
-            case 0xE: return std::cref(instructions::SHL_VX_VY);
-            default: return std::nullopt;
+            case 0x0: return visitor(instructions::LD_VX_VY);
+            case 0x1: return visitor(instructions::OR_VX_VY);
+            case 0x2: return visitor(instructions::AND_VX_VY);
+            case 0x3: return visitor(instructions::XOR_VX_VY);
+            case 0x4: return visitor(instructions::ADD_VX_VY);
+            case 0x5: return visitor(instructions::SUB_VX_VY);
+            case 0x6: return visitor(instructions::SHR_VX_VY);
+            case 0x7: return visitor(instructions::SUBN_VX_VY);
+            case 0xE: return visitor(instructions::SHL_VX_VY);
+            default: return visitor(instructions::UNKNOWN);
         }
-        case 0x9: return std::cref(instructions::SNE_VX_VY);
-        case 0xA: return std::cref(instructions::LD_I_ADDR);
-        case 0xB: return std::cref(instructions::JP_V0_ADDR);
-        case 0xC: return std::cref(instructions::RND_VX_BYTE);
-        case 0xD: return std::cref(instructions::DRW_VX_VY_N);
+        case 0x9: return visitor(instructions::SNE_VX_VY);
+        case 0xA: return visitor(instructions::LD_I_ADDR);
+        case 0xB: return visitor(instructions::JP_V0_ADDR);
+        case 0xC: return visitor(instructions::RND_VX_BYTE);
+        case 0xD: return schip && opcode.get_n() == 0 ? visitor(instructions::DRW_VX_VY_0) : visitor(instructions::DRW_VX_VY_N);
         case 0xE: switch (opcode.get_kk()) {
-            case 0x9E: return std::cref(instructions::SKP_VX);
-            case 0xA1: return std::cref(instructions::SKNP_VX);
-            default: return std::nullopt;
+            case 0x9E: return visitor(instructions::SKP_VX);
+            case 0xA1: return visitor(instructions::SKNP_VX);
+            default: return visitor(instructions::UNKNOWN);
         }
         case 0xF: switch (opcode.get_kk()) {
-            case 0x07: return std::cref(instructions::LD_VX_DT);
-            case 0x0A: return std::cref(instructions::LD_VX_K);
-            case 0x15: return std::cref(instructions::LD_DT_VX);
-            case 0x18: return std::cref(instructions::LD_ST_VX);
-            case 0x1E: return std::cref(instructions::ADD_I_VX);
-            case 0x29: return std::cref(instructions::LD_F_VX);
-            case 0x33: return std::cref(instructions::LD_B_VX);
-            case 0x55: return std::cref(instructions::LD_I_VX);
-            case 0x65: return std::cref(instructions::LD_VX_I);
-            default: return std::nullopt;
+            case 0x01: return xo_chip ? visitor(instructions::PLANE_X) : visitor(instructions::UNKNOWN);
+            case 0x02: return xo_chip && opcode.get_x() == 0 ? visitor(instructions::LD_AUDIO_I) : visitor(instructions::UNKNOWN);
+            case 0x07: return visitor(instructions::LD_VX_DT);
+            case 0x0A: return visitor(instructions::LD_VX_K);
+            case 0x15: return visitor(instructions::LD_DT_VX);
+            case 0x18: return visitor(instructions::LD_ST_VX);
+            case 0x1E: return visitor(instructions::ADD_I_VX);
+            case 0x29: return visitor(instructions::LD_F_VX);
+            case 0x33: return visitor(instructions::LD_B_VX);
+            case 0x3A: return xo_chip ? visitor(instructions::LD_PITCH_VX) : visitor(instructions::UNKNOWN);
+            case 0x55: return visitor(instructions::LD_I_VX);
+            case 0x65: return visitor(instructions::LD_VX_I);
+            default: return visitor(instructions::UNKNOWN);
         }
-        default: return std::nullopt;
+        default: return visitor(instructions::UNKNOWN);
     }
 }
 
+inline std::optional<std::reference_wrapper<const instruction_t>> decode_instruction(
+    opcode_t opcode,
+    vm_t::settings_t::emulator_type_t emulator_type = vm_t::settings_t::CHIP_8
+) {
+    return visit_instruction(opcode, [](const auto& instruction) -> std::optional<std::reference_wrapper<const instruction_t>> {
+        if constexpr (std::is_same_v<std::decay_t<decltype(instruction)>, std::decay_t<decltype(instructions::UNKNOWN)>>) {
+            return std::nullopt;
+        } else {
+            return std::cref(static_cast<const instruction_t&>(instruction));
+        }
+    }, emulator_type);
+}
+
 }
\ No newline at end of file
@@ -1,12 +1,15 @@
 #pragma once
 
 #include <algorithm>
+#include <bit>
 #include <cassert>
 #include <chrono>
 #include <cstdint>
 #include <functional>
-
+#include <iomanip>
 #include <iostream>
+#include <sstream>
+#include <type_traits>
 
 #include <core/common.h>
 #include <core/vm.h>
@@ -25,14 +28,27 @@ using decoded_instruction_t = std::tuple<std::reference_wrapper<const instructio
 
 namespace instructions {
 
+/**
+ * Instruction with its generic implementation, so engines could instantiate it
+ * for something else, than vm_t (e.g. registers, kept in locals).
+ */
+template <typename Impl>
+struct generic_instruction_t : instruction_t {
+    Impl impl;
+};
+
 // some boilerplate to make instruction declaration more readable
 namespace detail {
 struct InstructionDeclarationHelper {
     template <typename F>
-    constexpr instruction_t operator+(F&& executor) {
-        return instruction_t{
-            .name = name,
-            .executor = executor,
+    constexpr auto operator+(F&& executor) {
+        using impl_t = std::decay_t<F>;
+        return generic_instruction_t<impl_t>{
+            instruction_t{
+                .name = name,
+                .executor = [](vm_t& vm, const opcode_t& opcode) { impl_t{}(vm, opcode, vm.quirks); },
+            },
+            executor,
         };
     }
 
@@ -41,37 +57,84 @@ struct InstructionDeclarationHelper {
 } // namespace detail
 
 /**
- * Each instruction is a lambda that takes a vm_t reference and an opcode_t reference.
+ * Each instruction is a generic lambda that takes a vm_t reference (or anything with the same members),
+ * an opcode_t reference and quirks (quirks_t, or static_quirks_t to have them resolved at compile time).
  * Intruction mutates the vm_t and advances the program counter.
+ * Faulted instruction sets vm.fault and leaves everything else as is, instructions never throw on their own.
+ * Guest memory is addressed modulo its size, so no address is out of bounds.
  * Declaration is implemented with a really handy macro-hack from folly's SCOPE_EXIT
  */
 #define PIEX_INSTRUCTION(instruction_name)\
-inline constexpr auto instruction_name = detail::InstructionDeclarationHelper{.name = #instruction_name} + [](vm_t& vm, const opcode_t& opcode)
+inline constexpr auto instruction_name = detail::InstructionDeclarationHelper{.name = #instruction_name} + [](auto& vm, const opcode_t& opcode, const auto& quirks)
+
+/**
+ * Trap for every opcode, that decoder does not recognize.
+ */
+PIEX_INSTRUCTION(UNKNOWN) {
+    vm.fault = fault_kind_t::UNKNOWN_OPCODE;
+};
 
 PIEX_INSTRUCTION(CLS) {
-    for (auto& row : vm.video_memory) {
-        std::fill(row.begin(), row.end(), false);
-    }
-    vm.video_system.render(vm.video_memory);
+    vm.video_memory.clear(vm.video_memory.selected_planes);
+    vm.dirty_rows.set();
 
     vm.next_instruction();
 };
 
 PIEX_INSTRUCTION(RET) {
-    if (vm.sp == 0) {
-        throw std::runtime_error("Stack underflow");
+    if (vm.sp == 0) [[unlikely]] {
+        vm.fault = fault_kind_t::STACK_UNDERFLOW;
+        return;
     }
     vm.pc = vm.stack[--vm.sp];
     vm.next_instruction();
 };
 
+// SCHIP scrolls and resolution switches, distances are in pixels of the current resolution
+
+PIEX_INSTRUCTION(SCD_N) {
+    vm.video_memory.scroll_down(opcode.get_n());
+    vm.dirty_rows.set();
+
+    vm.next_instruction();
+};
+
+PIEX_INSTRUCTION(SCR) {
+    vm.video_memory.scroll_right(4);
+    vm.dirty_rows.set();
+
+    vm.next_instruction();
+};
+
+PIEX_INSTRUCTION(SCL) {
+    vm.video_memory.scroll_left(4);
+    vm.dirty_rows.set();
+
+    vm.next_instruction();
+};
+
+PIEX_INSTRUCTION(LOW) {
+    vm.video_memory.set_hires(false);
+    vm.dirty_rows.set();
+
+    vm.next_instruction();
+};
+
+PIEX_INSTRUCTION(HIGH) {
+    vm.video_memory.set_hires(true);
+    vm.dirty_rows.set();
+
+    vm.next_instruction();
+};
+
 PIEX_INSTRUCTION(JP_ADDR) {
     vm.pc = opcode.get_nnn();
 };
 
 PIEX_INSTRUCTION(CALL_ADDR) {
-    if (vm.sp == vm.stack.size()) {
-        throw std::runtime_error("Stack overflow");
+    if (vm.sp == vm.stack.size()) [[unlikely]] {
+        vm.fault = fault_kind_t::STACK_OVERFLOW;
+        return;
     }
     vm.stack[vm.sp++] = vm.pc;
     vm.pc = opcode.get_nnn();
@@ -116,7 +179,7 @@ PIEX_INSTRUCTION(LD_VX_VY) {
 PIEX_INSTRUCTION(OR_VX_VY) {
     vm.V[opcode.get_x()] |= vm.V[opcode.get_y()];
 
-    if (vm.settings.emulator_type == vm_t::settings_t::emulator_type_t::CHIP_8) {
+    if (quirks.vf_reset) {
         vm.V[0xF] = 0;
     }
 
@@ -126,7 +189,7 @@ PIEX_INSTRUCTION(OR_VX_VY) {
 PIEX_INSTRUCTION(AND_VX_VY) {
     vm.V[opcode.get_x()] &= vm.V[opcode.get_y()];
 
-    if (vm.settings.emulator_type == vm_t::settings_t::emulator_type_t::CHIP_8) {
+    if (quirks.vf_reset) {
         vm.V[0xF] = 0;
     }
 
@@ -136,7 +199,7 @@ PIEX_INSTRUCTION(AND_VX_VY) {
 PIEX_INSTRUCTION(XOR_VX_VY) {
     vm.V[opcode.get_x()] ^= vm.V[opcode.get_y()];
 
-    if (vm.settings.emulator_type == vm_t::settings_t::emulator_type_t::CHIP_8) {
+    if (quirks.vf_reset) {
         vm.V[0xF] = 0;
     }
 
@@ -174,7 +237,7 @@ PIEX_INSTRUCTION(SUB_VX_VY) {
 };
 
 PIEX_INSTRUCTION(SHR_VX_VY) {
-    uint8_t value = vm.V[opcode.get_y()];
+    uint8_t value = vm.V[quirks.shifting ? opcode.get_x() : opcode.get_y()];
     auto carry = value & 0x1;
     vm.V[opcode.get_x()] = value >> 1;
     vm.V[0xF] = carry;
@@ -197,7 +260,7 @@ PIEX_INSTRUCTION(SUBN_VX_VY) {
 };
 
 PIEX_INSTRUCTION(SHL_VX_VY) {
-    uint8_t value = vm.V[opcode.get_y()];
+    uint8_t value = vm.V[quirks.shifting ? opcode.get_x() : opcode.get_y()];
     auto carry = value >> 7;
     vm.V[opcode.get_x()] = value << 1;
     vm.V[0xF] = carry;
@@ -217,12 +280,7 @@ PIEX_INSTRUCTION(LD_I_ADDR) {
 };
 
 PIEX_INSTRUCTION(JP_V0_ADDR) {
-    if (vm.settings.emulator_type == vm_t::settings_t::emulator_type_t::CHIP_8) {
-        vm.pc = opcode.get_nnn() + vm.V[0];
-    }
-    else {
-        vm.pc = opcode.get_nnn() + vm.V[opcode.get_x()];
-    }
+    vm.pc = opcode.get_nnn() + vm.V[quirks.jump_vx ? opcode.get_x() : 0];
 };
 
 PIEX_INSTRUCTION(RND_VX_BYTE) {
@@ -230,42 +288,103 @@ PIEX_INSTRUCTION(RND_VX_BYTE) {
     vm.next_instruction();
 };
 
-PIEX_INSTRUCTION(DRW_VX_VY_N) {
-    if (static_cast<size_t>(opcode.get_n() + vm.I) > vm.memory.size()) {
-        throw std::runtime_error("DRW_VX_VY_N: sprite out of bounds");
+namespace detail {
+
+// sprite row, aligned to the left of the word, moved to the column of the hi-res screen row;
+// the row is one number of two words, wrapping rotates it as a whole
+inline video_memory_t::row_t place_sprite_row(video_memory_t::word_t aligned, size_t col, bool clipping) noexcept {
+    constexpr auto BITS = video_memory_t::WORD_BITS;
+    if (col < BITS) {
+        return {aligned >> col, col == 0 ? 0 : aligned << (BITS - col)};
+    }
+    col -= BITS;
+    return {clipping || col == 0 ? 0 : aligned << (BITS - col), aligned >> col};
+}
+
+// DRW_VX_VY_N and DRW_VX_VY_0: XOR of sprites on the selected planes, VF is set by a collision on any of them
+template <size_t SpriteBytes, typename VM, typename Quirks>
+void draw_sprite(VM& vm, const opcode_t& opcode, const Quirks& quirks, size_t height) {
+    if (quirks.display_wait) {
+        if (!vm.vblank) {
+            return; // pc stays, so it is executed again, until the next tick
+        }
+        vm.vblank = false;
     }
 
-    const auto sprite = bytes_view(vm.memory.data() + vm.I, opcode.get_n());
+    // both resolutions are powers of two
+    auto& video = vm.video_memory;
+    const auto screen_height = video.height();
+    const auto start_col = vm.V[opcode.get_x()] & (video.width() - 1);
+    const auto start_row = vm.V[opcode.get_y()] & (screen_height - 1);
 
-    auto start_col = vm.V[opcode.get_x()] % VIDEO_WIDTH;
-    auto start_row = vm.V[opcode.get_y()] % VIDEO_HEIGHT;
+    // clipped sprite is cut at the bottom by the number of rows and at the right by the shift,
+    // wrapped one goes around through the row index and the rotation
+    const auto rows = quirks.clipping ? std::min<size_t>(height, screen_height - start_row) : height;
 
-    bool collision = false;
-    for (size_t row = 0; row < sprite.size(); ++row) {
-        uint8_t sprite_byte = sprite[row];
-        for (size_t col = 0; col < 8; ++col) {
-            if (start_col + col >= VIDEO_WIDTH || start_row + row >= VIDEO_HEIGHT) {
-                continue;
-            }
+    const auto get_line = [&vm](size_t offset) {
+        auto sprite = static_cast<video_memory_t::word_t>(vm.memory[offset & (MEMORY_SIZE - 1)]);
+        if constexpr (SpriteBytes == 2) {
+            sprite = sprite << 8 | vm.memory[(offset + 1) & (MEMORY_SIZE - 1)];
+        }
+        return sprite << (video_memory_t::WORD_BITS - 8 * SpriteBytes);
+    };
+
+    // every selected plane takes the next sprite from memory
+    size_t address = vm.I;
+    video_memory_t::word_t collision = 0;
+    for (size_t plane = 0; plane < VIDEO_PLANES; ++plane) {
+        if (!(video.selected_planes & (1u << plane))) {
+            continue;
+        }
 
-            bool sprite_pixel = (sprite_byte >> (7 - col)) & 0x01;
+        auto& screen = video.planes[plane];
+        const auto sprite = address;
+        address += height * SpriteBytes;
+        if (!video.hires) {
+            // low resolution stays in the first word
+            for (size_t row = 0; row < rows; ++row) {
+                const auto aligned = get_line(sprite + row * SpriteBytes);
+                const auto line = quirks.clipping ? aligned >> start_col : std::rotr(aligned, static_cast<int>(start_col));
+                const auto index = (start_row + row) & (screen_height - 1);
+                auto& word = screen[index][0];
+
+                collision |= word & line;
+                word ^= line;
+                if (line != 0) {
+                    vm.dirty_rows.set(index);
+                }
+            }
+            continue;
+        }
 
-            auto r = (start_row + row) % VIDEO_HEIGHT;
-            auto c = (start_col + col) % VIDEO_WIDTH;
-            bool& screen_pixel = vm.video_memory[r][c];
+        for (size_t row = 0; row < rows; ++row) {
+            const auto line = place_sprite_row(get_line(sprite + row * SpriteBytes), start_col, quirks.clipping);
+            const auto index = (start_row + row) & (screen_height - 1);
+            auto& words = screen[index];
 
-            if (sprite_pixel && screen_pixel) {
-                collision = true;
+            collision |= (words[0] & line[0]) | (words[1] & line[1]);
+            words[0] ^= line[0];
+            words[1] ^= line[1];
+            if ((line[0] | line[1]) != 0) {
+                vm.dirty_rows.set(index);
             }
-            screen_pixel ^= sprite_pixel;
         }
     }
 
-    vm.V[0xF] = collision ? 1 : 0;
-
-    vm.video_system.render(vm.video_memory);
+    vm.V[0xF] = collision != 0 ? 1 : 0;
 
     vm.next_instruction();
+}
+
+} // namespace detail
+
+PIEX_INSTRUCTION(DRW_VX_VY_N) {
+    detail::draw_sprite<1>(vm, opcode, quirks, opcode.get_n());
+};
+
+// SCHIP: 16x16 sprite, two bytes per row
+PIEX_INSTRUCTION(DRW_VX_VY_0) {
+    detail::draw_sprite<2>(vm, opcode, quirks, 16);
 };
 
 PIEX_INSTRUCTION(SKP_VX) {
@@ -288,7 +407,13 @@ PIEX_INSTRUCTION(LD_VX_DT) {
 };
 
 PIEX_INSTRUCTION(LD_VX_K) {
-    vm.V[opcode.get_x()] = static_cast<uint8_t>(vm.keyboard_system.wait_for_keypress());
+    const auto key = vm.keyboard_system.take_keypress();
+    if (!key) {
+        // run stops here, the instruction runs again on the next one
+        vm.fault = fault_kind_t::KEY_WAIT;
+        return;
+    }
+    vm.V[opcode.get_x()] = static_cast<uint8_t>(*key);
     vm.next_instruction();
 };
 
@@ -315,9 +440,10 @@ PIEX_INSTRUCTION(LD_F_VX) {
 
 PIEX_INSTRUCTION(LD_B_VX) {
     uint8_t value = vm.V[opcode.get_x()];
-    vm.memory[vm.I] = value / 100;
-    vm.memory[static_cast<size_t>(vm.I + 1)] = (value / 10) % 10;
-    vm.memory[static_cast<size_t>(vm.I + 2)] = value % 10;
+    vm.memory[vm.I & (MEMORY_SIZE - 1)] = value / 100;
+    vm.memory[(vm.I + 1u) & (MEMORY_SIZE - 1)] = (value / 10) % 10;
+    vm.memory[(vm.I + 2u) & (MEMORY_SIZE - 1)] = value % 10;
+    vm.written_memory.set(vm.I, 3);
 
     vm.next_instruction();
 };
@@ -325,10 +451,11 @@ PIEX_INSTRUCTION(LD_B_VX) {
 PIEX_INSTRUCTION(LD_I_VX) {
     uint8_t size = opcode.get_x();
     for (uint8_t i = 0; i <= size; ++i) {
-        vm.memory[static_cast<size_t>(vm.I + i)] = vm.V[i];
+        vm.memory[(vm.I + i) & (MEMORY_SIZE - 1)] = vm.V[i];
     }
+    vm.written_memory.set(vm.I, size + 1);
 
-    if (vm.settings.emulator_type == vm_t::settings_t::emulator_type_t::CHIP_8) {
+    if (quirks.memory_increment) {
         vm.I += size + 1;
     }
 
@@ -338,15 +465,35 @@ PIEX_INSTRUCTION(LD_I_VX) {
 PIEX_INSTRUCTION(LD_VX_I) {
     uint8_t size = opcode.get_x();
     for (uint8_t i = 0; i <= size; ++i) {
-        vm.V[i] = vm.memory[static_cast<size_t>(vm.I + i)];
+        vm.V[i] = vm.memory[(vm.I + i) & (MEMORY_SIZE - 1)];
     }
 
-    if (vm.settings.emulator_type == vm_t::settings_t::emulator_type_t::CHIP_8) {
+    if (quirks.memory_increment) {
         vm.I += size + 1;
     }
 
     vm.next_instruction();
 };
 
+// XO-CHIP: 16 bytes of the audio pattern from I
+PIEX_INSTRUCTION(LD_AUDIO_I) {
+    for (size_t i = 0; i < AUDIO_PATTERN_SIZE; ++i) {
+        vm.audio.pattern[i] = vm.memory[(vm.I + i) & (MEMORY_SIZE - 1)];
+    }
+    vm.next_instruction();
+};
+
+// XO-CHIP: pitch of the audio pattern
+PIEX_INSTRUCTION(LD_PITCH_VX) {
+    vm.audio.pitch = vm.V[opcode.get_x()];
+    vm.next_instruction();
+};
+
+// XO-CHIP: x is the mask of planes, that drawing, clearing and scrolling touch
+PIEX_INSTRUCTION(PLANE_X) {
+    vm.video_memory.selected_planes = opcode.get_x() & ((1u << VIDEO_PLANES) - 1);
+    vm.next_instruction();
+};
+
 } // namespace instructions
 } // namespace chip8
\ No newline at end of file
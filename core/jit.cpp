@@ -0,0 +1,1050 @@
+#include <core/jit.h>
+
+#include <algorithm>
+#include <bit>
+#include <bitset>
+#include <cstddef>
+#include <cstring>
+#include <limits>
+#include <optional>
+#include <stdexcept>
+#include <vector>
+
+#include <core/common.h>
+#include <core/idle_loop.h>
+#include <core/x86_64_emitter.h>
+#include <core/vm.h>
+
+#if defined(__x86_64__) && (defined(__linux__) || defined(__FreeBSD__))
+#define PIEX_JIT_SUPPORTED 1
+#include <sys/mman.h>
+#else
+#define PIEX_JIT_SUPPORTED 0
+#endif
+
+
+namespace chip8 {
+
+namespace {
+
+using namespace x86_64;
+
+/**
+ * Register assignment inside translated code:
+ *   r15 - vm_t base, every vm field is addressed relative to it
+ *   r14 - code map base, to detect stores into translated code
+ *   r13 - I
+ *   r11 - budget, instructions, that translated code is still allowed to run
+ *   r10 - guest stack pointer, it is in vm only outside of translated code
+ *   rax, rcx, rdx - scratch, rdx holds the next pc on the way to the dispatcher
+ *   the rest - cache of guest V registers, allocated on first use
+ * Translated code calls only other translated code, so caller-saved registers are free to use too.
+ */
+inline constexpr reg_t VM_BASE = R15;
+inline constexpr reg_t CODE_MAP_BASE = R14;
+inline constexpr reg_t I_REG = R13;
+inline constexpr reg_t BUDGET = R11;
+inline constexpr reg_t STACK_POINTER = R10;
+inline constexpr reg_t GUEST_REGS_POOL[] = {RBX, RBP, R12, RSI, RDI, R8, R9};
+inline constexpr reg_t CALLEE_SAVED[] = {RBX, RBP, R12, R13, R14, R15};
+
+enum class translation_t {
+    NONE,       // left to the interpreter, ends the block right before the instruction
+    PLAIN,      // translated, block continues
+    TERMINATOR, // translated, block ends after the instruction
+};
+
+translation_t classify(opcode_t opcode) {
+    switch (opcode.get_nibble<3>()) {
+        case 0x0: return opcode.get_kk() == 0xEE ? translation_t::TERMINATOR : translation_t::NONE;
+        case 0x1: case 0x2: case 0xB:
+            return translation_t::TERMINATOR;
+        // taken skips leave the block through a side exit
+        case 0x3: case 0x4: case 0x5: case 0x9:
+        case 0x6: case 0x7: case 0xA:
+            return translation_t::PLAIN;
+        case 0x8: switch (opcode.get_n()) {
+            case 0x0: case 0x1: case 0x2: case 0x3: case 0x4: case 0x5: case 0x6: case 0x7: case 0xE:
+                return translation_t::PLAIN;
+            default:
+                return translation_t::NONE;
+        }
+        case 0xF: switch (opcode.get_kk()) {
+            case 0x1E: case 0x29: case 0x33: case 0x55: case 0x65:
+                return translation_t::PLAIN;
+            default:
+                return translation_t::NONE;
+        }
+        // CLS, RND, DRW, keys, timers talk to peripherals or depend on timers
+        default: return translation_t::NONE;
+    }
+}
+
+uint16_t wrap_pc(uint32_t pc) {
+    return static_cast<uint16_t>(pc % MEMORY_SIZE);
+}
+
+// where translated code finds shared state, offsets are relative to CODE_MAP_BASE
+struct native_layout_t {
+    int32_t entries;
+    int32_t exit_reason;
+    int32_t write_offset;
+    int32_t write_size;
+    int32_t bit_masks;
+};
+
+struct translator_t {
+    vm_t& vm;
+    native_layout_t layout;
+    const uint8_t* dispatcher;
+    const uint8_t* exit_stub;
+    const quirks_t quirks;
+
+    emitter_t as;
+
+    std::array<std::optional<reg_t>, REGISTERS_SIZE> guest_regs{};
+    std::bitset<REGISTERS_SIZE> dirty_regs;
+    size_t pool_used = 0;
+    bool i_loaded = false;
+    bool i_dirty = false;
+
+    // taken skip, emitted after the block with the register cache, as it was at the skip
+    struct side_exit_t {
+        label_t label;
+        std::array<std::optional<reg_t>, REGISTERS_SIZE> guest_regs;
+        std::bitset<REGISTERS_SIZE> dirty_regs;
+        bool i_dirty;
+        uint16_t pc;
+        uint32_t executed;
+        // returns to the run loop instead of going on to the next block
+        bool stops = false;
+    };
+    std::vector<side_exit_t> side_exits;
+
+    translator_t(vm_t& vm, const native_layout_t& layout, const uint8_t* origin, const uint8_t* dispatcher, const uint8_t* exit_stub)
+        : vm(vm)
+        , layout(layout)
+        , dispatcher(dispatcher)
+        , exit_stub(exit_stub)
+        , quirks(vm.quirks)
+    {
+        as.origin = origin;
+    }
+
+    int32_t offset_of(const void* field) const {
+        return static_cast<int32_t>(static_cast<const std::byte*>(field) - reinterpret_cast<const std::byte*>(&vm));
+    }
+
+    mem_t v_mem(size_t x) const {
+        return mem_t{.base = VM_BASE, .disp = offset_of(&vm.V[x])};
+    }
+
+    mem_t guest_mem(reg_t address) const {
+        return mem_t{.base = VM_BASE, .disp = offset_of(vm.memory.data()), .index = address};
+    }
+
+    mem_t stack_mem(reg_t slot) const {
+        return mem_t{.base = VM_BASE, .disp = offset_of(vm.stack.data()), .index = slot, .scale = 2};
+    }
+
+    mem_t pc_mem() const {
+        return mem_t{.base = VM_BASE, .disp = offset_of(&vm.pc)};
+    }
+
+    mem_t i_mem() const {
+        return mem_t{.base = VM_BASE, .disp = offset_of(&vm.I)};
+    }
+
+    mem_t state_mem(int32_t offset) const {
+        return mem_t{.base = CODE_MAP_BASE, .disp = offset};
+    }
+
+    mem_t entry_mem(uint16_t pc) const {
+        return state_mem(layout.entries + pc * static_cast<int32_t>(sizeof(const uint8_t*)));
+    }
+
+    // number of registers from the list, that are not in host registers yet
+    size_t missing_regs(std::initializer_list<uint8_t> regs) const {
+        std::bitset<REGISTERS_SIZE> missing;
+        for (auto x : regs) {
+            missing[x] = !guest_regs[x].has_value();
+        }
+        return missing.count();
+    }
+
+    bool can_allocate(std::initializer_list<uint8_t> regs) const {
+        return pool_used + missing_regs(regs) <= std::size(GUEST_REGS_POOL);
+    }
+
+    // host register for V[x], loaded from vm on first use
+    reg_t reg(uint8_t x) {
+        if (!guest_regs[x]) {
+            guest_regs[x] = GUEST_REGS_POOL[pool_used++];
+            as.movzx_byte(*guest_regs[x], v_mem(x));
+        }
+        return *guest_regs[x];
+    }
+
+    // host register for V[x], that is going to be overwritten, so there is no need to load it
+    reg_t reg_for_write(uint8_t x) {
+        if (!guest_regs[x]) {
+            guest_regs[x] = GUEST_REGS_POOL[pool_used++];
+        }
+        dirty_regs[x] = true;
+        return *guest_regs[x];
+    }
+
+    void load_i() {
+        if (!i_loaded) {
+            as.movzx_word(I_REG, i_mem());
+            i_loaded = true;
+        }
+    }
+
+    void write_i() {
+        i_loaded = true;
+        i_dirty = true;
+    }
+
+    // stores cached registers back into vm, register cache stays valid for the code after
+    void flush() {
+        for (uint8_t x = 0; x < REGISTERS_SIZE; ++x) {
+            if (guest_regs[x] && dirty_regs[x]) {
+                as.store_byte(v_mem(x), *guest_regs[x]);
+            }
+        }
+        if (i_dirty) {
+            as.store_word(i_mem(), I_REG);
+        }
+    }
+
+    void spend(uint32_t executed) {
+        as.alu_imm(ALU_SUB, BUDGET, static_cast<int32_t>(executed));
+    }
+
+    // jumps straight to the translation of `pc` through its slot in entries, it is the miss stub, until there is one
+    void exit_to(uint16_t pc, uint32_t executed) {
+        flush();
+        spend(executed);
+        as.mov_imm(RDX, pc);
+        as.jmp(entry_mem(pc));
+    }
+
+    /**
+     * Enters the translation of `pc` with a host call, so that the return of the guest is predicted by the host.
+     * RET comes back right after it with the pc in RDX: it is `return_pc`, unless the guest stack was changed outside
+     * of translated code, then the dispatcher looks it up.
+     */
+    void call_to(uint16_t pc, uint16_t return_pc, uint32_t executed) {
+        label_t other;
+        flush();
+        spend(executed);
+        as.mov_imm(RDX, pc);
+        as.call(entry_mem(pc));
+        as.alu_imm(ALU_CMP, RDX, return_pc);
+        as.jcc(CC_NE, other);
+        as.jmp(entry_mem(return_pc));
+        as.bind(other);
+        as.jmp(dispatcher);
+    }
+
+    // pc is already computed in RAX, next block is chosen by dispatcher
+    void exit_to_rax(uint32_t executed) {
+        as.mov(RDX, RAX);
+        flush();
+        spend(executed);
+        as.jmp(dispatcher);
+    }
+
+    // returns to the run loop with pc at `pc`
+    void stop(uint16_t pc, uint32_t executed) {
+        flush();
+        as.store_word_imm(pc_mem(), pc);
+        spend(executed);
+        as.jmp(exit_stub);
+    }
+
+    // returns to the run loop, instruction at `pc` is left to the interpreter
+    void bail(uint16_t pc, uint32_t executed) {
+        as.store_dword_imm(state_mem(layout.exit_reason), jit_t::native_state_t::BAILED);
+        stop(pc, executed);
+    }
+
+    // returns to the run loop with pc at the head of the idle loop, that the jump closes
+    void exit_idle_loop(uint16_t pc, uint32_t executed) {
+        as.store_dword_imm(state_mem(layout.exit_reason), jit_t::native_state_t::IDLE_LOOP);
+        stop(pc, executed);
+    }
+
+    // stops the block before its `index`-th instruction at `pc`, if the budget does not cover it
+    void check_budget(uint16_t pc, uint32_t index) {
+        side_exits.push_back(side_exit_t{
+            .guest_regs = guest_regs,
+            .dirty_regs = dirty_regs,
+            .i_dirty = i_dirty,
+            .pc = pc,
+            .executed = index,
+            .stops = true,
+        });
+        as.alu_imm(ALU_CMP, BUDGET, static_cast<int32_t>(index + 1));
+        as.jcc(CC_B, side_exits.back().label);
+    }
+
+    // sets bit `bit` of the bitmap in vm, RAX is scratch, `bit` is lost
+    void set_bit(const void* bitmap, reg_t bit) {
+        as.mov(RAX, bit);
+        as.alu_imm(ALU_AND, RAX, 31);
+        as.load_dword(RAX, mem_t{.base = CODE_MAP_BASE, .disp = layout.bit_masks, .index = RAX, .scale = 4});
+        as.shr_imm(bit, 5);
+        as.alu_mem(ALU_OR, mem_t{.base = VM_BASE, .disp = offset_of(bitmap), .index = bit, .scale = 4}, RAX);
+    }
+
+    /**
+     * Marks the guest write [base & 0xFFF, +size) in vm_t::written_memory, as the interpreter does,
+     * and returns to the run loop, if it hit translated code.
+     */
+    void check_written(reg_t base, uint8_t size, uint16_t next_pc, uint32_t executed) {
+        static_assert(memory_bitmap_t::PAGE_SIZE == memory_bitmap_t::WORD_BITS, "page must be one word of the bitmap");
+        static_assert(REGISTERS_SIZE <= memory_bitmap_t::WORD_BITS, "write must be shorter than a word");
+        constexpr auto word_shift = static_cast<uint8_t>(std::countr_zero(memory_bitmap_t::WORD_BITS));
+        label_t hit;
+        label_t done;
+
+        const auto address = [&](uint8_t i) {
+            as.lea(RDX, mem_t{.base = base, .disp = i});
+            as.alu_imm(ALU_AND, RDX, MEMORY_SIZE - 1);
+        };
+
+        // write is shorter than a word, so its first and last bytes are in all of its words and pages
+        for (const uint8_t i : {uint8_t{0}, static_cast<uint8_t>(size - 1)}) {
+            address(i);
+            as.shr_imm(RDX, word_shift);
+            set_bit(&vm.written_memory.dirty_words, RDX);
+            address(i);
+            as.shr_imm(RDX, word_shift);
+            set_bit(&vm.written_memory.pages, RDX);
+        }
+        for (uint8_t i = 0; i < size; ++i) {
+            address(i);
+            set_bit(vm.written_memory.words.data(), RDX);
+        }
+
+        for (uint8_t i = 0; i < size; ++i) {
+            address(i);
+            as.alu_byte_imm(ALU_CMP, mem_t{.base = CODE_MAP_BASE, .index = RDX}, 0);
+            as.jcc(CC_NE, hit);
+        }
+        as.jmp(done);
+
+        as.bind(hit);
+        as.mov(RAX, base);
+        as.alu_imm(ALU_AND, RAX, MEMORY_SIZE - 1);
+        as.store_dword(state_mem(layout.write_offset), RAX);
+        as.store_dword_imm(state_mem(layout.write_size), size);
+        as.store_dword_imm(state_mem(layout.exit_reason), jit_t::native_state_t::MEMORY_WRITTEN);
+        flush();
+        as.store_word_imm(pc_mem(), next_pc);
+        spend(executed);
+        as.jmp(exit_stub);
+
+        as.bind(done);
+    }
+
+    // flags are set by the caller, block goes on, if the skip is not taken
+    void skip_if(condition_t condition, uint16_t pc, uint32_t executed) {
+        side_exits.push_back(side_exit_t{
+            .guest_regs = guest_regs,
+            .dirty_regs = dirty_regs,
+            .i_dirty = i_dirty,
+            .pc = wrap_pc(pc + 4u),
+            .executed = executed,
+        });
+        as.jcc(condition, side_exits.back().label);
+    }
+
+    void emit_side_exits() {
+        for (auto& side_exit : side_exits) {
+            as.bind(side_exit.label);
+            guest_regs = side_exit.guest_regs;
+            dirty_regs = side_exit.dirty_regs;
+            i_dirty = side_exit.i_dirty;
+            if (side_exit.stops) {
+                stop(side_exit.pc, side_exit.executed);
+            } else {
+                exit_to(side_exit.pc, side_exit.executed);
+            }
+        }
+    }
+
+    void vf_reset() {
+        if (quirks.vf_reset) {
+            as.mov_imm(reg_for_write(0xF), 0);
+        }
+    }
+
+    // registers, that must be in host registers to translate the instruction
+    bool fits_registers(opcode_t opcode) const {
+        const auto x = opcode.get_x();
+        const auto y = opcode.get_y();
+
+        switch (opcode.get_nibble<3>()) {
+            case 0x3: case 0x4: case 0x6: case 0x7:
+                return can_allocate({x});
+            case 0x5: case 0x9:
+                return can_allocate({x, y});
+            case 0x8:
+                return can_allocate({x, y, 0xF});
+            case 0xB:
+                return can_allocate({quirks.jump_vx ? x : uint8_t{0}});
+            case 0xF: switch (opcode.get_kk()) {
+                case 0x1E: case 0x29: case 0x33:
+                    return can_allocate({x});
+                default:
+                    return true;
+            }
+            default:
+                return true;
+        }
+    }
+
+    /**
+     * Emits the instruction at `pc`, which is `index`-th in the block.
+     * Terminators emit block exit by themselves.
+     */
+    void emit(opcode_t opcode, uint16_t pc, uint32_t index) {
+        const auto x = opcode.get_x();
+        const auto y = opcode.get_y();
+        const auto kk = opcode.get_kk();
+        const auto nnn = opcode.get_nnn();
+        const uint16_t next_pc = wrap_pc(pc + 2u);
+        const uint32_t executed = index + 1;
+
+        switch (opcode.get_nibble<3>()) {
+            case 0x0: { // RET
+                label_t underflow;
+                as.alu_imm(ALU_CMP, STACK_POINTER, 0);
+                as.jcc(CC_E, underflow);
+                as.alu_imm(ALU_SUB, STACK_POINTER, 1);
+                as.movzx_word(RAX, stack_mem(STACK_POINTER));
+                as.alu_imm(ALU_ADD, RAX, 2);
+                as.alu_imm(ALU_AND, RAX, MEMORY_SIZE - 1);
+                // back to the host call of the matching CALL, or to the dispatcher, if it was made before the run
+                as.mov(RDX, RAX);
+                flush();
+                spend(executed);
+                as.ret();
+
+                // let the interpreter report it
+                as.bind(underflow);
+                bail(pc, index);
+                return;
+            }
+            case 0x1: // JP_ADDR
+                // run loop skips iterations of the idle loop, as the interpreter does
+                if (is_idle_loop_jump(opcode, pc) && find_idle_loop(vm, nnn)) {
+                    exit_idle_loop(nnn, executed);
+                } else {
+                    exit_to(nnn, executed);
+                }
+                return;
+            case 0x2: { // CALL_ADDR
+                label_t overflow;
+                as.alu_imm(ALU_CMP, STACK_POINTER, STACK_SIZE);
+                as.jcc(CC_E, overflow);
+                as.store_word_imm(stack_mem(STACK_POINTER), pc);
+                as.alu_imm(ALU_ADD, STACK_POINTER, 1);
+                call_to(nnn, next_pc, executed);
+
+                as.bind(overflow);
+                bail(pc, index);
+                return;
+            }
+            case 0x3: // SE_VX_BYTE
+                as.alu_imm(ALU_CMP, reg(x), kk);
+                skip_if(CC_E, pc, executed);
+                return;
+            case 0x4: // SNE_VX_BYTE
+                as.alu_imm(ALU_CMP, reg(x), kk);
+                skip_if(CC_NE, pc, executed);
+                return;
+            case 0x5: // SE_VX_VY
+                as.alu(ALU_CMP, reg(x), reg(y));
+                skip_if(CC_E, pc, executed);
+                return;
+            case 0x9: // SNE_VX_VY
+                as.alu(ALU_CMP, reg(x), reg(y));
+                skip_if(CC_NE, pc, executed);
+                return;
+            case 0x6: // LD_VX_BYTE
+                as.mov_imm(reg_for_write(x), kk);
+                return;
+            case 0x7: // ADD_VX_BYTE, byte operation wraps by itself
+                as.alu_byte_imm(ALU_ADD, reg(x), kk);
+                dirty_regs[x] = true;
+                return;
+            case 0x8:
+                emit_alu(opcode);
+                return;
+            case 0xA: // LD_I_ADDR
+                as.mov_imm(I_REG, nnn);
+                write_i();
+                return;
+            case 0xB: { // JP_V0_ADDR
+                as.mov(RAX, reg(quirks.jump_vx ? x : 0));
+                as.alu_imm(ALU_ADD, RAX, nnn);
+                exit_to_rax(executed);
+                return;
+            }
+            case 0xF:
+                emit_misc(opcode, next_pc, executed);
+                return;
+            default:
+                throw std::logic_error("jit: instruction can not be translated");
+        }
+    }
+
+    void emit_alu(opcode_t opcode) {
+        const auto x = opcode.get_x();
+        const auto y = opcode.get_y();
+
+        // sources first, so they are loaded before anything is overwritten
+        const auto ry = reg(y);
+        const auto rx = opcode.get_n() == 0x0 ? reg_for_write(x) : reg(x);
+        dirty_regs[x] = true;
+
+        switch (opcode.get_n()) {
+            case 0x0: // LD_VX_VY
+                as.mov(rx, ry);
+                return;
+            case 0x1: // OR_VX_VY
+                as.alu(ALU_OR, rx, ry);
+                vf_reset();
+                return;
+            case 0x2: // AND_VX_VY
+                as.alu(ALU_AND, rx, ry);
+                vf_reset();
+                return;
+            case 0x3: // XOR_VX_VY
+                as.alu(ALU_XOR, rx, ry);
+                vf_reset();
+                return;
+            case 0x4: { // ADD_VX_VY
+                as.alu_byte(ALU_ADD, rx, ry);
+                as.setcc(CC_B, RCX);
+                as.movzx_byte(reg_for_write(0xF), RCX);
+                return;
+            }
+            case 0x5: { // SUB_VX_VY, flag is set only when result is strictly positive
+                as.alu(ALU_CMP, rx, ry);
+                as.setcc(CC_A, RCX);
+                as.alu_byte(ALU_SUB, rx, ry);
+                as.movzx_byte(reg_for_write(0xF), RCX);
+                return;
+            }
+            case 0x6: { // SHR_VX_VY
+                const auto source = quirks.shifting ? rx : ry;
+                as.mov(RCX, source);
+                as.alu_imm(ALU_AND, RCX, 1);
+                if (rx != source) {
+                    as.mov(rx, source);
+                }
+                as.shr_imm(rx, 1);
+                as.mov(reg_for_write(0xF), RCX);
+                return;
+            }
+            case 0x7: { // SUBN_VX_VY
+                as.alu(ALU_CMP, ry, rx);
+                as.setcc(CC_A, RCX);
+                as.mov(RAX, ry);
+                as.alu_byte(ALU_SUB, RAX, rx);
+                as.mov(rx, RAX);
+                as.movzx_byte(reg_for_write(0xF), RCX);
+                return;
+            }
+            case 0xE: { // SHL_VX_VY
+                const auto source = quirks.shifting ? rx : ry;
+                as.mov(RCX, source);
+                as.shr_imm(RCX, 7);
+                if (rx != source) {
+                    as.mov(rx, source);
+                }
+                as.alu_byte(ALU_ADD, rx, rx);
+                as.mov(reg_for_write(0xF), RCX);
+                return;
+            }
+            default:
+                throw std::logic_error("jit: instruction can not be translated");
+        }
+    }
+
+    void increment_i(uint8_t size) {
+        if (quirks.memory_increment) {
+            as.alu_imm(ALU_ADD, I_REG, size);
+            as.movzx_word(I_REG, I_REG);
+            write_i();
+        }
+    }
+
+    void emit_misc(opcode_t opcode, uint16_t next_pc, uint32_t executed) {
+        const auto x = opcode.get_x();
+
+        switch (opcode.get_kk()) {
+            case 0x1E: { // ADD_I_VX
+                load_i();
+                as.alu(ALU_ADD, I_REG, reg(x));
+                as.movzx_word(I_REG, I_REG);
+                write_i();
+                return;
+            }
+            case 0x29: { // LD_F_VX
+                as.imul_imm(I_REG, reg(x), 5);
+                write_i();
+                return;
+            }
+            case 0x33: { // LD_B_VX, divisions are done with multiplications, exact for bytes
+                load_i();
+                const auto rx = reg(x);
+
+                auto store_digit = [&](uint8_t i, reg_t digit) {
+                    as.lea(RDX, mem_t{.base = I_REG, .disp = i});
+                    as.alu_imm(ALU_AND, RDX, MEMORY_SIZE - 1);
+                    as.store_byte(guest_mem(RDX), digit);
+                };
+
+                // value / 100
+                as.imul_imm(RAX, rx, 41);
+                as.shr_imm(RAX, 12);
+                store_digit(0, RAX);
+
+                // (value / 10) % 10
+                as.imul_imm(RAX, rx, 205);
+                as.shr_imm(RAX, 11);
+                as.imul_imm(RCX, RAX, 205);
+                as.shr_imm(RCX, 11);
+                as.imul_imm(RCX, RCX, 10);
+                as.alu(ALU_SUB, RAX, RCX);
+                store_digit(1, RAX);
+
+                // value % 10
+                as.imul_imm(RAX, rx, 205);
+                as.shr_imm(RAX, 11);
+                as.imul_imm(RAX, RAX, 10);
+                as.mov(RCX, rx);
+                as.alu(ALU_SUB, RCX, RAX);
+                store_digit(2, RCX);
+
+                check_written(I_REG, 3, next_pc, executed);
+                return;
+            }
+            case 0x55: { // LD_I_VX
+                load_i();
+                // keep initial I, quirk might change it
+                as.mov(RCX, I_REG);
+                for (uint8_t i = 0; i <= x; ++i) {
+                    auto source = RAX;
+                    if (guest_regs[i]) {
+                        source = *guest_regs[i];
+                    } else {
+                        as.movzx_byte(RAX, v_mem(i));
+                    }
+                    as.lea(RDX, mem_t{.base = RCX, .disp = i});
+                    as.alu_imm(ALU_AND, RDX, MEMORY_SIZE - 1);
+                    as.store_byte(guest_mem(RDX), source);
+                }
+                increment_i(x + 1);
+
+                check_written(RCX, x + 1, next_pc, executed);
+                return;
+            }
+            case 0x65: { // LD_VX_I
+                load_i();
+                for (uint8_t i = 0; i <= x; ++i) {
+                    as.lea(RDX, mem_t{.base = I_REG, .disp = i});
+                    as.alu_imm(ALU_AND, RDX, MEMORY_SIZE - 1);
+                    as.movzx_byte(RAX, guest_mem(RDX));
+                    if (guest_regs[i]) {
+                        as.mov(*guest_regs[i], RAX);
+                        dirty_regs[i] = true;
+                    } else {
+                        as.store_byte(v_mem(i), RAX);
+                    }
+                }
+                increment_i(x + 1);
+                return;
+            }
+            default:
+                throw std::logic_error("jit: instruction can not be translated");
+        }
+    }
+};
+
+} // namespace
+
+
+jit_t::jit_t(vm_t& vm)
+    : vm(vm)
+{
+#if PIEX_JIT_SUPPORTED
+    void* memory = mmap(nullptr, CODE_CACHE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) {
+        throw std::runtime_error("jit: failed to allocate executable memory");
+    }
+    code_cache = static_cast<uint8_t*>(memory);
+    emit_runtime();
+#else
+    throw std::runtime_error("jit: host is not supported");
+#endif
+}
+
+jit_t::~jit_t() {
+#if PIEX_JIT_SUPPORTED
+    munmap(code_cache, CODE_CACHE_SIZE);
+#endif
+}
+
+bool jit_t::is_supported() noexcept {
+    return PIEX_JIT_SUPPORTED;
+}
+
+fault_t jit_t::run(uint64_t count) {
+    // memory might have been loaded since last run
+    consume_written_memory();
+    // timers might have been advanced since last run
+    until_tick = 0;
+
+    while (count > 0) {
+        // rewind takes snapshots at ticks, so with it translated code stops at every one of them
+        uint64_t limit = count;
+        if (vm.rewind) {
+            limit = std::min(count, sync_timers());
+        }
+
+        const auto entry = get_entry(vm.pc);
+        if (entry == nullptr) {
+            if (auto fault = interpret(count)) {
+                return fault;
+            }
+            continue;
+        }
+
+        // blocks stop, where the budget runs out, it is left in state, when translated code returns
+        const auto budget = static_cast<uint32_t>(std::min<uint64_t>(limit, std::numeric_limits<uint32_t>::max()));
+        state.budget = budget;
+        state.exit_reason = native_state_t::NONE;
+
+        trampoline(entry);
+
+        const auto executed = budget - state.budget;
+        pending_instructions += executed;
+        count -= executed;
+
+        switch (state.exit_reason) {
+            case native_state_t::MEMORY_WRITTEN:
+                invalidate(state.write_offset, state.write_size);
+                break;
+            case native_state_t::BAILED:
+                // faults of translated instructions are reported by the interpreter
+                if (auto fault = interpret(count)) {
+                    return fault;
+                }
+                break;
+            case native_state_t::IDLE_LOOP: {
+                // skip goes up to the next tick, that has to know about the instructions run so far
+                const auto skipped = skip_idle_loop(vm, std::min(count, sync_timers()));
+                pending_instructions += skipped;
+                count -= skipped;
+                break;
+            }
+            case native_state_t::NONE:
+                break;
+        }
+    }
+
+    flush_timers();
+    return fault_t{};
+}
+
+void jit_t::flush_timers() {
+    if (pending_instructions > 0) {
+        vm.advance_timers(pending_instructions);
+        pending_instructions = 0;
+        until_tick = 0;
+    }
+}
+
+uint64_t jit_t::sync_timers() {
+    flush_timers();
+    if (until_tick == 0) {
+        until_tick = vm.instructions_until_tick();
+    }
+    return until_tick;
+}
+
+fault_t jit_t::interpret(uint64_t& count) {
+    // translated code does not stop at ticks, the instruction might look at timers
+    if (pending_instructions >= until_tick) {
+        sync_timers();
+    }
+
+    do {
+        // pc might be past the end of memory after JP_V0_ADDR
+        const auto opcode = opcode_t{static_cast<uint16_t>(vm.memory[vm.pc & (MEMORY_SIZE - 1)] << 8 | vm.memory[(vm.pc + 1u) & (MEMORY_SIZE - 1)])};
+        vm.dispatch_table[opcode.bytes](vm, opcode);
+        if (vm.fault != fault_kind_t::NONE) [[unlikely]] {
+            flush_timers();
+            consume_written_memory();
+            return vm.take_fault();
+        }
+        if (vm.written_memory.any()) {
+            consume_written_memory();
+        }
+        --count;
+
+        // timers tick right after the instruction, that reaches the tick, as with the interpreter
+        if (++pending_instructions >= until_tick) {
+            sync_timers();
+        }
+    } while (count > 0 && get_entry(vm.pc) == nullptr);
+
+    return fault_t{};
+}
+
+void jit_t::consume_written_memory() noexcept {
+    if (!vm.written_memory.any()) {
+        return;
+    }
+    vm.written_memory.for_each([this](size_t address) { invalidate(address, 1); });
+    vm.written_memory.clear();
+}
+
+const uint8_t* jit_t::get_entry(uint16_t pc) {
+    if (static_cast<size_t>(pc) + 1 >= MEMORY_SIZE) {
+        return nullptr;
+    }
+    if (guest_sizes[pc] == 0) {
+        translate(pc);
+    }
+    return entries[pc] != miss_stub ? entries[pc] : nullptr;
+}
+
+void jit_t::emit_runtime() {
+    const auto layout_offset = [this](const void* field) {
+        return static_cast<int32_t>(static_cast<const uint8_t*>(field) - code_map.data());
+    };
+    const auto pc_mem = mem_t{
+        .base = VM_BASE,
+        .disp = static_cast<int32_t>(reinterpret_cast<const uint8_t*>(&vm.pc) - reinterpret_cast<const uint8_t*>(&vm)),
+    };
+    const auto sp_mem = mem_t{
+        .base = VM_BASE,
+        .disp = static_cast<int32_t>(reinterpret_cast<const uint8_t*>(&vm.sp) - reinterpret_cast<const uint8_t*>(&vm)),
+    };
+    const auto budget_mem = mem_t{.base = CODE_MAP_BASE, .disp = layout_offset(&state.budget)};
+    const auto host_stack_mem = mem_t{.base = CODE_MAP_BASE, .disp = layout_offset(&state.host_stack)};
+
+    emitter_t as;
+    as.origin = code_cache;
+    label_t dispatcher_label;
+    label_t return_label;
+    label_t miss_label;
+
+    // trampoline(entry)
+    for (auto reg : CALLEE_SAVED) {
+        as.push(reg);
+    }
+    as.mov_imm64(VM_BASE, reinterpret_cast<uint64_t>(&vm));
+    as.mov_imm64(CODE_MAP_BASE, reinterpret_cast<uint64_t>(code_map.data()));
+    as.load_dword(BUDGET, budget_mem);
+    as.movzx_byte(STACK_POINTER, sp_mem);
+    as.store_qword(host_stack_mem, RSP);
+    as.call(RDI);
+
+    // exits return here with RDX out of guest memory, so that the return is predicted by the host
+    const auto returned_offset = as.code.size();
+    as.alu_imm(ALU_CMP, RDX, MEMORY_SIZE);
+    as.jcc(CC_NE, return_label);
+    as.store_dword(budget_mem, BUDGET);
+    as.store_byte(sp_mem, STACK_POINTER);
+    for (auto it = std::rbegin(CALLEE_SAVED); it != std::rend(CALLEE_SAVED); ++it) {
+        as.pop(*it);
+    }
+    as.ret();
+
+    // RET of a guest CALL, that was made before the run, has no host call to return to: it gets here
+    // and goes on through the dispatcher with a return address for the next such RET
+    as.bind(return_label);
+    as.call(dispatcher_label);
+    as.jmp(return_label);
+
+    // dispatcher, pc is in RDX
+    as.bind(dispatcher_label);
+    const auto dispatcher_offset = as.code.size();
+    as.alu_imm(ALU_CMP, RDX, MEMORY_SIZE);
+    as.jcc(CC_AE, miss_label);
+    as.jmp(mem_t{.base = CODE_MAP_BASE, .disp = layout_offset(entries.data()), .index = RDX, .scale = 8});
+
+    // there is no translation for pc in RDX
+    as.bind(miss_label);
+    const auto miss_offset = as.code.size();
+    as.store_word(pc_mem, RDX);
+
+    // back to the run loop, pc is already stored to vm; host calls of translated code are dropped,
+    // return address of the trampoline might have been taken by a RET of a guest CALL, that was made before the run
+    const auto exit_offset = as.code.size();
+    as.load_qword(RSP, host_stack_mem);
+    as.mov_imm64(RAX, reinterpret_cast<uint64_t>(code_cache + returned_offset));
+    as.push(RAX);
+    as.mov_imm(RDX, MEMORY_SIZE);
+    as.ret();
+
+    std::memcpy(code_cache, as.code.data(), as.code.size());
+    code_cache_used = as.code.size();
+
+    trampoline = reinterpret_cast<trampoline_t>(code_cache);
+    dispatcher = code_cache + dispatcher_offset;
+    miss_stub = code_cache + miss_offset;
+    exit_stub = code_cache + exit_offset;
+    entries.fill(miss_stub);
+}
+
+void jit_t::translate(uint16_t start_pc) {
+    // two copies of the block
+    if (code_cache_used + 2 * MAX_BLOCK_CODE_SIZE > CODE_CACHE_SIZE) {
+        flush();
+    }
+
+    const auto layout_offset = [this](const void* field) {
+        return static_cast<int32_t>(static_cast<const uint8_t*>(field) - code_map.data());
+    };
+    const auto layout = native_layout_t{
+        .entries = layout_offset(entries.data()),
+        .exit_reason = layout_offset(&state.exit_reason),
+        .write_offset = layout_offset(&state.write_offset),
+        .write_size = layout_offset(&state.write_size),
+        .bit_masks = layout_offset(bit_masks.data()),
+    };
+
+    struct block_t {
+        uint16_t end_pc;
+        uint32_t count;
+    };
+
+    /**
+     * Block is emitted twice: the checked copy compares the budget before every instruction and stops, where it runs out,
+     * the fast one runs only, if the budget is enough for all of it, and goes to the checked copy otherwise.
+     */
+    const auto emit_block = [this, start_pc](translator_t& translator, const uint8_t* checked_copy) {
+        label_t no_budget;
+        size_t length_fixup = 0;
+        if (checked_copy != nullptr) {
+            // length is patched in, when it is known
+            translator.as.alu_imm(ALU_CMP, BUDGET, std::numeric_limits<int32_t>::max());
+            length_fixup = translator.as.code.size() - sizeof(uint32_t);
+            translator.as.jcc(CC_B, no_budget);
+        }
+
+        uint16_t pc = start_pc;
+        uint32_t count = 0;
+        bool terminated = false;
+
+        while (count < MAX_BLOCK_INSTRUCTIONS && static_cast<size_t>(pc) + 1 < MEMORY_SIZE) {
+            // block, that starts in the middle of another one, runs up to the next translation and goes on there
+            if (count > 0 && entries[pc] != miss_stub) {
+                break;
+            }
+
+            const auto opcode = opcode_t{static_cast<uint16_t>(vm.memory[pc] << 8 | vm.memory[pc + 1])};
+            const auto translation = classify(opcode);
+
+            if (translation == translation_t::NONE || !translator.fits_registers(opcode)) {
+                break;
+            }
+
+            if (checked_copy == nullptr) {
+                translator.check_budget(pc, count);
+            }
+            translator.emit(opcode, pc, count);
+            ++count;
+            pc += 2;
+
+            if (translation == translation_t::TERMINATOR) {
+                terminated = true;
+                break;
+            }
+        }
+
+        if (count == 0) {
+            return block_t{.end_pc = pc, .count = 0};
+        }
+
+        if (!terminated) {
+            translator.exit_to(wrap_pc(pc), count);
+        }
+        translator.emit_side_exits();
+
+        if (checked_copy != nullptr) {
+            translator.as.bind(no_budget);
+            translator.as.jmp(checked_copy);
+            std::memcpy(translator.as.code.data() + length_fixup, &count, sizeof(count));
+        }
+        return block_t{.end_pc = pc, .count = count};
+    };
+
+    const auto checked_origin = code_cache + code_cache_used;
+    translator_t checked(vm, layout, checked_origin, dispatcher, exit_stub);
+    const auto block = emit_block(checked, nullptr);
+
+    if (block.count == 0) {
+        // remember, that it is not worth trying again, until memory here changes
+        guest_sizes[start_pc] = 2;
+        ++code_map[start_pc];
+        ++code_map[start_pc + 1];
+        return;
+    }
+
+    const auto origin = checked_origin + checked.as.code.size();
+    translator_t fast(vm, layout, origin, dispatcher, exit_stub);
+    emit_block(fast, checked_origin);
+
+    std::memcpy(checked_origin, checked.as.code.data(), checked.as.code.size());
+    std::memcpy(origin, fast.as.code.data(), fast.as.code.size());
+    code_cache_used += checked.as.code.size() + fast.as.code.size();
+
+    const auto pc = block.end_pc;
+    entries[start_pc] = origin;
+    guest_sizes[start_pc] = static_cast<uint16_t>(pc - start_pc);
+    for (size_t address = start_pc; address < pc; ++address) {
+        ++code_map[address];
+    }
+}
+
+void jit_t::invalidate(size_t offset, size_t size) noexcept {
+    static constexpr size_t MAX_BLOCK_SIZE = MAX_BLOCK_INSTRUCTIONS * 2;
+
+    size = std::min(size, MEMORY_SIZE);
+    for (size_t i = 0; i < size; ++i) {
+        const size_t address = (offset + i) % MEMORY_SIZE;
+        if (code_map[address] == 0) {
+            continue;
+        }
+
+        const size_t first = address >= MAX_BLOCK_SIZE ? address - MAX_BLOCK_SIZE + 1 : 0;
+        for (size_t start = first; start <= address; ++start) {
+            if (guest_sizes[start] != 0 && start + guest_sizes[start] > address) {
+                for (size_t covered = start; covered < start + guest_sizes[start]; ++covered) {
+                    --code_map[covered];
+                }
+                entries[start] = miss_stub;
+                guest_sizes[start] = 0;
+            }
+        }
+    }
+}
+
+void jit_t::flush() {
+    code_map.fill(0);
+    guest_sizes.fill(0);
+    emit_runtime();
+}
+
+} // namespace chip8
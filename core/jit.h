@@ -0,0 +1,124 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+#include <core/common.h>
+#include <core/vm.h>
+
+
+namespace chip8 {
+
+/**
+ * Dynamic recompiler, that translates straight-line runs of guest code into x86-64.
+ *
+ * Translated block starts at some pc and ends at first JP/CALL/RET, or right before
+ * an instruction, that talks to peripherals or timers (those are left to the interpreter).
+ * Skips stay inside of the block, taken ones leave it through a side exit.
+ * Inside the block V, I and pc live in host registers, memory of vm_t is touched only on block exit.
+ * Exits with a known pc jump straight to the next block through its slot in the table of entries,
+ * calls enter their target with a host call, so returns come back to the caller through the host return stack,
+ * computed jumps go through a native dispatcher, jumps, that close an idle loop (idle_loop.h), return to the run loop,
+ * that skips its iterations; every block checks the budget,
+ * that is kept in a host register, so blocks run one after another, until it runs out
+ * or there is no translation for the next pc. Every block is emitted twice, the copy, that runs, when the budget
+ * covers all of the block, and the one, that checks it before every instruction and stops in the middle.
+ *
+ * Blocks are cached by their start address, guest stores (LD_B_VX, LD_I_VX) into translated
+ * range drop the translations they hit. Translated stores mark vm_t::written_memory, as the interpreter does,
+ * and check the range inline, everything else is picked up from vm_t::written_memory.
+ * With rewind, translated code stops at every tick of timers, so that snapshots are taken at all of them.
+ *
+ * Translations assume, that vm settings do not change while vm is running.
+ */
+struct jit_t {
+    explicit jit_t(vm_t& vm);
+    ~jit_t();
+
+    jit_t(const jit_t&) = delete;
+    jit_t& operator=(const jit_t&) = delete;
+
+    // false, if host can not execute translated code, caller should interpret instead
+    static bool is_supported() noexcept;
+
+    // runs exactly `count` guest instructions, mixing translated blocks and interpreter steps, unless guest faults
+    fault_t run(uint64_t count);
+
+    // drops translations, that overlap [offset, offset + size) of guest memory
+    void invalidate(size_t offset, size_t size) noexcept;
+
+    // drops all translations
+    void flush();
+
+    // state, shared with translated code
+    struct native_state_t {
+        enum exit_reason_t : uint32_t {
+            NONE,
+            MEMORY_WRITTEN, // block wrote into translated range, [write_offset, write_offset + write_size)
+            BAILED,         // block refused to execute instruction at pc, interpreter has to do it
+            IDLE_LOOP,      // block jumped back to the head of an idle loop at pc
+        };
+
+        uint32_t budget = 0;        // instructions, that translated code is still allowed to run
+        exit_reason_t exit_reason = NONE;
+        uint32_t write_offset = 0;
+        uint32_t write_size = 0;
+        // stack pointer of the trampoline, exits drop host frames of translated calls
+        uint64_t host_stack = 0;
+    };
+
+private:
+    // enters translated code at given block, returns when chain of blocks ends
+    using trampoline_t = void (*)(const uint8_t* entry);
+
+    static inline constexpr size_t CODE_CACHE_SIZE = 4 * 1024 * 1024;
+    // enough for any single copy of a block
+    static inline constexpr size_t MAX_BLOCK_CODE_SIZE = 64 * 1024;
+    static inline constexpr size_t MAX_BLOCK_INSTRUCTIONS = 64;
+
+    // translates pc on first use, nullptr, if it can not be translated
+    const uint8_t* get_entry(uint16_t pc);
+    void translate(uint16_t pc);
+    void emit_runtime();
+    // interprets instructions from pc up to the first one, that has a translation, takes them out of `count`
+    fault_t interpret(uint64_t& count);
+    // drops translations, hit by stores of the interpreter and vm_t::load_data
+    void consume_written_memory() noexcept;
+    void flush_timers();
+    // flushes timers, returns the number of instructions up to the next tick
+    uint64_t sync_timers();
+
+    vm_t& vm;
+
+    uint8_t* code_cache = nullptr;
+    size_t code_cache_used = 0;
+    trampoline_t trampoline = nullptr;
+    const uint8_t* dispatcher = nullptr;
+    // stores pc, which has no translation, and returns to the run loop
+    const uint8_t* miss_stub = nullptr;
+    const uint8_t* exit_stub = nullptr;
+
+    // translated instructions do not touch timers, so their time is accounted lazily
+    uint64_t pending_instructions = 0;
+    // instructions to the next tick as of the last flush of timers, 0 if it was not looked up since
+    uint64_t until_tick = 0;
+
+    // everything below is addressed by translated code relative to code_map
+    // for every guest byte, number of blocks (or "nothing to translate" marks), that cover it
+    std::array<uint8_t, MEMORY_SIZE> code_map{};
+    // translated code by start pc, miss stub if there is none
+    std::array<const uint8_t*, MEMORY_SIZE> entries{};
+    // bytes of guest code covered by the block, zero if pc was not looked at yet
+    std::array<uint16_t, MEMORY_SIZE> guest_sizes{};
+    native_state_t state;
+    // bit i of a dword at i, translated stores mark vm_t::written_memory with them
+    std::array<uint32_t, 32> bit_masks = [] {
+        std::array<uint32_t, 32> masks{};
+        for (size_t i = 0; i < masks.size(); ++i) {
+            masks[i] = uint32_t{1} << i;
+        }
+        return masks;
+    }();
+};
+
+} // namespace chip8
@@ -0,0 +1,124 @@
+#include <core/profiler.h>
+
+#include <algorithm>
+
+#include <core/instruction_decoder.h>
+
+
+namespace chip8 {
+
+profiler_t::profiler_t(
+    keyboard_system_iface_t& keyboard_system,
+    timers_system_iface_t& timers_system,
+    video_system_iface_t& video_system,
+    sound_system_iface_t& sound_system
+)
+    : keyboard_system(keyboard_system)
+    , timers_system(timers_system)
+    , video_system(video_system)
+    , sound_system(sound_system)
+{}
+
+void profiler_t::attach(vm_t& vm) noexcept {
+    this->vm = &vm;
+    emulator_type = vm.settings.emulator_type;
+#if PIEX_PROFILING
+    vm.profiler = this;
+#endif
+}
+
+void profiler_t::detach() noexcept {
+#if PIEX_PROFILING
+    if (vm != nullptr) {
+        vm->profiler = nullptr;
+    }
+#endif
+    vm = nullptr;
+}
+
+template <typename F>
+decltype(auto) profiler_t::measure(peripheral_t peripheral, F&& f) {
+    struct stopwatch_t {
+        timing_t& timing;
+        const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+        ~stopwatch_t() {
+            ++timing.calls;
+            timing.duration += std::chrono::steady_clock::now() - start;
+        }
+    } stopwatch{timings[peripheral]};
+
+    return f();
+}
+
+bool profiler_t::is_pressed(keyboard_key_t key) {
+    return measure(IS_PRESSED, [&] { return keyboard_system.is_pressed(key); });
+}
+
+keyboard_key_t profiler_t::wait_for_keypress() {
+    return keyboard_system.wait_for_keypress();
+}
+
+std::optional<keyboard_key_t> profiler_t::take_keypress() {
+    return keyboard_system.take_keypress();
+}
+
+void profiler_t::tick(std::chrono::nanoseconds duration) {
+    measure(TICK, [&] { timers_system.tick(duration); });
+}
+
+void profiler_t::render(const video_memory_t& video_memory, const video_rows_t& dirty_rows) {
+    measure(RENDER, [&] { video_system.render(video_memory, dirty_rows); });
+}
+
+void profiler_t::play_sound(std::chrono::nanoseconds duration, std::chrono::nanoseconds audible, const audio_t& audio) {
+    measure(PLAY_SOUND, [&] { sound_system.play_sound(duration, audible, audio); });
+}
+
+profile_t profiler_t::get_profile() const {
+    profile_t profile;
+
+    // opcodes of one instruction are summed up by its name
+    for (size_t opcode = 0; opcode < OPCODES_COUNT; ++opcode) {
+        if (opcodes[opcode] == 0) {
+            continue;
+        }
+        profile.instructions += opcodes[opcode];
+
+        const auto name = visit_instruction(opcode_t{static_cast<uint16_t>(opcode)}, [](const auto& instruction) {
+            return instruction.name;
+        }, emulator_type);
+        auto it = std::find_if(profile.by_instruction.begin(), profile.by_instruction.end(), [name](const auto& entry) {
+            return entry.name == name;
+        });
+        if (it == profile.by_instruction.end()) {
+            profile.by_instruction.push_back({.name = name, .count = 0});
+            it = std::prev(profile.by_instruction.end());
+        }
+        it->count += opcodes[opcode];
+    }
+    std::stable_sort(profile.by_instruction.begin(), profile.by_instruction.end(), [](const auto& a, const auto& b) {
+        return a.count > b.count;
+    });
+
+    profile.by_address = addresses;
+
+    static constexpr std::string_view PERIPHERAL_NAMES[PERIPHERALS_COUNT] = {"render", "tick", "play_sound", "is_pressed"};
+    for (size_t i = 0; i < PERIPHERALS_COUNT; ++i) {
+        profile.peripherals.push_back({
+            .name = PERIPHERAL_NAMES[i],
+            .calls = timings[i].calls,
+            .duration = timings[i].duration,
+        });
+    }
+
+    return profile;
+}
+
+void profiler_t::reset() noexcept {
+    std::fill(opcodes.begin(), opcodes.end(), 0);
+    std::fill(addresses.begin(), addresses.end(), 0);
+    timings.fill(timing_t{});
+}
+
+} // namespace chip8
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+#include <core/common.h>
+#include <core/iface/keyboard.h>
+#include <core/iface/sound.h>
+#include <core/iface/timers.h>
+#include <core/iface/video.h>
+#include <core/vm.h>
+
+
+namespace chip8 {
+
+/**
+ * What profiler_t has seen since it was attached or reset.
+ */
+struct profile_t {
+    struct instruction_count_t {
+        std::string_view name;
+        uint64_t count;
+    };
+
+    struct peripheral_time_t {
+        std::string_view name;
+        uint64_t calls;
+        std::chrono::nanoseconds duration;
+    };
+
+    uint64_t instructions = 0;
+    // executed instructions by name, the most frequent first, never executed ones are left out
+    std::vector<instruction_count_t> by_instruction;
+    // heat map, executions of the instruction at every address of guest memory
+    std::vector<uint64_t> by_address;
+    // render, tick, play_sound and is_pressed, in that order
+    std::vector<peripheral_time_t> peripherals;
+};
+
+/**
+ * Sits between vm and its peripherals, forwards calls to them and measures, how long they take.
+ * Instructions are counted by engines, only in builds with PIEX_PROFILING (cmake -DENABLE_PROFILING=1),
+ * otherwise counters stay zero and engines have no trace of profiler.
+ * While profiler is attached, JIT engine runs as INTERPRETER, its native code is not counted.
+ */
+struct profiler_t : keyboard_system_iface_t, timers_system_iface_t, video_system_iface_t, sound_system_iface_t {
+    profiler_t(
+        keyboard_system_iface_t& keyboard_system,
+        timers_system_iface_t& timers_system,
+        video_system_iface_t& video_system,
+        sound_system_iface_t& sound_system
+    );
+
+    // vm has to use the profiler as its peripherals; profiler has to outlive vm or be detached
+    void attach(vm_t& vm) noexcept;
+    void detach() noexcept;
+
+    bool is_pressed(keyboard_key_t key) override;
+    // waits for user, not measured
+    keyboard_key_t wait_for_keypress() override;
+    std::optional<keyboard_key_t> take_keypress() override;
+    void tick(std::chrono::nanoseconds duration) override;
+    void render(const video_memory_t& video_memory, const video_rows_t& dirty_rows) override;
+    void play_sound(std::chrono::nanoseconds duration, std::chrono::nanoseconds audible, const audio_t& audio) override;
+
+    // called by engines for every executed instruction
+    void count_instruction(uint16_t pc, opcode_t opcode) noexcept {
+        ++opcodes[opcode.bytes];
+        ++addresses[pc];
+    }
+
+    profile_t get_profile() const;
+
+    void reset() noexcept;
+
+private:
+    enum peripheral_t {
+        RENDER,
+        TICK,
+        PLAY_SOUND,
+        IS_PRESSED,
+        PERIPHERALS_COUNT,
+    };
+
+    struct timing_t {
+        uint64_t calls = 0;
+        std::chrono::nanoseconds duration = std::chrono::nanoseconds::zero();
+    };
+
+    // calls f and adds its time to the peripheral
+    template <typename F>
+    decltype(auto) measure(peripheral_t peripheral, F&& f);
+
+    keyboard_system_iface_t& keyboard_system;
+    timers_system_iface_t& timers_system;
+    video_system_iface_t& video_system;
+    sound_system_iface_t& sound_system;
+
+    vm_t* vm = nullptr;
+    // opcodes are named by the decoder of the last attached vm
+    vm_t::settings_t::emulator_type_t emulator_type = vm_t::settings_t::CHIP_8;
+
+    std::vector<uint64_t> opcodes = std::vector<uint64_t>(OPCODES_COUNT);
+    std::vector<uint64_t> addresses = std::vector<uint64_t>(MEMORY_SIZE);
+    std::array<timing_t, PERIPHERALS_COUNT> timings;
+};
+
+// counts the instruction at pc, if profiler is attached to vm; nothing at all without PIEX_PROFILING
+inline void profile_instruction([[maybe_unused]] vm_t& vm, [[maybe_unused]] uint16_t pc, [[maybe_unused]] opcode_t opcode) noexcept {
+#if PIEX_PROFILING
+    if (vm.profiler != nullptr) [[unlikely]] {
+        vm.profiler->count_instruction(pc, opcode);
+    }
+#endif
+}
+
+} // namespace chip8
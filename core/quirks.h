@@ -0,0 +1,67 @@
+#pragma once
+
+
+namespace chip8 {
+
+/**
+ * Behaviour, that differs between CHIP-8 implementations. Every flag is independent of the others.
+ */
+struct quirks_t {
+    bool vf_reset = false;          // OR_VX_VY, AND_VX_VY and XOR_VX_VY reset VF
+    bool memory_increment = false;  // LD_I_VX and LD_VX_I leave I right after the last accessed byte
+    bool jump_vx = false;           // JP_V0_ADDR jumps to nnn + Vx, where x is the high nibble of nnn
+    bool clipping = true;           // sprites are clipped at the edges of the screen, instead of wrapping around
+    bool shifting = false;          // SHR_VX_VY and SHL_VX_VY shift Vx in place, Vy is ignored
+    bool display_wait = false;      // DRW_VX_VY_N waits for the next tick of timers
+
+    bool operator==(const quirks_t&) const noexcept = default;
+};
+
+inline constexpr quirks_t CHIP_8_QUIRKS = {
+    .vf_reset = true,
+    .memory_increment = true,
+    .jump_vx = false,
+    .clipping = true,
+    .shifting = false,
+    .display_wait = false,
+};
+
+inline constexpr quirks_t SCHIP_QUIRKS = {
+    .vf_reset = false,
+    .memory_increment = false,
+    .jump_vx = true,
+    .clipping = true,
+    .shifting = false,
+    .display_wait = false,
+};
+
+/**
+ * Quirks, known at compile time. Instructions get them as the last argument,
+ * so every profile gets its own instantiation without quirk branches.
+ */
+template <quirks_t Quirks>
+struct static_quirks_t {
+    static constexpr bool vf_reset = Quirks.vf_reset;
+    static constexpr bool memory_increment = Quirks.memory_increment;
+    static constexpr bool jump_vx = Quirks.jump_vx;
+    static constexpr bool clipping = Quirks.clipping;
+    static constexpr bool shifting = Quirks.shifting;
+    static constexpr bool display_wait = Quirks.display_wait;
+};
+
+/**
+ * Calls f with static_quirks_t of the profile, that matches quirks,
+ * or with quirks as they are, when there is no such profile.
+ */
+template <typename F>
+decltype(auto) visit_quirks(const quirks_t& quirks, F&& f) {
+    if (quirks == CHIP_8_QUIRKS) {
+        return f(static_quirks_t<CHIP_8_QUIRKS>{});
+    }
+    if (quirks == SCHIP_QUIRKS) {
+        return f(static_quirks_t<SCHIP_QUIRKS>{});
+    }
+    return f(quirks);
+}
+
+} // namespace chip8
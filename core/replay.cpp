@@ -0,0 +1,482 @@
+#include <core/replay.h>
+
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+
+
+namespace chip8 {
+
+namespace {
+
+void write_u8(bytes_owned& out, uint8_t value) {
+    out.push_back(value);
+}
+
+void write_u16(bytes_owned& out, uint16_t value) {
+    out.push_back(static_cast<uint8_t>(value));
+    out.push_back(static_cast<uint8_t>(value >> 8));
+}
+
+void write_u64(bytes_owned& out, uint64_t value) {
+    for (size_t i = 0; i < 8; ++i) {
+        out.push_back(static_cast<uint8_t>(value >> (8 * i)));
+    }
+}
+
+void write_varint(bytes_owned& out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<uint8_t>(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<uint8_t>(value));
+}
+
+// reads little-endian values, offset is moved past them
+struct reader_t {
+    const bytes_owned& data;
+    size_t& offset;
+
+    void require(size_t size) const {
+        if (data.size() - offset < size) {
+            throw std::runtime_error("replay: recording is truncated");
+        }
+    }
+
+    uint8_t u8() {
+        require(1);
+        return data[offset++];
+    }
+
+    uint16_t u16() {
+        const uint16_t low = u8();
+        return static_cast<uint16_t>(low | u8() << 8);
+    }
+
+    uint64_t u64() {
+        uint64_t value = 0;
+        for (size_t i = 0; i < 8; ++i) {
+            value |= uint64_t{u8()} << (8 * i);
+        }
+        return value;
+    }
+
+    uint64_t varint() {
+        uint64_t value = 0;
+        for (size_t shift = 0; shift < 64; shift += 7) {
+            const auto byte = u8();
+            value |= uint64_t{byte & 0x7Fu} << shift;
+            if ((byte & 0x80) == 0) {
+                return value;
+            }
+        }
+        throw std::runtime_error("replay: malformed varint");
+    }
+};
+
+// everything, that vm needs to go on from the keyframe, with keys, that were pressed then
+struct state_t {
+    std::array<uint8_t, REGISTERS_SIZE> V;
+    uint16_t I;
+    uint16_t pc;
+    uint8_t sp;
+    uint8_t delay_timer;
+    uint8_t sound_timer;
+    std::array<uint16_t, STACK_SIZE> stack;
+    uint64_t timers_duration;
+    uint64_t frame_cycles;
+    bool vblank;
+    std::array<uint8_t, MEMORY_SIZE> memory;
+    video_memory_t video_memory;
+    audio_t audio;
+    uint16_t keys;
+
+    static state_t from(const vm_t& vm, uint16_t keys) {
+        return state_t{
+            .V = vm.V,
+            .I = vm.I,
+            .pc = vm.pc,
+            .sp = vm.sp,
+            .delay_timer = vm.delay_timer,
+            .sound_timer = vm.sound_timer,
+            .stack = vm.stack,
+            .timers_duration = static_cast<uint64_t>(vm.timers_duration.count()),
+            .frame_cycles = vm.frame_cycles,
+            .vblank = vm.vblank,
+            .memory = vm.memory,
+            .video_memory = vm.video_memory,
+            .audio = vm.audio,
+            .keys = keys,
+        };
+    }
+
+    void apply(vm_t& vm) const {
+        vm.V = V;
+        vm.I = I;
+        vm.pc = pc;
+        vm.sp = sp;
+        vm.delay_timer = delay_timer;
+        vm.sound_timer = sound_timer;
+        vm.stack = stack;
+        vm.timers_duration = std::chrono::nanoseconds(timers_duration);
+        vm.frame_cycles = frame_cycles;
+        vm.vblank = vblank;
+        vm.video_memory = video_memory;
+        vm.audio = audio;
+        vm.dirty_rows.set();
+
+        // memory was replaced as a whole, caches of engines have to go
+        vm.memory = memory;
+        vm.written_memory.set(0, MEMORY_SIZE);
+    }
+
+    void write(bytes_owned& out) const {
+        out.append(V.data(), V.size());
+        write_u16(out, I);
+        write_u16(out, pc);
+        write_u8(out, sp);
+        write_u8(out, delay_timer);
+        write_u8(out, sound_timer);
+        for (auto value : stack) {
+            write_u16(out, value);
+        }
+        write_varint(out, timers_duration);
+        write_varint(out, frame_cycles);
+        write_u8(out, vblank);
+        out.append(memory.data(), memory.size());
+        for (const auto& plane : video_memory.planes) {
+            for (const auto& row : plane) {
+                for (auto word : row) {
+                    write_u64(out, word);
+                }
+            }
+        }
+        write_u8(out, video_memory.hires);
+        write_u8(out, video_memory.selected_planes);
+        out.append(audio.pattern.data(), audio.pattern.size());
+        write_u8(out, audio.pitch);
+        write_u16(out, keys);
+    }
+
+    static state_t read(reader_t& reader) {
+        state_t state;
+        for (auto& value : state.V) {
+            value = reader.u8();
+        }
+        state.I = reader.u16();
+        state.pc = reader.u16();
+        state.sp = reader.u8();
+        state.delay_timer = reader.u8();
+        state.sound_timer = reader.u8();
+        for (auto& value : state.stack) {
+            value = reader.u16();
+        }
+        state.timers_duration = reader.varint();
+        state.frame_cycles = reader.varint();
+        state.vblank = reader.u8() != 0;
+        reader.require(MEMORY_SIZE);
+        std::copy_n(reader.data.begin() + static_cast<std::ptrdiff_t>(reader.offset), MEMORY_SIZE, state.memory.begin());
+        reader.offset += MEMORY_SIZE;
+        for (auto& plane : state.video_memory.planes) {
+            for (auto& row : plane) {
+                for (auto& word : row) {
+                    word = reader.u64();
+                }
+            }
+        }
+        state.video_memory.hires = reader.u8() != 0;
+        state.video_memory.selected_planes = reader.u8();
+        for (auto& value : state.audio.pattern) {
+            value = reader.u8();
+        }
+        state.audio.pitch = reader.u8();
+        state.keys = reader.u16();
+        return state;
+    }
+
+    bool operator==(const state_t&) const = default;
+};
+
+/**
+ * True, if vm stopped at the instruction, that made timers tick.
+ * Engines might run a few more instructions before they advance timers (or tick several times at once),
+ * vm is somewhere past the tick then, such state is neither recorded, nor compared.
+ */
+bool is_at_tick(const vm_t& vm) {
+    if (vm.settings.cycles_per_frame > 0) {
+        // with cycle costs only the interpreter runs, it advances timers after every instruction
+        return vm.settings.cycle_costs != nullptr || vm.frame_cycles == 0;
+    }
+    return vm.timers_duration < vm.settings.op_duration;
+}
+
+uint16_t to_keys(const std::bitset<KEYPAD_SIZE>& keys) {
+    return static_cast<uint16_t>(keys.to_ulong());
+}
+
+} // namespace
+
+
+recorder_t::recorder_t(
+    keyboard_system_iface_t& keyboard_system,
+    random_system_iface_t& random_system,
+    timers_system_iface_t& timers_system,
+    uint64_t keyframe_interval
+)
+    : keyboard_system(keyboard_system)
+    , random_system(random_system)
+    , timers_system(timers_system)
+    , keyframe_interval(keyframe_interval)
+{
+    if (keyframe_interval == 0) {
+        throw std::invalid_argument("recorder needs non-zero keyframe interval");
+    }
+
+    for (size_t i = 0; i < 4; ++i) {
+        write_u8(recording, static_cast<uint8_t>(replay::MAGIC >> (8 * i)));
+    }
+    write_u8(recording, replay::VERSION);
+}
+
+void recorder_t::attach(const vm_t& vm) {
+    this->vm = &vm;
+    write_keyframe();
+}
+
+bool recorder_t::is_pressed(keyboard_key_t key) {
+    return keys[key % KEYPAD_SIZE];
+}
+
+keyboard_key_t recorder_t::wait_for_keypress() {
+    const auto key = keyboard_system.wait_for_keypress();
+    write_keypress(key);
+    return key;
+}
+
+std::optional<keyboard_key_t> recorder_t::take_keypress() {
+    // waits without a key are run again, only the key itself is recorded
+    const auto key = keyboard_system.take_keypress();
+    if (key) {
+        write_keypress(*key);
+    }
+    return key;
+}
+
+void recorder_t::write_keypress(keyboard_key_t key) {
+    random_run = 0;
+    write_u8(recording, replay::KEYPRESS);
+    write_u8(recording, key);
+}
+
+uint8_t recorder_t::get_random_byte() {
+    const auto byte = random_system.get_random_byte();
+
+    if (random_run == 0 || recording[random_run] == 0xFF) {
+        write_u8(recording, replay::RANDOM);
+        random_run = recording.size();
+        write_u8(recording, 0);
+    }
+    ++recording[random_run];
+    write_u8(recording, byte);
+
+    return byte;
+}
+
+void recorder_t::tick(std::chrono::nanoseconds duration) {
+    timers_system.tick(duration);
+    ++ticks;
+
+    // vm sees keys, sampled right after the tick, until the next one
+    std::bitset<KEYPAD_SIZE> sampled;
+    for (size_t key = 0; key < KEYPAD_SIZE; ++key) {
+        sampled[key] = keyboard_system.is_pressed(static_cast<keyboard_key_t>(key));
+    }
+    if (sampled != keys) {
+        keys = sampled;
+        random_run = 0;
+        write_u8(recording, replay::KEYS);
+        write_varint(recording, ticks - last_event_tick);
+        write_u16(recording, to_keys(keys));
+        last_event_tick = ticks;
+    }
+
+    if (vm != nullptr && ticks - last_keyframe_tick >= keyframe_interval && is_at_tick(*vm)) {
+        write_keyframe();
+    }
+}
+
+const bytes_owned& recorder_t::get_recording() const noexcept {
+    return recording;
+}
+
+uint64_t recorder_t::get_tick() const noexcept {
+    return ticks;
+}
+
+void recorder_t::write_keyframe() {
+    random_run = 0;
+    write_u8(recording, replay::KEYFRAME);
+    write_varint(recording, ticks);
+    state_t::from(*vm, to_keys(keys)).write(recording);
+    last_event_tick = ticks;
+    last_keyframe_tick = ticks;
+}
+
+
+replayer_t::replayer_t(bytes_view recording)
+    : recording(recording)
+{
+    reader_t reader{this->recording, offset};
+
+    uint32_t magic = 0;
+    for (size_t i = 0; i < 4; ++i) {
+        magic |= uint32_t{reader.u8()} << (8 * i);
+    }
+    if (magic != replay::MAGIC || reader.u8() != replay::VERSION) {
+        throw std::runtime_error("replay: not a recording, or unsupported version");
+    }
+
+    // index of keyframes, events are checked on the way
+    const size_t events = offset;
+    while (offset < this->recording.size()) {
+        const auto event_offset = offset;
+        switch (reader.u8()) {
+            case replay::KEYS:
+                reader.varint();
+                reader.u16();
+                break;
+            case replay::RANDOM: {
+                const auto count = reader.u8();
+                reader.require(count);
+                offset += count;
+                break;
+            }
+            case replay::KEYPRESS:
+                reader.u8();
+                break;
+            case replay::KEYFRAME:
+                keyframes.push_back(keyframe_t{.tick = reader.varint(), .offset = event_offset});
+                state_t::read(reader);
+                break;
+            default:
+                throw std::runtime_error("replay: unknown event");
+        }
+    }
+    offset = events;
+
+    if (keyframes.empty()) {
+        throw std::runtime_error("replay: recording has no keyframes");
+    }
+}
+
+void replayer_t::attach(vm_t& vm) {
+    this->vm = &vm;
+    restore_keyframe(keyframes.front());
+}
+
+void replayer_t::seek(uint64_t tick) {
+    if (vm->settings.op_duration <= std::chrono::nanoseconds::zero() && vm->settings.cycles_per_frame == 0) {
+        throw std::logic_error("replay: timers of vm do not tick");
+    }
+
+    const auto next = std::upper_bound(keyframes.begin(), keyframes.end(), tick, [](uint64_t tick, const keyframe_t& keyframe) {
+        return tick < keyframe.tick;
+    });
+    restore_keyframe(*std::prev(next));
+
+    while (ticks < tick) {
+        if (const auto fault = vm->emulate_instructions(vm->instructions_until_tick())) {
+            throw std::runtime_error("replay: vm faulted before the tick\n" + fault.describe());
+        }
+    }
+}
+
+bool replayer_t::is_pressed(keyboard_key_t key) {
+    return keys[key % KEYPAD_SIZE];
+}
+
+keyboard_key_t replayer_t::wait_for_keypress() {
+    reader_t reader{recording, offset};
+    if (random_left > 0 || offset == recording.size() || reader.u8() != replay::KEYPRESS) {
+        throw std::runtime_error("replay: vm waits for a key, that was not recorded");
+    }
+    return static_cast<keyboard_key_t>(reader.u8() % KEYPAD_SIZE);
+}
+
+uint8_t replayer_t::get_random_byte() {
+    reader_t reader{recording, offset};
+    if (random_left == 0) {
+        if (offset == recording.size() || reader.u8() != replay::RANDOM) {
+            throw std::runtime_error("replay: vm asks for a random byte, that was not recorded");
+        }
+        random_left = reader.u8();
+    }
+    --random_left;
+    return reader.u8();
+}
+
+void replayer_t::tick(std::chrono::nanoseconds) {
+    ++ticks;
+    apply_tick_events(true);
+}
+
+uint64_t replayer_t::get_tick() const noexcept {
+    return ticks;
+}
+
+bool replayer_t::is_finished() const noexcept {
+    return offset == recording.size() && random_left == 0;
+}
+
+void replayer_t::restore_keyframe(const keyframe_t& keyframe) {
+    offset = keyframe.offset;
+    ticks = keyframe.tick;
+    last_event_tick = keyframe.tick;
+    random_left = 0;
+    apply_tick_events(false);
+}
+
+void replayer_t::apply_tick_events(bool verify) {
+    // bytes of one RANDOM event might span several ticks, events of this tick are behind them
+    if (random_left > 0) {
+        return;
+    }
+
+    while (offset < recording.size()) {
+        size_t next = offset;
+        reader_t reader{recording, next};
+        const auto event = reader.u8();
+        if (event != replay::KEYS && event != replay::KEYFRAME) {
+            return;
+        }
+
+        const auto tick = event == replay::KEYS ? last_event_tick + reader.varint() : reader.varint();
+        if (tick > ticks) {
+            return;
+        }
+        if (tick < ticks) {
+            std::stringstream error;
+            error << "replay: vm diverged, events of tick " << tick << " were not used before tick " << ticks;
+            throw std::runtime_error(error.str());
+        }
+
+        if (event == replay::KEYS) {
+            keys = reader.u16();
+        } else {
+            const auto state = state_t::read(reader);
+            if (!verify) {
+                state.apply(*vm);
+            } else if (is_at_tick(*vm) && !(state == state_t::from(*vm, state.keys))) {
+                std::stringstream error;
+                error << "replay: vm diverged from the keyframe at tick " << tick;
+                throw std::runtime_error(error.str());
+            }
+            keys = state.keys;
+        }
+
+        last_event_tick = tick;
+        offset = next;
+    }
+}
+
+} // namespace chip8
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <bitset>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+#include <core/common.h>
+#include <core/iface/keyboard.h>
+#include <core/iface/random.h>
+#include <core/iface/timers.h>
+#include <core/vm.h>
+
+
+namespace chip8 {
+
+/**
+ * Recording is a stream of events in the order vm asked for them:
+ * changes of keyboard state, random bytes, results of wait_for_keypress and keyframes of the whole vm state.
+ * Time is measured in ticks of timers, they happen between the same instructions in every engine.
+ *
+ * Keyboard is sampled once per tick, so the state, that vm sees between two ticks, is recorded exactly.
+ */
+namespace replay {
+
+inline constexpr uint32_t MAGIC = 0x58454950; // "PIEX"
+inline constexpr uint8_t VERSION = 4;
+
+enum event_t : uint8_t {
+    KEYS = 1,       // varint ticks since the previous KEYS or KEYFRAME, u16 pressed keys
+    RANDOM = 2,     // u8 count, bytes
+    KEYPRESS = 3,   // u8 key
+    KEYFRAME = 4,   // varint tick, state of vm
+};
+
+} // namespace replay
+
+/**
+ * Sits between vm and live peripherals, forwards calls to them and records what they return.
+ * attach() has to be called with the vm, that uses the recorder, before it runs.
+ */
+struct recorder_t : keyboard_system_iface_t, random_system_iface_t, timers_system_iface_t {
+    static inline constexpr uint64_t DEFAULT_KEYFRAME_INTERVAL = 600;
+
+    recorder_t(
+        keyboard_system_iface_t& keyboard_system,
+        random_system_iface_t& random_system,
+        timers_system_iface_t& timers_system,
+        uint64_t keyframe_interval = DEFAULT_KEYFRAME_INTERVAL
+    );
+
+    // writes the first keyframe, so replay can start from the current state of vm
+    void attach(const vm_t& vm);
+
+    bool is_pressed(keyboard_key_t key) override;
+    keyboard_key_t wait_for_keypress() override;
+    std::optional<keyboard_key_t> take_keypress() override;
+    uint8_t get_random_byte() override;
+    void tick(std::chrono::nanoseconds duration) override;
+
+    const bytes_owned& get_recording() const noexcept;
+
+    uint64_t get_tick() const noexcept;
+
+private:
+    void write_keyframe();
+    void write_keypress(keyboard_key_t key);
+
+    keyboard_system_iface_t& keyboard_system;
+    random_system_iface_t& random_system;
+    timers_system_iface_t& timers_system;
+    const uint64_t keyframe_interval;
+
+    const vm_t* vm = nullptr;
+    bytes_owned recording;
+
+    uint64_t ticks = 0;
+    uint64_t last_event_tick = 0;
+    uint64_t last_keyframe_tick = 0;
+    std::bitset<KEYPAD_SIZE> keys;
+    // offset of the count of the last RANDOM event, while nothing else was written after it
+    size_t random_run = 0;
+};
+
+/**
+ * Feeds recorded inputs back to vm, ticks do not sleep, so it runs as fast as it can.
+ * Keyframes, met on the way, are compared with vm, divergence throws.
+ */
+struct replayer_t : keyboard_system_iface_t, random_system_iface_t, timers_system_iface_t {
+    explicit replayer_t(bytes_view recording);
+
+    // restores the first keyframe into vm, vm has to use the replayer
+    void attach(vm_t& vm);
+
+    // restores the latest keyframe at or before `tick` and runs vm up to it
+    void seek(uint64_t tick);
+
+    bool is_pressed(keyboard_key_t key) override;
+    keyboard_key_t wait_for_keypress() override;
+    uint8_t get_random_byte() override;
+    void tick(std::chrono::nanoseconds duration) override;
+
+    uint64_t get_tick() const noexcept;
+
+    // true, if all recorded events were replayed
+    bool is_finished() const noexcept;
+
+private:
+    struct keyframe_t {
+        uint64_t tick;
+        size_t offset; // of the keyframe event
+    };
+
+    void restore_keyframe(const keyframe_t& keyframe);
+    // applies events of the current tick, that go before anything vm might ask for
+    void apply_tick_events(bool verify);
+
+    bytes_owned recording;
+    std::vector<keyframe_t> keyframes;
+
+    vm_t* vm = nullptr;
+    size_t offset = 0;
+    uint64_t ticks = 0;
+    uint64_t last_event_tick = 0;
+    std::bitset<KEYPAD_SIZE> keys;
+    size_t random_left = 0;
+};
+
+} // namespace chip8
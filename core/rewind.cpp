@@ -0,0 +1,236 @@
+#include <core/rewind.h>
+
+#include <bit>
+#include <cstring>
+#include <stdexcept>
+
+
+namespace chip8 {
+
+namespace {
+
+inline constexpr size_t PAGES_COUNT = MEMORY_SIZE / rewind_t::PAGE_SIZE;
+inline constexpr uint64_t ALL_PAGES = PAGES_COUNT == 64 ? ~uint64_t{0} : (uint64_t{1} << PAGES_COUNT) - 1;
+static_assert(VIDEO_HEIGHT <= 64, "rows must fit one word");
+inline constexpr uint64_t ALL_ROWS = VIDEO_HEIGHT == 64 ? ~uint64_t{0} : (uint64_t{1} << VIDEO_HEIGHT) - 1;
+
+// vectors of the ring are reused, so the ones, that held a keyframe, would keep its whole size otherwise
+template <typename T>
+void shrink(std::vector<T>& values) {
+    if (values.capacity() > 2 * values.size()) {
+        values.shrink_to_fit();
+    }
+}
+
+} // namespace
+
+
+bool rewind_t::snapshot_t::is_keyframe() const noexcept {
+    return pages == ALL_PAGES;
+}
+
+const uint8_t* rewind_t::snapshot_t::get_page(size_t page) const noexcept {
+    // pages are stored densely, index is the number of stored pages before this one
+    const auto before = pages & ((uint64_t{1} << page) - 1);
+    return data.data() + std::popcount(before) * PAGE_SIZE;
+}
+
+const video_memory_t::row_t* rewind_t::snapshot_t::get_row(size_t row) const noexcept {
+    const auto before = rows & ((uint64_t{1} << row) - 1);
+    return video.data() + std::popcount(before) * VIDEO_PLANES;
+}
+
+
+rewind_t::rewind_t(vm_t& vm, uint32_t interval, size_t capacity)
+    : vm(vm)
+    , interval(interval)
+    , ring(capacity)
+{
+    if (interval == 0 || capacity == 0) {
+        throw std::invalid_argument("rewind needs non-zero interval and capacity");
+    }
+}
+
+void rewind_t::on_ticks(uint64_t ticks) {
+    ticks_since_snapshot += ticks;
+    if (ticks_since_snapshot >= interval) {
+        ticks_since_snapshot = 0;
+        take_snapshot();
+    }
+}
+
+void rewind_t::take_snapshot() {
+    pages_since_keyframe |= vm.written_memory.take_pages();
+    // rows of the current frame are not presented yet
+    rows_since_keyframe |= (vm.written_rows | vm.dirty_rows).to_ullong();
+    vm.written_rows.reset();
+
+    if (count == ring.size()) {
+        drop_oldest();
+    }
+
+    const bool keyframe = count == 0 || snapshots_since_keyframe + 1 >= KEYFRAME_INTERVAL;
+    if (keyframe) {
+        pages_since_keyframe = ALL_PAGES;
+        rows_since_keyframe = ALL_ROWS;
+    }
+
+    auto& snapshot = at(count++);
+    snapshot.V = vm.V;
+    snapshot.I = vm.I;
+    snapshot.pc = vm.pc;
+    snapshot.sp = vm.sp;
+    snapshot.delay_timer = vm.delay_timer;
+    snapshot.sound_timer = vm.sound_timer;
+    snapshot.stack = vm.stack;
+    snapshot.hires = vm.video_memory.hires;
+    snapshot.selected_planes = vm.video_memory.selected_planes;
+    snapshot.audio = vm.audio;
+    snapshot.timers_duration = vm.timers_duration;
+    snapshot.frame_cycles = vm.frame_cycles;
+    snapshot.vblank = vm.vblank;
+
+    snapshot.pages = pages_since_keyframe;
+    snapshot.data.clear();
+    for (uint64_t pages = snapshot.pages; pages != 0; pages &= pages - 1) {
+        const auto page = vm.memory.data() + std::countr_zero(pages) * PAGE_SIZE;
+        snapshot.data.insert(snapshot.data.end(), page, page + PAGE_SIZE);
+    }
+
+    snapshot.rows = rows_since_keyframe;
+    snapshot.video.clear();
+    for (uint64_t rows = snapshot.rows; rows != 0; rows &= rows - 1) {
+        const auto row = static_cast<size_t>(std::countr_zero(rows));
+        for (const auto& plane : vm.video_memory.planes) {
+            snapshot.video.push_back(plane[row]);
+        }
+    }
+
+    if (keyframe) {
+        pages_since_keyframe = 0;
+        rows_since_keyframe = 0;
+        snapshots_since_keyframe = 0;
+    } else {
+        shrink(snapshot.data);
+        shrink(snapshot.video);
+        ++snapshots_since_keyframe;
+    }
+}
+
+size_t rewind_t::size() const noexcept {
+    return count;
+}
+
+void rewind_t::restore(size_t steps_back) {
+    if (steps_back >= count) {
+        throw std::out_of_range("rewind: no such snapshot");
+    }
+
+    const size_t index = count - 1 - steps_back;
+    size_t keyframe_index = index;
+    while (!at(keyframe_index).is_keyframe()) {
+        --keyframe_index;
+    }
+
+    const auto& snapshot = at(index);
+    const auto& keyframe = at(keyframe_index);
+
+    vm.V = snapshot.V;
+    vm.I = snapshot.I;
+    vm.pc = snapshot.pc;
+    vm.sp = snapshot.sp;
+    vm.delay_timer = snapshot.delay_timer;
+    vm.sound_timer = snapshot.sound_timer;
+    vm.stack = snapshot.stack;
+    vm.audio = snapshot.audio;
+    vm.timers_duration = snapshot.timers_duration;
+    vm.frame_cycles = snapshot.frame_cycles;
+    vm.vblank = snapshot.vblank;
+
+    // only pages, that differ, are copied, engines drop code there
+    for (size_t page = 0; page < PAGES_COUNT; ++page) {
+        const bool in_snapshot = (snapshot.pages >> page) & 0x1;
+        const auto source = in_snapshot ? snapshot.get_page(page) : keyframe.get_page(page);
+        const auto destination = vm.memory.data() + page * PAGE_SIZE;
+
+        if (std::memcmp(destination, source, PAGE_SIZE) != 0) {
+            std::memcpy(destination, source, PAGE_SIZE);
+            vm.written_memory.set(page * PAGE_SIZE, PAGE_SIZE);
+        }
+    }
+
+    vm.video_memory.hires = snapshot.hires;
+    vm.video_memory.selected_planes = snapshot.selected_planes;
+    for (size_t row = 0; row < VIDEO_HEIGHT; ++row) {
+        const bool in_snapshot = (snapshot.rows >> row) & 0x1;
+        const auto source = in_snapshot ? snapshot.get_row(row) : keyframe.get_row(row);
+        for (size_t plane = 0; plane < VIDEO_PLANES; ++plane) {
+            vm.video_memory.planes[plane][row] = source[plane];
+        }
+    }
+
+    // only rows, that differ from the presented frame, are drawn again, so the next snapshot does not take the others
+    const bool same_resolution = vm.video_memory.hires == vm.presented_video_memory.hires;
+    vm.dirty_rows.reset();
+    for (size_t row = 0; row < VIDEO_HEIGHT; ++row) {
+        if (!same_resolution || !vm.video_memory.is_same_row(vm.presented_video_memory, row)) {
+            vm.dirty_rows.set(row);
+        }
+    }
+
+    // memory and screen are the ones of the snapshot now, so they differ from the keyframe by the pages and rows of the snapshot
+    vm.written_memory.take_pages();
+    vm.written_rows.reset();
+    pages_since_keyframe = snapshot.is_keyframe() ? 0 : snapshot.pages;
+    rows_since_keyframe = snapshot.is_keyframe() ? 0 : snapshot.rows;
+    snapshots_since_keyframe = index - keyframe_index;
+    ticks_since_snapshot = 0;
+    count = index + 1;
+}
+
+size_t rewind_t::memory_usage() const noexcept {
+    size_t usage = ring.size() * sizeof(snapshot_t);
+    for (const auto& snapshot : ring) {
+        usage += snapshot.data.capacity() + snapshot.video.capacity() * sizeof(video_memory_t::row_t);
+    }
+    return usage;
+}
+
+rewind_t::snapshot_t& rewind_t::at(size_t index) noexcept {
+    return ring[(first + index) % ring.size()];
+}
+
+const rewind_t::snapshot_t& rewind_t::at(size_t index) const noexcept {
+    return ring[(first + index) % ring.size()];
+}
+
+void rewind_t::drop_oldest() {
+    if (count > 1 && !at(1).is_keyframe()) {
+        // the next one has to carry the whole memory, its own pages over the ones of the keyframe
+        const auto& keyframe = at(0);
+        auto& next = at(1);
+
+        std::vector<uint8_t> data;
+        data.reserve(MEMORY_SIZE);
+        for (size_t page = 0; page < PAGES_COUNT; ++page) {
+            const auto source = ((next.pages >> page) & 0x1) ? next.get_page(page) : keyframe.get_page(page);
+            data.insert(data.end(), source, source + PAGE_SIZE);
+        }
+        next.data = std::move(data);
+        next.pages = ALL_PAGES;
+
+        std::vector<video_memory_t::row_t> video;
+        video.reserve(VIDEO_HEIGHT * VIDEO_PLANES);
+        for (size_t row = 0; row < VIDEO_HEIGHT; ++row) {
+            const auto source = ((next.rows >> row) & 0x1) ? next.get_row(row) : keyframe.get_row(row);
+            video.insert(video.end(), source, source + VIDEO_PLANES);
+        }
+        next.video = std::move(video);
+        next.rows = ALL_ROWS;
+    }
+
+    first = (first + 1) % ring.size();
+    --count;
+}
+
+} // namespace chip8
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+#include <core/common.h>
+#include <core/vm.h>
+
+
+namespace chip8 {
+
+/**
+ * Ring buffer of snapshots of the vm, taken every `settings.rewind_interval` ticks of timers.
+ *
+ * Every KEYFRAME_INTERVAL-th snapshot is a keyframe with the whole memory and screen, the others keep only pages,
+ * that guest wrote since their keyframe (vm_t::written_memory remembers written pages),
+ * and rows of the screen, that were drawn since then (vm_t::written_rows remembers them).
+ * When the ring is full, the oldest snapshot is dropped, the next one becomes a keyframe.
+ *
+ * Restoring copies registers, the pages, that differ from the snapshot, and the rows, nothing is replayed.
+ */
+struct rewind_t {
+    static inline constexpr size_t PAGE_SIZE = memory_bitmap_t::PAGE_SIZE;
+    static inline constexpr size_t KEYFRAME_INTERVAL = 16;
+
+    rewind_t(vm_t& vm, uint32_t interval, size_t capacity);
+
+    rewind_t(const rewind_t&) = delete;
+    rewind_t& operator=(const rewind_t&) = delete;
+
+    // called by vm, after timers ticked
+    void on_ticks(uint64_t ticks);
+
+    void take_snapshot();
+
+    // number of kept snapshots
+    size_t size() const noexcept;
+
+    // brings vm back to the snapshot `steps_back` snapshots before the latest one, newer snapshots are dropped
+    void restore(size_t steps_back = 0);
+
+    // bytes, taken by the kept snapshots
+    size_t memory_usage() const noexcept;
+
+    struct snapshot_t {
+        std::array<uint8_t, REGISTERS_SIZE> V;
+        uint16_t I;
+        uint16_t pc;
+        uint8_t sp;
+        uint8_t delay_timer;
+        uint8_t sound_timer;
+        std::array<uint16_t, STACK_SIZE> stack;
+        bool hires;
+        uint8_t selected_planes;
+        audio_t audio;
+        std::chrono::nanoseconds timers_duration;
+        uint64_t frame_cycles;
+        bool vblank;
+
+        // pages, stored in `data` in order of their addresses, keyframe has all of them
+        uint64_t pages;
+        std::vector<uint8_t> data;
+        // rows of the screen, VIDEO_PLANES of them each, stored in `video` in order of their numbers, keyframe has all of them
+        uint64_t rows;
+        std::vector<video_memory_t::row_t> video;
+
+        bool is_keyframe() const noexcept;
+        const uint8_t* get_page(size_t page) const noexcept;
+        // row of every plane
+        const video_memory_t::row_t* get_row(size_t row) const noexcept;
+    };
+
+private:
+    snapshot_t& at(size_t index) noexcept;
+    const snapshot_t& at(size_t index) const noexcept;
+    // the oldest one becomes keyframe, if the oldest keyframe goes away
+    void drop_oldest();
+
+    vm_t& vm;
+    const uint32_t interval;
+
+    // ring of snapshots, vectors of dropped snapshots are reused
+    std::vector<snapshot_t> ring;
+    size_t first = 0;
+    size_t count = 0;
+
+    uint64_t ticks_since_snapshot = 0;
+    // pages, written since the latest keyframe
+    uint64_t pages_since_keyframe = 0;
+    // rows, drawn since the latest keyframe
+    uint64_t rows_since_keyframe = 0;
+    size_t snapshots_since_keyframe = 0;
+};
+
+} // namespace chip8
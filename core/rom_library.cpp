@@ -0,0 +1,221 @@
+#include <core/rom_library.h>
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+#if defined(__linux__) || defined(__FreeBSD__) || defined(__APPLE__)
+#define PIEX_MMAP_SUPPORTED 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#define PIEX_MMAP_SUPPORTED 0
+#endif
+
+
+namespace chip8 {
+
+namespace {
+
+inline constexpr size_t MAX_ROM_SIZE = MEMORY_SIZE - ROM_OFFSET;
+
+#if PIEX_MMAP_SUPPORTED
+// pages are read in by mmap itself, where it can, instead of one fault at a time
+#if defined(MAP_POPULATE)
+inline constexpr int MAP_FLAGS = MAP_PRIVATE | MAP_POPULATE;
+#else
+inline constexpr int MAP_FLAGS = MAP_PRIVATE;
+#endif
+#endif
+
+std::runtime_error file_error(const std::filesystem::path& path, const char* what) {
+    std::stringstream error;
+    error << what << ": " << path.string();
+    return std::runtime_error(error.str());
+}
+
+std::optional<vm_t::settings_t::emulator_type_t> type_of_extension(const std::filesystem::path& path) {
+    const auto extension = path.extension();
+    if (extension == ".ch8") {
+        return vm_t::settings_t::CHIP_8;
+    }
+    if (extension == ".sc8") {
+        return vm_t::settings_t::SCHIP1_1;
+    }
+    if (extension == ".xo8") {
+        return vm_t::settings_t::XO_CHIP;
+    }
+    return std::nullopt;
+}
+
+} // namespace
+
+rom_hash_t hash_rom(bytes_view data) noexcept {
+    rom_hash_t hash = 0xCBF29CE484222325;
+    for (auto byte : data) {
+        hash = (hash ^ byte) * 0x100000001B3;
+    }
+    return hash;
+}
+
+vm_t::settings_t rom_t::apply_profile(vm_t::settings_t settings) const {
+    if (emulator_type) {
+        settings.emulator_type = *emulator_type;
+    }
+    if (quirks) {
+        settings.quirks = quirks;
+    }
+    return settings;
+}
+
+// whole file, read-only and private to the process
+struct rom_library_t::mapping_t {
+    explicit mapping_t(const std::filesystem::path& path) {
+#if PIEX_MMAP_SUPPORTED
+        const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            throw file_error(path, "failed to open file");
+        }
+        struct stat info{};
+        if (::fstat(fd, &info) != 0) {
+            ::close(fd);
+            throw file_error(path, "failed to stat file");
+        }
+        size = static_cast<size_t>(info.st_size);
+        if (size > MAX_ROM_SIZE) {
+            ::close(fd);
+            throw file_error(path, "rom does not fit into memory");
+        }
+        if (size > 0) {
+            address = ::mmap(nullptr, size, PROT_READ, MAP_FLAGS, fd, 0);
+        }
+        ::close(fd);
+        if (address == MAP_FAILED) {
+            address = nullptr;
+            throw file_error(path, "failed to map file");
+        }
+#else
+        std::ifstream file(path, std::ios::in | std::ios::binary);
+        if (!file.is_open()) {
+            throw file_error(path, "failed to open file");
+        }
+        const auto file_size = std::filesystem::file_size(path);
+        if (file_size > MAX_ROM_SIZE) {
+            throw file_error(path, "rom does not fit into memory");
+        }
+        // one read of the whole file, there is no mapping to point into
+        buffer.resize(static_cast<size_t>(file_size));
+        file.read(reinterpret_cast<char*>(buffer.data()), static_cast<std::streamsize>(buffer.size()));
+        size = static_cast<size_t>(file.gcount());
+#endif
+    }
+
+    ~mapping_t() {
+#if PIEX_MMAP_SUPPORTED
+        if (address != nullptr) {
+            ::munmap(address, size);
+        }
+#endif
+    }
+
+    mapping_t(const mapping_t&) = delete;
+    mapping_t& operator=(const mapping_t&) = delete;
+
+    bytes_view data() const noexcept {
+#if PIEX_MMAP_SUPPORTED
+        return address != nullptr ? bytes_view(static_cast<const uint8_t*>(address), size) : bytes_view();
+#else
+        return bytes_view(buffer.data(), size);
+#endif
+    }
+
+private:
+    size_t size = 0;
+#if PIEX_MMAP_SUPPORTED
+    void* address = nullptr;
+#else
+    bytes_owned buffer;
+#endif
+};
+
+rom_library_t::rom_library_t() = default;
+
+rom_library_t::~rom_library_t() = default;
+
+void rom_library_t::add_directory(const std::filesystem::path& directory) {
+    std::vector<std::filesystem::path> paths;
+    for (const auto& entry : std::filesystem::recursive_directory_iterator(directory)) {
+        if (!entry.is_regular_file()) {
+            continue;
+        }
+        if (entry.file_size() > MAX_ROM_SIZE) {
+            skipped_files.push_back(entry.path());
+            continue;
+        }
+        paths.push_back(entry.path());
+    }
+    // directory order differs between file systems, the library does not
+    std::sort(paths.begin(), paths.end());
+
+    for (const auto& path : paths) {
+        add_file(path);
+    }
+}
+
+const rom_t& rom_library_t::add_file(const std::filesystem::path& path) {
+    if (auto it = by_path.find(path.string()); it != by_path.end()) {
+        return *it->second;
+    }
+
+    auto mapping = std::make_unique<mapping_t>(path);
+    const auto data = mapping->data();
+    const auto hash = hash_rom(data);
+
+    // the same image is kept once, the mapping of the copy goes away right here
+    auto [it, inserted] = by_hash.try_emplace(hash, nullptr);
+    if (!inserted && it->second->data == data) {
+        it->second->paths.push_back(path);
+        by_path.emplace(path.string(), it->second);
+        return *it->second;
+    }
+
+    auto rom = std::make_unique<rom_t>();
+    rom->hash = hash;
+    rom->data = data;
+    rom->paths.push_back(path);
+    rom->emulator_type = type_of_extension(path);
+
+    // images, that collide with another one, are found by path only
+    if (inserted) {
+        it->second = rom.get();
+    }
+    by_path.emplace(path.string(), rom.get());
+    mappings.push_back(std::move(mapping));
+    images.push_back(std::move(rom));
+    return *images.back();
+}
+
+const rom_t* rom_library_t::find(rom_hash_t hash) const noexcept {
+    const auto it = by_hash.find(hash);
+    return it != by_hash.end() ? it->second : nullptr;
+}
+
+const rom_t* rom_library_t::find(const std::filesystem::path& path) const {
+    const auto it = by_path.find(path.string());
+    return it != by_path.end() ? it->second : nullptr;
+}
+
+bool rom_library_t::set_profile(rom_hash_t hash, std::optional<vm_t::settings_t::emulator_type_t> emulator_type, std::optional<quirks_t> quirks) {
+    const auto it = by_hash.find(hash);
+    if (it == by_hash.end()) {
+        return false;
+    }
+    it->second->emulator_type = emulator_type;
+    it->second->quirks = quirks;
+    return true;
+}
+
+} // namespace chip8
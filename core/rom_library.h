@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <core/common.h>
+#include <core/quirks.h>
+#include <core/vm.h>
+
+
+namespace chip8 {
+
+using rom_hash_t = uint64_t;
+
+// FNV-1a of the image, the key of rom_library_t
+rom_hash_t hash_rom(bytes_view data) noexcept;
+
+/**
+ * One image of the library. `data` points into the mapping of the file, vm.load_data(rom.data, ROM_OFFSET)
+ * is the only copy of it, library has to outlive the view.
+ */
+struct rom_t {
+    rom_hash_t hash = 0;
+    bytes_view data;
+    // every file with this content, the first one is mapped
+    std::vector<std::filesystem::path> paths;
+
+    // default profile of the rom: the type comes from the extension (.ch8, .sc8, .xo8), if it is known
+    std::optional<vm_t::settings_t::emulator_type_t> emulator_type;
+    std::optional<quirks_t> quirks;
+
+    // settings with the profile of the rom over them
+    vm_t::settings_t apply_profile(vm_t::settings_t settings) const;
+};
+
+/**
+ * Corpus of ROM files, memory-mapped (read into memory, where there is no mmap) and indexed by content:
+ * identical images are kept once, with all their paths. Files are read only by the hash, when they are added,
+ * so starting many runs from the library costs a lookup and a copy into vm memory.
+ */
+struct rom_library_t {
+    rom_library_t();
+    ~rom_library_t();
+
+    rom_library_t(const rom_library_t&) = delete;
+    rom_library_t& operator=(const rom_library_t&) = delete;
+
+    // every regular file under the directory, in order of paths; files, that do not fit into memory of vm, are skipped
+    void add_directory(const std::filesystem::path& directory);
+
+    // throws std::runtime_error, if the file can not be mapped or does not fit into memory of vm
+    const rom_t& add_file(const std::filesystem::path& path);
+
+    // nullptr, if there is no such image or file
+    const rom_t* find(rom_hash_t hash) const noexcept;
+    const rom_t* find(const std::filesystem::path& path) const;
+
+    // returns false, if there is no such image
+    bool set_profile(rom_hash_t hash, std::optional<vm_t::settings_t::emulator_type_t> emulator_type, std::optional<quirks_t> quirks);
+
+    // unique images in order of addition; references stay valid, while the library lives
+    const std::vector<std::unique_ptr<rom_t>>& roms() const noexcept {
+        return images;
+    }
+
+    const std::vector<std::filesystem::path>& skipped() const noexcept {
+        return skipped_files;
+    }
+
+private:
+    struct mapping_t;
+
+    std::vector<std::unique_ptr<mapping_t>> mappings;
+    std::vector<std::unique_ptr<rom_t>> images;
+    std::unordered_map<rom_hash_t, rom_t*> by_hash;
+    std::unordered_map<std::string, rom_t*> by_path;
+    std::vector<std::filesystem::path> skipped_files;
+};
+
+} // namespace chip8
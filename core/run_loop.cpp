@@ -0,0 +1,118 @@
+#include <core/run_loop.h>
+
+#include <utility>
+
+
+namespace chip8 {
+
+vm_task_t vm_task_t::promise_type::get_return_object() noexcept {
+    return vm_task_t(std::coroutine_handle<promise_type>::from_promise(*this));
+}
+
+std::suspend_always vm_task_t::promise_type::yield_value(run_state_t state) noexcept {
+    this->state = state;
+    return {};
+}
+
+void vm_task_t::promise_type::return_value(fault_t fault) noexcept {
+    state = run_state_t::FINISHED;
+    this->fault = fault;
+}
+
+void vm_task_t::promise_type::unhandled_exception() noexcept {
+    state = run_state_t::FINISHED;
+    exception = std::current_exception();
+}
+
+vm_task_t::vm_task_t(std::coroutine_handle<promise_type> handle) noexcept
+    : handle(handle)
+{}
+
+vm_task_t::vm_task_t(vm_task_t&& other) noexcept
+    : handle(std::exchange(other.handle, nullptr))
+{}
+
+vm_task_t& vm_task_t::operator=(vm_task_t&& other) noexcept {
+    if (this != &other) {
+        if (handle) {
+            handle.destroy();
+        }
+        handle = std::exchange(other.handle, nullptr);
+    }
+    return *this;
+}
+
+vm_task_t::~vm_task_t() {
+    if (handle) {
+        handle.destroy();
+    }
+}
+
+run_state_t vm_task_t::resume() {
+    if (handle.done()) {
+        return run_state_t::FINISHED;
+    }
+
+    handle.resume();
+    if (auto exception = std::exchange(handle.promise().exception, nullptr)) {
+        std::rethrow_exception(exception);
+    }
+    return handle.promise().state;
+}
+
+run_state_t vm_task_t::get_state() const noexcept {
+    return handle.promise().state;
+}
+
+fault_t vm_task_t::get_fault() const noexcept {
+    return handle.promise().fault;
+}
+
+vm_task_t run_frames(vm_t& vm, uint64_t frames) {
+    while (frames > 0) {
+        const auto fault = vm.emulate_frames(1);
+        if (fault.kind == fault_kind_t::KEY_WAIT) {
+            co_yield run_state_t::WAITING_FOR_KEY;
+            continue;
+        }
+        if (fault) {
+            co_return fault;
+        }
+
+        --frames;
+        co_yield run_state_t::RUNNING;
+    }
+    co_return fault_t{};
+}
+
+
+run_loop_t::session_id_t run_loop_t::add_session(vm_t& vm, uint64_t frames) {
+    sessions.push_back({.task = run_frames(vm, frames)});
+    return sessions.size() - 1;
+}
+
+bool run_loop_t::run_once() {
+    bool any_runnable = false;
+    for (auto& session : sessions) {
+        if (session.waiting || session.task.get_state() == run_state_t::FINISHED) {
+            continue;
+        }
+        any_runnable = true;
+        session.waiting = session.task.resume() == run_state_t::WAITING_FOR_KEY;
+    }
+    return any_runnable;
+}
+
+void run_loop_t::wake(session_id_t id) noexcept {
+    sessions[id].waiting = false;
+}
+
+run_state_t run_loop_t::get_state(session_id_t id) const noexcept {
+    return sessions[id].task.get_state();
+}
+
+fault_t run_loop_t::get_fault(session_id_t id) const noexcept {
+    return sessions[id].task.get_fault();
+}
+
+} // namespace chip8
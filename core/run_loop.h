@@ -0,0 +1,90 @@
+#pragma once
+
+#include <coroutine>
+#include <cstdint>
+#include <exception>
+#include <limits>
+#include <vector>
+
+#include <core/fault.h>
+#include <core/vm.h>
+
+
+namespace chip8 {
+
+enum class run_state_t : uint8_t {
+    RUNNING,            // a frame was run, there are more to go
+    WAITING_FOR_KEY,    // LD_VX_K got no key, the rest of the frame runs after resume
+    FINISHED,           // all frames were run, or vm faulted, or peripherals threw
+};
+
+/**
+ * VM run loop as a coroutine: runs a frame (emulate_frames(1)), then yields to the caller.
+ * With a keyboard, that does not block (keyboard_system_queue_t), key waits yield too, instead of parking the thread.
+ * Display waits end with the frame, so they need nothing else.
+ */
+struct vm_task_t {
+    struct promise_type {
+        run_state_t state = run_state_t::RUNNING;
+        fault_t fault;
+        std::exception_ptr exception;
+
+        vm_task_t get_return_object() noexcept;
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        std::suspend_always yield_value(run_state_t state) noexcept;
+        void return_value(fault_t fault) noexcept;
+        void unhandled_exception() noexcept;
+    };
+
+    vm_task_t(vm_task_t&& other) noexcept;
+    vm_task_t& operator=(vm_task_t&& other) noexcept;
+    ~vm_task_t();
+
+    // runs up to the next yield, rethrows exceptions of peripherals
+    run_state_t resume();
+
+    run_state_t get_state() const noexcept;
+    // fault, that finished the task, empty otherwise
+    fault_t get_fault() const noexcept;
+
+private:
+    explicit vm_task_t(std::coroutine_handle<promise_type> handle) noexcept;
+
+    std::coroutine_handle<promise_type> handle;
+};
+
+// vm and its peripherals have to outlive the task
+vm_task_t run_frames(vm_t& vm, uint64_t frames = std::numeric_limits<uint64_t>::max());
+
+/**
+ * Drives many vms on the calling thread: every pass resumes every runnable session for one frame.
+ * Sessions, that wait for a key, are left out until wake(), after the host gave their keyboard a key.
+ *
+ * Timers of vms should not sleep (timers_system_instant_t), pacing of passes is up to the caller.
+ * Loop does not own vms, they must outlive it.
+ */
+struct run_loop_t {
+    using session_id_t = size_t;
+
+    session_id_t add_session(vm_t& vm, uint64_t frames = std::numeric_limits<uint64_t>::max());
+
+    // one frame of every runnable session, false if none of them was runnable
+    bool run_once();
+
+    // session, that waits for a key, runs again in the next pass
+    void wake(session_id_t id) noexcept;
+
+    run_state_t get_state(session_id_t id) const noexcept;
+    fault_t get_fault(session_id_t id) const noexcept;
+
+private:
+    struct session_t {
+        vm_task_t task;
+        bool waiting = false;
+    };
+
+    std::vector<session_t> sessions;
+};
+
+} // namespace chip8
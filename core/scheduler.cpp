@@ -0,0 +1,217 @@
+#include <core/scheduler.h>
+
+#include <stdexcept>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+
+namespace chip8 {
+
+namespace {
+
+void pin_current_thread(size_t cpu) noexcept {
+#if defined(__linux__)
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu % CPU_SETSIZE, &cpus);
+    // best effort, worker still works unpinned
+    pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+#else
+    (void)cpu;
+#endif
+}
+
+} // namespace
+
+
+scheduler_t::scheduler_t(settings_t settings)
+    : settings(settings)
+{
+    if (this->settings.workers == 0 || this->settings.quantum == 0) {
+        throw std::invalid_argument("scheduler needs at least one worker and non-empty quantum");
+    }
+
+    for (size_t i = 0; i < this->settings.workers; ++i) {
+        workers.push_back(std::make_unique<worker_t>());
+    }
+    for (size_t i = 0; i < workers.size(); ++i) {
+        workers[i]->thread = std::thread(&scheduler_t::worker_loop, this, i);
+    }
+}
+
+scheduler_t::~scheduler_t() {
+    {
+        std::lock_guard lock(state_mutex);
+        stopping = true;
+    }
+    work_available.notify_all();
+
+    for (auto& worker : workers) {
+        worker->thread.join();
+    }
+}
+
+scheduler_t::session_id_t scheduler_t::add_session(vm_t& vm, uint64_t budget, uint32_t priority) {
+    if (priority == 0) {
+        throw std::invalid_argument("session priority must be at least 1");
+    }
+
+    session_t* session = nullptr;
+    session_id_t id = 0;
+    size_t worker = 0;
+    {
+        std::lock_guard lock(sessions_mutex);
+        id = sessions.size();
+        session = &sessions.emplace_back(session_t{.vm = vm, .budget = budget, .priority = priority});
+        worker = next_worker++ % workers.size();
+    }
+
+    if (budget == 0) {
+        std::lock_guard lock(state_mutex);
+        session->result.finished = true;
+        return id;
+    }
+
+    {
+        std::lock_guard lock(state_mutex);
+        ++active_sessions;
+    }
+    push(worker, session, false);
+
+    return id;
+}
+
+void scheduler_t::wait() {
+    std::unique_lock lock(state_mutex);
+    all_finished.wait(lock, [this] { return active_sessions == 0; });
+}
+
+scheduler_t::session_result_t scheduler_t::get_result(session_id_t id) const {
+    const session_t* session = nullptr;
+    {
+        std::lock_guard lock(sessions_mutex);
+        session = &sessions.at(id);
+    }
+
+    std::lock_guard lock(state_mutex);
+    if (!session->result.finished) {
+        return session_result_t{};
+    }
+    return session->result;
+}
+
+uint64_t scheduler_t::get_executed_instructions() const noexcept {
+    return executed_instructions.load(std::memory_order_relaxed);
+}
+
+void scheduler_t::worker_loop(size_t index) {
+    if (settings.pin_workers) {
+        pin_current_thread(index);
+    }
+
+    for (;;) {
+        session_t* session = pop(index);
+        if (session == nullptr) {
+            std::unique_lock lock(state_mutex);
+            work_available.wait(lock, [this] { return stopping || queued_sessions > 0; });
+            if (stopping) {
+                return;
+            }
+            continue;
+        }
+
+        run_quantum(*session);
+
+        if (!session->result.finished) {
+            // behind the other own sessions, so they take turns
+            push(index, session, true);
+            continue;
+        }
+
+        std::lock_guard lock(state_mutex);
+        if (--active_sessions == 0) {
+            all_finished.notify_all();
+        }
+    }
+}
+
+scheduler_t::session_t* scheduler_t::pop(size_t index) {
+    // own sessions from the back, requeued ones wait at the front
+    {
+        auto& worker = *workers[index];
+        std::lock_guard lock(worker.mutex);
+        if (!worker.queue.empty()) {
+            auto* session = worker.queue.back();
+            worker.queue.pop_back();
+            --queued_sessions;
+            return session;
+        }
+    }
+
+    // the others from the front
+    for (size_t i = 1; i < workers.size(); ++i) {
+        auto& victim = *workers[(index + i) % workers.size()];
+        std::lock_guard lock(victim.mutex);
+        if (!victim.queue.empty()) {
+            auto* session = victim.queue.front();
+            victim.queue.pop_front();
+            --queued_sessions;
+            return session;
+        }
+    }
+
+    return nullptr;
+}
+
+void scheduler_t::push(size_t index, session_t* session, bool to_front) {
+    {
+        auto& worker = *workers[index];
+        std::lock_guard lock(worker.mutex);
+        if (to_front) {
+            worker.queue.push_front(session);
+        } else {
+            worker.queue.push_back(session);
+        }
+        ++queued_sessions;
+    }
+
+    {
+        // sleeping worker must not miss the session between its check and its wait
+        std::lock_guard lock(state_mutex);
+    }
+    work_available.notify_one();
+}
+
+void scheduler_t::run_quantum(session_t& session) {
+    const auto count = std::min(session.budget - session.result.executed, settings.quantum * session.priority);
+
+    fault_t fault;
+    try {
+        fault = session.vm.emulate_instructions(count);
+    } catch (...) {
+        std::lock_guard lock(state_mutex);
+        session.result.exception = std::current_exception();
+        session.result.finished = true;
+        return;
+    }
+
+    if (fault) {
+        std::lock_guard lock(state_mutex);
+        session.result.fault = fault;
+        session.result.finished = true;
+        return;
+    }
+
+    session.result.executed += count;
+    executed_instructions.fetch_add(count, std::memory_order_relaxed);
+
+    if (session.result.executed == session.budget) {
+        std::lock_guard lock(state_mutex);
+        session.result.finished = true;
+    }
+}
+
+} // namespace chip8
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <core/vm.h>
+
+
+namespace chip8 {
+
+/**
+ * Runs many vms on a pool of worker threads.
+ *
+ * Every vm is a session with its own instruction budget. Sessions are executed in quanta of instructions,
+ * every worker keeps its sessions in its own deque, idle workers steal sessions from the others.
+ * Session, that exhausted its budget, faulted or got an exception from peripherals, is finished.
+ *
+ * Scheduler does not own vms, they must outlive their sessions (wait() for them to finish).
+ * Peripherals of vms are called from worker threads, one session never runs on two workers at once.
+ */
+struct scheduler_t {
+    struct settings_t {
+        size_t workers = std::max(1u, std::thread::hardware_concurrency());
+        uint64_t quantum = 10000;  // instructions, executed by a session before it lets others run
+        bool pin_workers = false;  // worker i is pinned to cpu i, where supported
+    };
+
+    using session_id_t = size_t;
+
+    struct session_result_t {
+        uint64_t executed = 0;
+        bool finished = false;
+        fault_t fault;                 // fault of the guest, that stopped the vm, empty if it did not fault
+        std::exception_ptr exception;  // exception of peripherals, that stopped the vm, nullptr if there was none
+    };
+
+    explicit scheduler_t(settings_t settings);
+    ~scheduler_t();
+
+    scheduler_t(const scheduler_t&) = delete;
+    scheduler_t& operator=(const scheduler_t&) = delete;
+
+    // priority >= 1 is a share of cpu time: session runs `priority` quanta at once
+    session_id_t add_session(vm_t& vm, uint64_t budget, uint32_t priority = 1);
+
+    // blocks, until every added session is finished
+    void wait();
+
+    // result of finished session, instructions of the quantum, that faulted or threw, are not counted in `executed`
+    session_result_t get_result(session_id_t id) const;
+
+    // instructions, executed by all sessions since start
+    uint64_t get_executed_instructions() const noexcept;
+
+private:
+    struct session_t {
+        vm_t& vm;
+        uint64_t budget;
+        uint32_t priority;
+        session_result_t result;
+    };
+
+    struct worker_t {
+        std::mutex mutex;
+        std::deque<session_t*> queue;
+        std::thread thread;
+    };
+
+    void worker_loop(size_t index);
+    session_t* pop(size_t index);
+    void push(size_t index, session_t* session, bool to_front);
+    void run_quantum(session_t& session);
+
+    const settings_t settings;
+
+    std::vector<std::unique_ptr<worker_t>> workers;
+
+    // sessions never move, workers keep pointers to them
+    mutable std::mutex sessions_mutex;
+    std::deque<session_t> sessions;
+    size_t next_worker = 0;
+
+    // workers sleep, while nothing is queued
+    mutable std::mutex state_mutex;
+    std::condition_variable work_available;
+    std::condition_variable all_finished;
+    std::atomic<size_t> queued_sessions = 0;
+    size_t active_sessions = 0;
+    bool stopping = false;
+
+    std::atomic<uint64_t> executed_instructions = 0;
+};
+
+} // namespace chip8
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+
+namespace chip8 {
+
+/**
+ * Wait-free ring of values between one producer thread and one consumer thread, e.g. samples for an audio callback.
+ * Both sides copy as much as fits and return at once, neither of them ever locks or waits for the other.
+ * Every side writes only its own index and keeps a cached copy of the other one, so they share a cache line
+ * only when the cached index runs out.
+ */
+template <typename T>
+struct spsc_ring_t {
+    static_assert(std::is_trivially_copyable_v<T>);
+
+    // capacity is rounded up to a power of two
+    explicit spsc_ring_t(size_t min_capacity)
+        : buffer(std::bit_ceil(std::max<size_t>(min_capacity, 1)))
+        , mask(buffer.size() - 1)
+    {}
+
+    spsc_ring_t(const spsc_ring_t&) = delete;
+    spsc_ring_t& operator=(const spsc_ring_t&) = delete;
+
+    size_t capacity() const noexcept {
+        return buffer.size();
+    }
+
+    // producer: appends the first values, that fit, returns how many
+    size_t push(const T* values, size_t count) noexcept {
+        const auto tail = producer.index.load(std::memory_order_relaxed);
+        if (tail - producer.cached_other + count > capacity()) {
+            producer.cached_other = consumer.index.load(std::memory_order_acquire);
+        }
+        count = std::min(count, capacity() - (tail - producer.cached_other));
+
+        copy(buffer.data(), tail, values, count, true);
+        producer.index.store(tail + count, std::memory_order_release);
+        return count;
+    }
+
+    // consumer: takes up to `count` values, returns how many there were
+    size_t pop(T* values, size_t count) noexcept {
+        const auto head = consumer.index.load(std::memory_order_relaxed);
+        if (consumer.cached_other - head < count) {
+            consumer.cached_other = producer.index.load(std::memory_order_acquire);
+        }
+        count = std::min(count, consumer.cached_other - head);
+
+        copy(values, head, buffer.data(), count, false);
+        consumer.index.store(head + count, std::memory_order_release);
+        return count;
+    }
+
+    // values in the ring, exact only on the side, that does not run at the moment
+    size_t size() const noexcept {
+        const auto head = consumer.index.load(std::memory_order_acquire);
+        return producer.index.load(std::memory_order_acquire) - head;
+    }
+
+private:
+    // indices grow forever and wrap with size_t, position in the buffer is index & mask
+    struct alignas(64) side_t {
+        std::atomic<size_t> index{0};
+        size_t cached_other = 0;
+    };
+
+    // at most two pieces: up to the end of the buffer and from its start
+    void copy(T* to, size_t index, const T* from, size_t count, bool into_ring) noexcept {
+        const auto position = index & mask;
+        const auto first = std::min(count, capacity() - position);
+        if (into_ring) {
+            std::memcpy(to + position, from, first * sizeof(T));
+            std::memcpy(to, from + first, (count - first) * sizeof(T));
+        } else {
+            std::memcpy(to, from + position, first * sizeof(T));
+            std::memcpy(to + first, from, (count - first) * sizeof(T));
+        }
+    }
+
+    std::vector<T> buffer;
+    size_t mask;
+    side_t producer;
+    side_t consumer;
+};
+
+} // namespace chip8
@@ -0,0 +1,235 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <type_traits>
+
+#include <core/common.h>
+#include <core/idle_loop.h>
+#include <core/instruction_decoder.h>
+#include <core/profiler.h>
+#include <core/quirks.h>
+#include <core/vm.h>
+
+
+namespace chip8 {
+
+/**
+ * Peripheral of type T, called without virtual dispatch: qualified calls go straight to the implementation of T,
+ * so inline no-op ones compile away. T has to be the most derived type of the object, overrides below it are not seen.
+ */
+template <typename T>
+struct static_peripheral_t {
+    T& impl;
+
+    bool is_pressed(keyboard_key_t key) { return impl.T::is_pressed(key); }
+    std::optional<keyboard_key_t> take_keypress() { return impl.T::take_keypress(); }
+    void tick(std::chrono::nanoseconds duration) { impl.T::tick(duration); }
+    void tick_many(std::chrono::nanoseconds duration, uint64_t count) { impl.T::tick_many(duration, count); }
+    void render(const video_memory_t& video_memory, const video_rows_t& dirty_rows) { impl.T::render(video_memory, dirty_rows); }
+    uint8_t get_random_byte() { return impl.T::get_random_byte(); }
+    void play_sound(std::chrono::nanoseconds duration, std::chrono::nanoseconds audible, const audio_t& audio) {
+        impl.T::play_sound(duration, audible, audio);
+    }
+};
+
+/**
+ * vm_t with peripherals of known types: its interpreter calls them directly, instead of through core/iface.
+ * `vm` is an ordinary vm_t with the same peripherals, so virtual interfaces stay the general case,
+ * its run APIs and engines work on the same state and can be used in turns with this interpreter.
+ * Runs with settings.cycle_costs are left to vm.
+ */
+template <typename Keyboard, typename Timers, typename Video, typename Random, typename Sound>
+struct static_vm_t {
+    static_vm_t(
+        vm_t::settings_t&& settings,
+        Keyboard& keyboard_system,
+        Timers& timers_system,
+        Video& video_system,
+        Random& random_system,
+        Sound& sound_system
+    )
+        : vm(std::move(settings), keyboard_system, timers_system, video_system, random_system, sound_system)
+        , keyboard_system{keyboard_system}
+        , timers_system{timers_system}
+        , video_system{video_system}
+        , random_system{random_system}
+        , sound_system{sound_system}
+    {}
+
+    static_vm_t(const static_vm_t&) = delete;
+    static_vm_t& operator=(const static_vm_t&) = delete;
+
+    // the same as vm.emulate_instructions with INTERPRETER
+    fault_t emulate_instructions(uint64_t count);
+
+    fault_t emulate_frames(uint64_t frames);
+
+    vm_t vm;
+
+private:
+    // what instructions see: state of vm, peripherals bound statically
+    struct view_t {
+        void next_instruction() noexcept {
+            vm.next_instruction();
+        }
+
+        vm_t& vm;
+        const quirks_t& quirks;
+
+        std::array<uint8_t, REGISTERS_SIZE>& V;
+        uint16_t& I;
+        uint16_t& pc;
+        uint8_t& sp;
+        uint8_t& delay_timer;
+        uint8_t& sound_timer;
+        bool& vblank;
+        fault_kind_t& fault;
+
+        std::array<uint16_t, STACK_SIZE>& stack;
+        std::array<uint8_t, MEMORY_SIZE>& memory;
+        video_memory_t& video_memory;
+        video_rows_t& dirty_rows;
+        memory_bitmap_t& written_memory;
+        audio_t& audio;
+
+        static_peripheral_t<Keyboard>& keyboard_system;
+        static_peripheral_t<Random>& random_system;
+    };
+
+    using table_t = std::array<void (*)(view_t&, const opcode_t&), OPCODES_COUNT>;
+
+    // built on first request for every quirks profile and emulator type, like the dispatch table of vm_t
+    template <typename Quirks>
+    static const table_t& get_table(vm_t::settings_t::emulator_type_t emulator_type);
+
+    template <typename Quirks>
+    static std::unique_ptr<const table_t> build_table(vm_t::settings_t::emulator_type_t emulator_type);
+
+    fault_t run(uint64_t count, const table_t& table);
+
+    static_peripheral_t<Keyboard> keyboard_system;
+    static_peripheral_t<Timers> timers_system;
+    static_peripheral_t<Video> video_system;
+    static_peripheral_t<Random> random_system;
+    static_peripheral_t<Sound> sound_system;
+};
+
+
+template <typename Keyboard, typename Timers, typename Video, typename Random, typename Sound>
+fault_t static_vm_t<Keyboard, Timers, Video, Random, Sound>::emulate_instructions(uint64_t count) {
+    if (vm.settings.cycles_per_frame > 0 && vm.settings.cycle_costs != nullptr) {
+        return vm.emulate_instructions(count);
+    }
+
+    return visit_quirks(vm.quirks, [this, count](auto profile) {
+        return run(count, get_table<decltype(profile)>(vm.settings.emulator_type));
+    });
+}
+
+template <typename Keyboard, typename Timers, typename Video, typename Random, typename Sound>
+fault_t static_vm_t<Keyboard, Timers, Video, Random, Sound>::emulate_frames(uint64_t frames) {
+    if (vm.settings.cycles_per_frame > 0 && vm.settings.cycle_costs != nullptr) {
+        return vm.emulate_frames(frames);
+    }
+
+    for (; frames > 0; --frames) {
+        if (auto fault = emulate_instructions(vm.instructions_until_tick())) {
+            return fault;
+        }
+    }
+    return fault_t{};
+}
+
+template <typename Keyboard, typename Timers, typename Video, typename Random, typename Sound>
+template <typename Quirks>
+auto static_vm_t<Keyboard, Timers, Video, Random, Sound>::get_table(vm_t::settings_t::emulator_type_t emulator_type) -> const table_t& {
+    switch (emulator_type) {
+        case vm_t::settings_t::CHIP_8: {
+            static const auto table = build_table<Quirks>(emulator_type);
+            return *table;
+        }
+        case vm_t::settings_t::SCHIP1_1: {
+            static const auto table = build_table<Quirks>(emulator_type);
+            return *table;
+        }
+        case vm_t::settings_t::XO_CHIP: {
+            static const auto table = build_table<Quirks>(emulator_type);
+            return *table;
+        }
+    }
+
+    throw std::invalid_argument("unknown emulator type");
+}
+
+template <typename Keyboard, typename Timers, typename Video, typename Random, typename Sound>
+template <typename Quirks>
+auto static_vm_t<Keyboard, Timers, Video, Random, Sound>::build_table(vm_t::settings_t::emulator_type_t emulator_type) -> std::unique_ptr<const table_t> {
+    auto table = std::make_unique<table_t>();
+    for (size_t bytes = 0; bytes < OPCODES_COUNT; ++bytes) {
+        (*table)[bytes] = visit_instruction(opcode_t{static_cast<uint16_t>(bytes)}, [](const auto& instruction) -> typename table_t::value_type {
+            using impl_t = decltype(instruction.impl);
+            return [](view_t& view, const opcode_t& opcode) {
+                if constexpr (std::is_same_v<Quirks, quirks_t>) {
+                    impl_t{}(view, opcode, view.quirks);
+                } else {
+                    impl_t{}(view, opcode, Quirks{});
+                }
+            };
+        }, emulator_type);
+    }
+    return table;
+}
+
+template <typename Keyboard, typename Timers, typename Video, typename Random, typename Sound>
+fault_t static_vm_t<Keyboard, Timers, Video, Random, Sound>::run(uint64_t count, const table_t& table) {
+    view_t view{
+        .vm = vm,
+        .quirks = vm.quirks,
+        .V = vm.V,
+        .I = vm.I,
+        .pc = vm.pc,
+        .sp = vm.sp,
+        .delay_timer = vm.delay_timer,
+        .sound_timer = vm.sound_timer,
+        .vblank = vm.vblank,
+        .fault = vm.fault,
+        .stack = vm.stack,
+        .memory = vm.memory,
+        .video_memory = vm.video_memory,
+        .dirty_rows = vm.dirty_rows,
+        .written_memory = vm.written_memory,
+        .audio = vm.audio,
+        .keyboard_system = keyboard_system,
+        .random_system = random_system,
+    };
+
+    // the same loop as the interpreter of vm_t
+    while (count > 0) {
+        const auto chunk = std::min(count, vm.instructions_until_tick());
+        for (uint64_t executed = 0; executed < chunk; ++executed) {
+            const auto jump_pc = vm.pc;
+            const auto opcode = opcode_t{static_cast<uint16_t>(vm.memory[vm.pc & (MEMORY_SIZE - 1)] << 8 | vm.memory[(vm.pc + 1u) & (MEMORY_SIZE - 1)])};
+            profile_instruction(vm, vm.pc, opcode);
+
+            table[opcode.bytes](view, opcode);
+            if (vm.fault != fault_kind_t::NONE) [[unlikely]] {
+                vm.advance_timers(executed, timers_system, video_system, sound_system);
+                return vm.take_fault();
+            }
+            if (is_idle_loop_jump(opcode, jump_pc)) {
+                executed += skip_idle_loop(vm, chunk - executed - 1);
+            }
+        }
+        vm.advance_timers(chunk, timers_system, video_system, sound_system);
+        count -= chunk;
+    }
+    return fault_t{};
+}
+
+} // namespace chip8
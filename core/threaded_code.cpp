@@ -0,0 +1,342 @@
+#include <core/threaded_code.h>
+
+#include <algorithm>
+
+#include <core/idle_loop.h>
+#include <core/instruction_decoder.h>
+#include <core/instructions.h>
+#include <core/profiler.h>
+
+#if defined(__GNUC__)
+#define PIEX_COMPUTED_GOTO 1
+#else
+#define PIEX_COMPUTED_GOTO 0
+#endif
+
+
+namespace chip8 {
+
+namespace {
+
+// instructions with own handler, everything else goes through the dispatch table of vm
+#define PIEX_THREADED_INSTRUCTIONS(X) \
+    X(CLS) X(SE_VX_BYTE) X(SNE_VX_BYTE) X(SE_VX_VY) \
+    X(LD_VX_BYTE) X(ADD_VX_BYTE) X(LD_VX_VY) X(OR_VX_VY) X(AND_VX_VY) X(XOR_VX_VY) \
+    X(ADD_VX_VY) X(SUB_VX_VY) X(SHR_VX_VY) X(SUBN_VX_VY) X(SHL_VX_VY) X(SNE_VX_VY) \
+    X(LD_I_ADDR) X(JP_V0_ADDR) X(RND_VX_BYTE) X(DRW_VX_VY_N) X(SKP_VX) X(SKNP_VX) \
+    X(LD_VX_DT) X(LD_DT_VX) X(LD_ST_VX) X(ADD_I_VX) X(LD_F_VX) X(LD_VX_I)
+
+// instructions, that write guest memory
+#define PIEX_THREADED_STORES(X) \
+    X(LD_B_VX) X(LD_I_VX)
+
+// instructions, that might fault
+#define PIEX_THREADED_FAULTING(X) \
+    X(RET) X(CALL_ADDR) X(LD_VX_K)
+
+// jumps, that might close an idle loop
+#define PIEX_THREADED_JUMPS(X) \
+    X(JP_ADDR)
+
+enum handler_t : uint8_t {
+    DECODE,     // slot was not decoded yet
+    SLOW,       // pc is out of memory, emulate_one_instruction has to deal with it
+    GENERIC,    // executor from the dispatch table, on vm itself
+#define PIEX_HANDLER_ENUM(name) HANDLER_##name,
+    PIEX_THREADED_INSTRUCTIONS(PIEX_HANDLER_ENUM)
+    PIEX_THREADED_STORES(PIEX_HANDLER_ENUM)
+    PIEX_THREADED_FAULTING(PIEX_HANDLER_ENUM)
+    PIEX_THREADED_JUMPS(PIEX_HANDLER_ENUM)
+#undef PIEX_HANDLER_ENUM
+};
+
+handler_t find_handler(opcode_t opcode, vm_t::settings_t::emulator_type_t emulator_type) noexcept {
+    // dispatch table might hold executors, specialized for the quirks, decoder has the generic ones
+    const auto instruction = decode_instruction(opcode, emulator_type);
+    if (!instruction) {
+        return GENERIC;
+    }
+
+    const auto executor = instruction->get().executor;
+#define PIEX_HANDLER_FIND(name) if (executor == instructions::name.executor) return HANDLER_##name;
+    PIEX_THREADED_INSTRUCTIONS(PIEX_HANDLER_FIND)
+    PIEX_THREADED_STORES(PIEX_HANDLER_FIND)
+    PIEX_THREADED_FAULTING(PIEX_HANDLER_FIND)
+    PIEX_THREADED_JUMPS(PIEX_HANDLER_FIND)
+#undef PIEX_HANDLER_FIND
+    return GENERIC;
+}
+
+/**
+ * Looks like vm_t for instructions, but keeps registers by value, so they could live in host registers.
+ * Everything else refers to vm.
+ */
+struct local_vm_t {
+    explicit local_vm_t(vm_t& vm) noexcept
+        : settings(vm.settings)
+        , delay_timer(vm.delay_timer)
+        , sound_timer(vm.sound_timer)
+        , vblank(vm.vblank)
+        , fault(vm.fault)
+        , stack(vm.stack)
+        , memory(vm.memory)
+        , video_memory(vm.video_memory)
+        , dirty_rows(vm.dirty_rows)
+        , written_memory(vm.written_memory)
+        , keyboard_system(vm.keyboard_system)
+        , random_system(vm.random_system)
+    {
+        load(vm);
+    }
+
+    void load(const vm_t& vm) noexcept {
+        V = vm.V;
+        I = vm.I;
+        pc = vm.pc;
+        sp = vm.sp;
+    }
+
+    void store(vm_t& vm) const noexcept {
+        vm.V = V;
+        vm.I = I;
+        vm.pc = pc;
+        vm.sp = sp;
+    }
+
+    void next_instruction() noexcept {
+        pc += 2;
+        pc %= MEMORY_SIZE;
+    }
+
+    const vm_t::settings_t settings;
+
+    std::array<uint8_t, REGISTERS_SIZE> V;
+    uint16_t I;
+    uint16_t pc;
+    uint8_t sp;
+    uint8_t& delay_timer;
+    uint8_t& sound_timer;
+    bool& vblank;
+    fault_kind_t& fault;
+
+    std::array<uint16_t, STACK_SIZE>& stack;
+    std::array<uint8_t, MEMORY_SIZE>& memory;
+    video_memory_t& video_memory;
+    video_rows_t& dirty_rows;
+    memory_bitmap_t& written_memory;
+
+    keyboard_system_iface_t& keyboard_system;
+    random_system_iface_t& random_system;
+};
+
+} // namespace
+
+
+threaded_code_t::threaded_code_t(vm_t& vm)
+    : vm(vm)
+{
+    flush();
+}
+
+fault_t threaded_code_t::run(uint64_t count) {
+    // profiles get handlers without quirk branches
+    return visit_quirks(vm.quirks, [this, count](const auto& quirks) { return run(count, quirks); });
+}
+
+template <typename Quirks>
+fault_t threaded_code_t::run(uint64_t count, const Quirks& quirks) {
+    // memory might have been loaded since last run
+    consume_written_memory();
+
+    local_vm_t local(vm);
+    const slot_t* slot = nullptr;
+    uint64_t executed = 0;
+    uint64_t budget = 0;
+
+#if PIEX_COMPUTED_GOTO
+    static const void* const TARGETS[] = {
+        &&DECODE,
+        &&SLOW,
+        &&GENERIC,
+#define PIEX_HANDLER_TARGET(name) &&HANDLER_##name,
+        PIEX_THREADED_INSTRUCTIONS(PIEX_HANDLER_TARGET)
+        PIEX_THREADED_STORES(PIEX_HANDLER_TARGET)
+        PIEX_THREADED_FAULTING(PIEX_HANDLER_TARGET)
+    PIEX_THREADED_JUMPS(PIEX_HANDLER_TARGET)
+#undef PIEX_HANDLER_TARGET
+    };
+
+#define PIEX_CASE(handler) handler:
+#define PIEX_NEXT() \
+    do { \
+        if (executed == budget) goto chunk_end; \
+        slot = &code[local.pc]; \
+        goto *TARGETS[slot->handler]; \
+    } while (false)
+#else
+#define PIEX_CASE(handler) case handler:
+#define PIEX_NEXT() continue
+#endif
+
+    try {
+        while (count > 0) {
+            // timers have to tick between the same instructions, as they do in the interpreter
+            budget = std::min(count, vm.instructions_until_tick());
+            executed = 0;
+
+#if PIEX_COMPUTED_GOTO
+            PIEX_NEXT();
+            {
+#else
+            for (;;) {
+                if (executed == budget) goto chunk_end;
+                slot = &code[local.pc];
+                switch (slot->handler) {
+#endif
+
+            PIEX_CASE(DECODE) {
+                auto& decoded = code[local.pc];
+                decoded.opcode = opcode_t{static_cast<uint16_t>(local.memory[local.pc] << 8 | local.memory[local.pc + 1u])};
+                decoded.handler = find_handler(decoded.opcode, local.settings.emulator_type);
+                PIEX_NEXT();
+            }
+
+            PIEX_CASE(SLOW) {
+                goto chunk_end;
+            }
+
+            PIEX_CASE(GENERIC) {
+                local.store(vm);
+                profile_instruction(vm, local.pc, slot->opcode);
+                vm.dispatch_table[slot->opcode.bytes](vm, slot->opcode);
+                local.load(vm);
+                if (vm.fault != fault_kind_t::NONE) [[unlikely]] {
+                    goto faulted;
+                }
+                ++executed;
+                consume_written_memory();
+                PIEX_NEXT();
+            }
+
+#define PIEX_HANDLER_EXECUTE(name) \
+            PIEX_CASE(HANDLER_##name) { \
+                profile_instruction(vm, local.pc, slot->opcode); \
+                instructions::name.impl(local, slot->opcode, quirks); \
+                ++executed; \
+                PIEX_NEXT(); \
+            }
+            PIEX_THREADED_INSTRUCTIONS(PIEX_HANDLER_EXECUTE)
+#undef PIEX_HANDLER_EXECUTE
+
+#define PIEX_HANDLER_STORE(name) \
+            PIEX_CASE(HANDLER_##name) { \
+                profile_instruction(vm, local.pc, slot->opcode); \
+                instructions::name.impl(local, slot->opcode, quirks); \
+                ++executed; \
+                consume_written_memory(); \
+                PIEX_NEXT(); \
+            }
+            PIEX_THREADED_STORES(PIEX_HANDLER_STORE)
+#undef PIEX_HANDLER_STORE
+
+#define PIEX_HANDLER_FAULTING(name) \
+            PIEX_CASE(HANDLER_##name) { \
+                profile_instruction(vm, local.pc, slot->opcode); \
+                instructions::name.impl(local, slot->opcode, quirks); \
+                if (local.fault != fault_kind_t::NONE) [[unlikely]] { \
+                    goto faulted; \
+                } \
+                ++executed; \
+                PIEX_NEXT(); \
+            }
+            PIEX_THREADED_FAULTING(PIEX_HANDLER_FAULTING)
+#undef PIEX_HANDLER_FAULTING
+
+#define PIEX_HANDLER_JUMP(name) \
+            PIEX_CASE(HANDLER_##name) { \
+                const auto at = local.pc; \
+                profile_instruction(vm, at, slot->opcode); \
+                instructions::name.impl(local, slot->opcode, quirks); \
+                ++executed; \
+                if (is_idle_loop_jump(slot->opcode, at)) { \
+                    local.store(vm); \
+                    executed += skip_idle_loop(vm, budget - executed); \
+                    local.load(vm); \
+                } \
+                PIEX_NEXT(); \
+            }
+            PIEX_THREADED_JUMPS(PIEX_HANDLER_JUMP)
+#undef PIEX_HANDLER_JUMP
+
+#if PIEX_COMPUTED_GOTO
+            }
+#else
+                }
+            }
+#endif
+
+        chunk_end:
+            // ticks might take a snapshot of vm
+            local.store(vm);
+            vm.advance_timers(executed);
+            count -= executed;
+
+            if (executed < budget) {
+                // stopped at the slot, that only the interpreter knows how to run
+                executed = 0;
+                if (auto fault = vm.emulate_one_instruction()) {
+                    return fault;
+                }
+                local.load(vm);
+                --count;
+            }
+        }
+
+        local.store(vm);
+        return fault_t{};
+
+    faulted:
+        // faulted instruction changed nothing and is not counted
+        local.store(vm);
+        vm.advance_timers(executed);
+        return vm.take_fault();
+    } catch (...) {
+        local.store(vm);
+        vm.advance_timers(executed);
+        throw;
+    }
+
+#undef PIEX_CASE
+#undef PIEX_NEXT
+}
+
+void threaded_code_t::consume_written_memory() noexcept {
+    if (!vm.written_memory.any()) {
+        return;
+    }
+    vm.written_memory.for_each([this](size_t address) { invalidate(address, 1); });
+    vm.written_memory.clear();
+}
+
+void threaded_code_t::invalidate(size_t offset, size_t size) noexcept {
+    size = std::min(size, MEMORY_SIZE);
+    for (size_t i = 0; i < size; ++i) {
+        const size_t address = (offset + i) % MEMORY_SIZE;
+
+        // slot covers its own byte and the next one
+        code[address] = slot_t{};
+        if (address > 0) {
+            code[address - 1] = slot_t{};
+        }
+    }
+
+    // the last byte has no next one
+    code[MEMORY_SIZE - 1].handler = SLOW;
+}
+
+void threaded_code_t::flush() noexcept {
+    code.fill(slot_t{});
+    std::fill(code.begin() + MEMORY_SIZE - 1, code.end(), slot_t{.handler = SLOW});
+}
+
+} // namespace chip8
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+#include <core/common.h>
+#include <core/vm.h>
+
+
+namespace chip8 {
+
+/**
+ * Threaded-code interpreter.
+ *
+ * Every guest address gets a pre-decoded slot with the handler and the opcode, handlers jump
+ * straight to the handler of the next slot (computed goto, or a switch on compilers without it),
+ * so many instructions run per entry without going back to emulate_one_instruction.
+ * Registers of the guest are kept in locals while running, semantics are the generic ones from instructions.h.
+ *
+ * Stores of the guest and vm_t::load_data mark vm_t::written_memory, slots, that were hit, are decoded again.
+ */
+struct threaded_code_t {
+    explicit threaded_code_t(vm_t& vm);
+
+    threaded_code_t(const threaded_code_t&) = delete;
+    threaded_code_t& operator=(const threaded_code_t&) = delete;
+
+    // runs exactly `count` guest instructions, unless guest faults
+    fault_t run(uint64_t count);
+
+    // decodes slots, that overlap [offset, offset + size) of guest memory, once more
+    void invalidate(size_t offset, size_t size) noexcept;
+
+    // decodes all slots once more
+    void flush() noexcept;
+
+    struct slot_t {
+        uint8_t handler = 0;
+        opcode_t opcode{0};
+    };
+
+private:
+    // pc might run past memory with JP_V0_ADDR, such slots always go to emulate_one_instruction
+    static inline constexpr size_t CODE_SIZE = MEMORY_SIZE + 0x100;
+
+    template <typename Quirks>
+    fault_t run(uint64_t count, const Quirks& quirks);
+
+    void consume_written_memory() noexcept;
+
+    vm_t& vm;
+    std::array<slot_t, CODE_SIZE> code;
+};
+
+} // namespace chip8
@@ -3,18 +3,26 @@
 #include <optional>
 #include <sstream>
 #include <thread>
+#include <utility>
 #include <algorithm>
 #include <chrono>
 #include <iomanip>
 #include <iostream>
 
+#include <core/block_cache.h>
 #include <core/common.h>
+#include <core/dispatch_table.h>
+#include <core/idle_loop.h>
 #include <core/iface/keyboard.h>
 #include <core/iface/random.h>
 #include <core/iface/timers.h>
 #include <core/iface/video.h>
 #include <core/instructions.h>
 #include <core/instruction_decoder.h>
+#include <core/jit.h>
+#include <core/profiler.h>
+#include <core/rewind.h>
+#include <core/threaded_code.h>
 #include <core/vm.h>
 
 
@@ -22,29 +30,36 @@ namespace chip8 {
 
 namespace {
 
-void wrap_instruction_execution(vm_t& vm, const decoded_instruction_t& decoded_instruction) {
-    const auto& [instruction_ref, opcode] = decoded_instruction;
-    try {
-        instruction_ref.get().executor(vm, opcode);
-    } catch (const std::exception& e) {
-        std::stringstream error;
-        error << "error while executing instruction: " << instruction_ref.get().name << std::endl;
-        error << "error: " << e.what();
-        
-        error << "debug info:" << std::endl;
-        error << "sp: 0x" << std::hex << std::setw(2) << std::setfill('0') << static_cast<uint16_t>(vm.sp) << std::endl;
-        error << "pc: 0x" << std::hex << std::setw(4) << std::setfill('0') << vm.pc << std::endl;
-        error << "opcode: 0x" << std::hex << std::setw(4) << std::setfill('0') << opcode.bytes << std::endl;
-        error << "I: 0x" << std::hex << std::setw(4) << std::setfill('0') << vm.I << std::endl;
-        error << "V: ";
-        for (const auto& v : vm.V) {
-            error << std::hex << std::setw(2) << std::setfill('0') << static_cast<uint16_t>(v) << " ";
-        }
-        error << std::endl;
-        throw;
+quirks_t get_default_quirks(vm_t::settings_t::emulator_type_t emulator_type) {
+    switch (emulator_type) {
+        case vm_t::settings_t::CHIP_8:
+            return CHIP_8_QUIRKS;
+        case vm_t::settings_t::SCHIP1_1:
+        case vm_t::settings_t::XO_CHIP:
+            return SCHIP_QUIRKS;
     }
+    return CHIP_8_QUIRKS;
+}
+
+// pc might be past the end of memory after JP_V0_ADDR
+opcode_t fetch_opcode(const vm_t& vm) noexcept {
+    return opcode_t{static_cast<uint16_t>(vm.memory[vm.pc & (MEMORY_SIZE - 1)] << 8 | vm.memory[(vm.pc + 1u) & (MEMORY_SIZE - 1)])};
+}
+
+// false, if the instruction faulted, it is not counted then; timers are left to the caller
+bool execute_one_instruction(vm_t& vm, opcode_t opcode) {
+    profile_instruction(vm, vm.pc, opcode);
+
+    // decode and execute (might trigger some peripherals)
+    vm.dispatch_table[opcode.bytes](vm, opcode);
+    return vm.fault == fault_kind_t::NONE;
 }
 
+bool has_cycle_costs(const vm_t& vm) noexcept {
+    return vm.settings.cycles_per_frame > 0 && vm.settings.cycle_costs != nullptr;
+}
+
+
 } // namespace
 
 
@@ -55,66 +70,140 @@ vm_t::vm_t(
     video_system_iface_t& video_system,
     random_system_iface_t& random_system,
     sound_system_iface_t& sound_system
-) noexcept
+)
     : settings(std::move(settings))
+    , quirks(this->settings.quirks.value_or(get_default_quirks(this->settings.emulator_type)))
     , keyboard_system(keyboard_system)
     , timers_system(timers_system)
     , video_system(video_system)
     , random_system(random_system)
     , sound_system(sound_system)
+    , dispatch_table(get_dispatch_table(this->settings.emulator_type, quirks))
 {
     std::fill(memory.begin(), memory.end(), 0);
     std::fill(V.begin(), V.end(), 0);
     std::fill(stack.begin(), stack.end(), 0);
+    video_memory.clear();
 
-    for (auto& row : video_memory) {
-        std::fill(row.begin(), row.end(), false);
+    if (this->settings.rewind_interval > 0) {
+        rewind = std::make_unique<rewind_t>(*this, this->settings.rewind_interval, this->settings.rewind_capacity);
     }
 }
 
-void vm_t::emulate_one_instruction() {
-    // fetch
-    uint16_t opcode_bytes = memory[pc] << 8 | memory[static_cast<size_t>(pc + 1)];
-    auto opcode = opcode_t{opcode_bytes};
-    // decode
-    auto instruction_opt = decode_instruction(opcode);
+vm_t::~vm_t() = default;
+
+fault_t vm_t::emulate_one_instruction() {
+    const auto opcode = fetch_opcode(*this);
+    if (!execute_one_instruction(*this, opcode)) [[unlikely]] {
+        return take_fault();
+    }
+
+    // update peripherals
+    advance_timers(has_cycle_costs(*this) ? (*settings.cycle_costs)[opcode.bytes] : 1);
+    return fault_t{};
+}
 
-    if (!instruction_opt) {
-        std::stringstream error;
-        error << "unknown opcode: 0x" << std::hex << std::setw(4) << std::setfill('0') << opcode_bytes;
-        throw std::runtime_error(error.str());
+fault_t vm_t::emulate_instructions(uint64_t count) {
+    if (has_cycle_costs(*this)) {
+        // engines count instructions, not cycles
+        for (; count > 0; --count) {
+            if (auto fault = emulate_one_instruction()) {
+                return fault;
+            }
+        }
+        return fault_t{};
     }
 
-    const auto& instruction = instruction_opt.value().get();
+    switch (settings.engine) {
+        case settings_t::JIT:
+            if (!jit_t::is_supported()) {
+                break;
+            }
+#if PIEX_PROFILING
+            // native code does not count instructions
+            if (profiler != nullptr) {
+                break;
+            }
+#endif
+            if (!jit) {
+                jit = std::make_unique<jit_t>(*this);
+            }
+            return jit->run(count);
+        case settings_t::BLOCK_CACHE:
+            if (!block_cache) {
+                block_cache = std::make_unique<block_cache_t>(*this);
+            }
+            return block_cache->run(count);
+        case settings_t::THREADED:
+            if (!threaded_code) {
+                threaded_code = std::make_unique<threaded_code_t>(*this);
+            }
+            return threaded_code->run(count);
+        case settings_t::INTERPRETER:
+            break;
+    }
 
-    // execute (might trigger some peripherals)
-    wrap_instruction_execution(*this, {instruction, opcode});
+    // timers only change at ticks, so they are advanced once per run of instructions up to the next one
+    while (count > 0) {
+        const auto chunk = std::min(count, instructions_until_tick());
+        for (uint64_t executed = 0; executed < chunk; ++executed) {
+            const auto jump_pc = pc;
+            const auto opcode = fetch_opcode(*this);
+            if (!execute_one_instruction(*this, opcode)) [[unlikely]] {
+                advance_timers(executed);
+                return take_fault();
+            }
+            if (is_idle_loop_jump(opcode, jump_pc)) {
+                executed += skip_idle_loop(*this, chunk - executed - 1);
+            }
+        }
+        advance_timers(chunk);
+        count -= chunk;
+    }
+    return fault_t{};
+}
 
-    // update peripherals
-    timers_duration += settings.op_duration;
+fault_t vm_t::emulate_duration(std::chrono::nanoseconds target_duration) {
+    if (settings.cycles_per_frame > 0) {
+        return emulate_frames(static_cast<uint64_t>(target_duration / settings.timer_duration));
+    }
 
-    auto play_sound_duration = std::chrono::nanoseconds::zero();
-    while (timers_duration >= settings.timer_duration) {
-        timers_duration -= settings.timer_duration;
-        play_sound_duration += settings.timer_duration;
+    if (target_duration < settings.op_duration) {
+        return fault_t{};
+    }
 
-        delay_timer = (delay_timer > 0) ? (delay_timer - 1) : 0;
-        sound_timer = (sound_timer > 0) ? (sound_timer - 1) : 0;
-        timers_system.tick(settings.timer_duration);
+    if (settings.op_duration <= std::chrono::nanoseconds::zero()) {
+        // instructions take no time, so there is no end
+        return emulate_instructions(std::numeric_limits<uint64_t>::max());
     }
 
-    sound_system.play_sound(play_sound_duration);
+    return emulate_instructions(static_cast<uint64_t>(target_duration / settings.op_duration));
 }
 
-void vm_t::emulate_duration(std::chrono::nanoseconds target_duration) {
-    while (target_duration >= settings.op_duration) {
-        target_duration -= settings.op_duration;
-        emulate_one_instruction();
+fault_t vm_t::emulate_frames(uint64_t frames) {
+    for (; frames > 0; --frames) {
+        if (!has_cycle_costs(*this)) {
+            if (auto fault = emulate_instructions(instructions_until_tick())) {
+                return fault;
+            }
+            continue;
+        }
+
+        // timers tick with the instruction, that reaches the end of the frame
+        for (uint64_t left = settings.cycles_per_frame - frame_cycles; left > 0;) {
+            const auto cycles = (*settings.cycle_costs)[fetch_opcode(*this).bytes];
+            if (auto fault = emulate_one_instruction()) {
+                return fault;
+            }
+            left -= std::min<uint64_t>(left, cycles);
+        }
     }
+    return fault_t{};
 }
 
 void vm_t::load_data(const bytes_view data, const size_t offset) noexcept {
     std::copy(data.begin(), data.end(), memory.begin() + offset);
+    written_memory.set(offset, data.size());
 }
 
 void vm_t::next_instruction() noexcept {
@@ -122,4 +211,52 @@ void vm_t::next_instruction() noexcept {
     pc %= MEMORY_SIZE;
 }
 
+void vm_t::advance_timers(uint64_t instructions_count) {
+    advance_timers(instructions_count, timers_system, video_system, sound_system);
+}
+
+void vm_t::present_video() {
+    present_video(video_system);
+}
+
+void vm_t::on_ticks(uint64_t ticks) {
+    if (rewind) {
+        rewind->on_ticks(ticks);
+    }
+}
+
+uint64_t vm_t::instructions_until_tick() const noexcept {
+    if (settings.cycles_per_frame > 0) {
+        return has_cycle_costs(*this) ? 1 : settings.cycles_per_frame - frame_cycles;
+    }
+
+    if (settings.op_duration <= std::chrono::nanoseconds::zero()) {
+        return std::numeric_limits<uint64_t>::max();
+    }
+
+    const auto left = settings.timer_duration - timers_duration;
+    if (left <= settings.op_duration) {
+        return 1;
+    }
+
+    // rounded up, timers tick right after the instruction, that reaches timer_duration
+    return static_cast<uint64_t>((left + settings.op_duration - std::chrono::nanoseconds(1)) / settings.op_duration);
+}
+
+fault_t vm_t::take_fault() noexcept {
+    if (fault == fault_kind_t::NONE) {
+        return fault_t{};
+    }
+
+    const auto opcode = fetch_opcode(*this);
+    return fault_t{
+        .kind = std::exchange(fault, fault_kind_t::NONE),
+        .pc = pc,
+        .opcode = opcode,
+        .I = I,
+        .sp = sp,
+        .V = V,
+    };
+}
+
 } // namespace chip8
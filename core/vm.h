@@ -1,6 +1,7 @@
 #pragma once
 
 #include <algorithm>
+#include <bit>
 #include <bitset>
 #include <chrono>
 #include <cstdint>
@@ -11,15 +12,35 @@
 #include <string_view>
 
 #include <core/common.h>
+#include <core/fault.h>
 #include <core/iface/keyboard.h>
 #include <core/iface/random.h>
 #include <core/iface/sound.h>
 #include <core/iface/timers.h>
 #include <core/iface/video.h>
+#include <core/quirks.h>
+
+// instruction counters of profiler_t, compiled in with cmake -DENABLE_PROFILING=1
+#ifndef PIEX_PROFILING
+#define PIEX_PROFILING 0
+#endif
 
 
 namespace chip8 {
 
+struct vm_t;
+struct jit_t;
+struct block_cache_t;
+struct threaded_code_t;
+struct rewind_t;
+struct profiler_t;
+
+// flat table of executors, indexed by the full 16-bit opcode
+using dispatch_table_t = std::array<void (*)(vm_t&, const opcode_t&), OPCODES_COUNT>;
+
+// cycles, that every opcode takes, indexed by the full 16-bit opcode (see cycles.h)
+using cycle_costs_t = std::array<uint16_t, OPCODES_COUNT>;
+
 struct vm_t {
     static inline constexpr auto DEFAULT_OP_DURATION = std::chrono::milliseconds(2);
     static inline constexpr auto DEFAULT_TIMER_DURATION = std::chrono::nanoseconds(16666667);
@@ -31,13 +52,32 @@ struct vm_t {
             XO_CHIP,
         };
 
+        enum engine_t {
+            INTERPRETER,    // one instruction at a time, through dispatch table
+            JIT,            // x86-64 translation of basic blocks, same as INTERPRETER on other hosts
+            BLOCK_CACHE,    // cached pre-decoded basic blocks, portable
+            THREADED,       // threaded code, registers in locals, portable
+        };
+
         emulator_type_t emulator_type = CHIP_8;
         std::chrono::nanoseconds timer_duration = DEFAULT_TIMER_DURATION;
         std::chrono::nanoseconds op_duration = DEFAULT_OP_DURATION;
+        engine_t engine = INTERPRETER;
+        // default quirks of emulator_type, if not set
+        std::optional<quirks_t> quirks;
+        // snapshot is taken every `rewind_interval` ticks of timers, the last `rewind_capacity` are kept, 0 disables rewind
+        uint32_t rewind_interval = 0;
+        size_t rewind_capacity = 0;
+        // timers tick after every `cycles_per_frame` cycles instead of timer_duration / op_duration, 0 keeps durations
+        uint32_t cycles_per_frame = 0;
+        // cycles of opcodes for cycles_per_frame, one per instruction, if not set; must outlive vm.
+        // Only the interpreter counts them, every engine runs as INTERPRETER then
+        const cycle_costs_t* cycle_costs = nullptr;
     };
 
     // settings
     settings_t settings;
+    const quirks_t quirks;
 
     // registers
     std::array<uint8_t, REGISTERS_SIZE> V;
@@ -51,6 +91,11 @@ struct vm_t {
     std::array<uint16_t, STACK_SIZE> stack;
     std::array<uint8_t, MEMORY_SIZE> memory;
     video_memory_t video_memory{};
+    // XO-CHIP buzzer, the others keep the default square wave
+    audio_t audio{};
+
+    // guest stores mark written bytes, engines drop cached code, that was hit
+    memory_bitmap_t written_memory;
 
     // peripherals
     keyboard_system_iface_t& keyboard_system;
@@ -59,7 +104,36 @@ struct vm_t {
     random_system_iface_t& random_system;
     sound_system_iface_t& sound_system;
 
+    // decoder, chosen once by settings.emulator_type and quirks
+    const dispatch_table_t& dispatch_table;
+
     std::chrono::nanoseconds timers_duration = std::chrono::nanoseconds::zero();
+    // cycles since the last tick of timers, with settings.cycles_per_frame
+    uint64_t frame_cycles = 0;
+    // set by every tick of timers, DRW_VX_VY_N with display_wait quirk waits for it
+    bool vblank = false;
+
+    // set by the instruction, that faulted, engines stop and report it with take_fault()
+    fault_kind_t fault = fault_kind_t::NONE;
+
+    // rows, that instructions touched since the last frame, and the last frame itself
+    video_rows_t dirty_rows;
+    video_memory_t presented_video_memory{};
+    // rows, that instructions touched since rewind took them, frames add their dirty rows here
+    video_rows_t written_rows;
+
+    // caches of engines, created on first use
+    std::unique_ptr<jit_t> jit;
+    std::unique_ptr<block_cache_t> block_cache;
+    std::unique_ptr<threaded_code_t> threaded_code;
+
+    // snapshots for rewind, if settings enable it
+    std::unique_ptr<rewind_t> rewind;
+
+#if PIEX_PROFILING
+    // counts executed instructions, set by profiler_t::attach
+    profiler_t* profiler = nullptr;
+#endif
 
     explicit vm_t(
         settings_t&& settings,
@@ -68,20 +142,127 @@ struct vm_t {
         video_system_iface_t& video_system,
         random_system_iface_t& random_system,
         sound_system_iface_t& sound_system
-    ) noexcept;
+    );
+
+    ~vm_t();
 
     vm_t(const vm_t&) = delete;
     vm_t(vm_t&&) noexcept = delete;
     vm_t& operator=(const vm_t&) = delete;
     vm_t& operator=(vm_t&&) noexcept = delete;
 
-    void emulate_one_instruction();
+    // run APIs stop at the first fault of the guest and return it
+    fault_t emulate_one_instruction();
+
+    // runs exactly `count` instructions with the engine from settings, unless guest faults
+    fault_t emulate_instructions(uint64_t count);
 
-    void emulate_duration(std::chrono::nanoseconds duration = std::chrono::nanoseconds::max());
+    fault_t emulate_duration(std::chrono::nanoseconds duration = std::chrono::nanoseconds::max());
+
+    // runs up to the `frames`-th tick of timers from now, timers and peripherals tick once per frame
+    fault_t emulate_frames(uint64_t frames);
 
     void load_data(const bytes_view data, const size_t offset) noexcept;
 
     void next_instruction() noexcept;
+
+    // accounts time of `instructions_count` executed instructions: runs timers and feeds peripherals.
+    // With settings.cycles_per_frame it is the count of cycles
+    void advance_timers(uint64_t instructions_count);
+    // the same with peripherals of the caller, e.g. bound statically (static_vm.h)
+    template <typename Timers, typename Video, typename Sound>
+    void advance_timers(uint64_t instructions_count, Timers& timers, Video& video, Sound& sound);
+
+    // renders rows, that differ from the last frame, if there are any
+    void present_video();
+    template <typename Video>
+    void present_video(Video& video);
+
+    // takes snapshots for rewind, called after timers ticked
+    void on_ticks(uint64_t ticks);
+
+    // how many instructions can be executed, before advance_timers would tick timers; always 1 with cycle_costs
+    uint64_t instructions_until_tick() const noexcept;
+
+    // record of the fault, that the instruction at pc has just set, clears it; empty, if there is none
+    fault_t take_fault() noexcept;
 };
 
+
+template <typename Timers, typename Video, typename Sound>
+void vm_t::advance_timers(uint64_t instructions_count, Timers& timers, Video& video, Sound& sound) {
+    // whole frames in the accumulated time or cycles, they are taken out of it by `pass`
+    uint64_t ticks = 0;
+    if (settings.cycles_per_frame > 0) {
+        frame_cycles += instructions_count;
+        ticks = frame_cycles / settings.cycles_per_frame;
+    } else {
+        timers_duration += settings.op_duration * instructions_count;
+        ticks = static_cast<uint64_t>(timers_duration / settings.timer_duration);
+    }
+    if (ticks == 0) {
+        return;
+    }
+    const auto pass = [&](uint64_t count) {
+        if (settings.cycles_per_frame > 0) {
+            frame_cycles -= settings.cycles_per_frame * count;
+        } else {
+            timers_duration -= settings.timer_duration * static_cast<int64_t>(count);
+        }
+        delay_timer = static_cast<uint8_t>(delay_timer - std::min<uint64_t>(delay_timer, count));
+        sound_timer = static_cast<uint8_t>(sound_timer - std::min<uint64_t>(sound_timer, count));
+        vblank = true;
+        present_video(video);
+        timers.tick_many(settings.timer_duration, count);
+    };
+
+    // buzzer sounds from now, until the sound timer runs out
+    const uint64_t sounding_ticks = sound_timer;
+
+    // engines run many frames at once: ticks before the last one go to timers in one call,
+    // vm is a frame or more before the end of the run during them, as it would be, if they went one by one
+    if (ticks > 1) {
+        pass(ticks - 1);
+    }
+    pass(1);
+
+    // sound plays whole frames, there is nothing to play between ticks
+    sound.play_sound(settings.timer_duration * ticks, settings.timer_duration * std::min(ticks, sounding_ticks), audio);
+    on_ticks(ticks);
+}
+
+template <typename Video>
+void vm_t::present_video(Video& video) {
+    if (dirty_rows.none()) {
+        return;
+    }
+    written_rows |= dirty_rows;
+
+    // rows, that were drawn and erased within one frame, are not changed, unless resolution is
+    static_assert(VIDEO_HEIGHT <= 64, "rows must fit one word");
+    const bool same_resolution = video_memory.hires == presented_video_memory.hires;
+    uint64_t rows = dirty_rows.to_ullong();
+    for (uint64_t bits = rows; bits != 0 && same_resolution; bits &= bits - 1) {
+        const auto row = static_cast<size_t>(std::countr_zero(bits));
+        if (video_memory.is_same_row(presented_video_memory, row)) {
+            rows &= ~(uint64_t{1} << row);
+        }
+    }
+    dirty_rows = video_rows_t{rows};
+
+    if (rows != 0) {
+        video.render(video_memory, dirty_rows);
+        // the rest of the frame is the same already
+        for (uint64_t bits = same_resolution ? rows : ~uint64_t{0}; bits != 0; bits &= bits - 1) {
+            const auto row = static_cast<size_t>(std::countr_zero(bits));
+            for (size_t plane = 0; plane < VIDEO_PLANES; ++plane) {
+                presented_video_memory.planes[plane][row] = video_memory.planes[plane][row];
+            }
+        }
+        presented_video_memory.hires = video_memory.hires;
+        presented_video_memory.selected_planes = video_memory.selected_planes;
+    }
+    dirty_rows.reset();
+}
+
 } // namespace chip8
@@ -0,0 +1,496 @@
+#include <core/vm_batch.h>
+
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+#include <type_traits>
+
+#include <core/instruction_decoder.h>
+#include <core/instructions.h>
+
+
+namespace chip8 {
+
+namespace {
+
+/**
+ * Looks like vm_t for instructions, holds copy of registers of one lane, memory of the lane is referenced.
+ */
+struct lane_vm_t {
+    lane_vm_t(vm_batch_t& batch, size_t lane) noexcept
+        : settings(batch.settings)
+        , quirks(batch.quirks)
+        , memory(batch.memory[lane])
+        , video_memory(batch.video_memory[lane])
+        , written_memory(batch.written_memory)
+        , audio(batch.audio[lane])
+        , keyboard_system(batch.keyboard_system)
+        , random_system(batch.random_system)
+    {
+        for (size_t i = 0; i < REGISTERS_SIZE; ++i) {
+            V[i] = batch.V[i][lane];
+        }
+        for (size_t i = 0; i < STACK_SIZE; ++i) {
+            stack[i] = batch.stack[i][lane];
+        }
+        I = batch.I[lane];
+        pc = batch.pc[lane];
+        sp = batch.sp[lane];
+        delay_timer = batch.delay_timer[lane];
+        sound_timer = batch.sound_timer[lane];
+        vblank = batch.vblank[lane];
+    }
+
+    void store(vm_batch_t& batch, size_t lane) const noexcept {
+        for (size_t i = 0; i < REGISTERS_SIZE; ++i) {
+            batch.V[i][lane] = V[i];
+        }
+        for (size_t i = 0; i < STACK_SIZE; ++i) {
+            batch.stack[i][lane] = stack[i];
+        }
+        batch.I[lane] = I;
+        batch.pc[lane] = pc;
+        batch.sp[lane] = sp;
+        batch.delay_timer[lane] = delay_timer;
+        batch.sound_timer[lane] = sound_timer;
+        batch.vblank[lane] = vblank;
+    }
+
+    void next_instruction() noexcept {
+        pc += 2;
+        pc %= MEMORY_SIZE;
+    }
+
+    const vm_t::settings_t& settings;
+    const quirks_t& quirks;
+
+    std::array<uint8_t, REGISTERS_SIZE> V;
+    uint16_t I;
+    uint16_t pc;
+    uint8_t sp;
+    uint8_t delay_timer;
+    uint8_t sound_timer;
+    bool vblank;
+    fault_kind_t fault = fault_kind_t::NONE;
+    std::array<uint16_t, STACK_SIZE> stack;
+
+    std::array<uint8_t, MEMORY_SIZE>& memory;
+    video_memory_t& video_memory;
+    // lanes are not presented, store_lane() a lane into a vm to look at its screen
+    video_rows_t dirty_rows;
+    memory_bitmap_t& written_memory;
+    audio_t& audio;
+
+    keyboard_system_iface_t& keyboard_system;
+    random_system_iface_t& random_system;
+};
+
+using lane_dispatch_table_t = std::array<void (*)(lane_vm_t&, const opcode_t&), OPCODES_COUNT>;
+
+std::unique_ptr<const lane_dispatch_table_t> build_lane_dispatch_table(vm_t::settings_t::emulator_type_t emulator_type) {
+    auto table = std::make_unique<lane_dispatch_table_t>();
+    for (size_t bytes = 0; bytes < OPCODES_COUNT; ++bytes) {
+        (*table)[bytes] = visit_instruction(opcode_t{static_cast<uint16_t>(bytes)}, [](const auto& instruction) {
+            using impl_t = decltype(instruction.impl);
+            return +[](lane_vm_t& vm, const opcode_t& opcode) { impl_t{}(vm, opcode, vm.quirks); };
+        }, emulator_type);
+    }
+    return table;
+}
+
+const lane_dispatch_table_t& get_lane_dispatch_table(vm_t::settings_t::emulator_type_t emulator_type) {
+    switch (emulator_type) {
+        case vm_t::settings_t::CHIP_8: {
+            static const auto table = build_lane_dispatch_table(emulator_type);
+            return *table;
+        }
+        case vm_t::settings_t::SCHIP1_1: {
+            static const auto table = build_lane_dispatch_table(emulator_type);
+            return *table;
+        }
+        case vm_t::settings_t::XO_CHIP: {
+            static const auto table = build_lane_dispatch_table(emulator_type);
+            return *table;
+        }
+    }
+
+    throw std::invalid_argument("unknown emulator type");
+}
+
+opcode_t fetch(const std::array<uint8_t, MEMORY_SIZE>& memory, uint16_t pc) noexcept {
+    return opcode_t{static_cast<uint16_t>(memory[pc % MEMORY_SIZE] << 8 | memory[(pc + 1u) % MEMORY_SIZE])};
+}
+
+} // namespace
+
+
+vm_batch_t::vm_batch_t(
+    size_t lanes,
+    const vm_t& prototype,
+    keyboard_system_iface_t& keyboard_system,
+    timers_system_iface_t& timers_system,
+    video_system_iface_t& video_system,
+    random_system_iface_t& random_system,
+    sound_system_iface_t& sound_system
+)
+    : settings(prototype.settings)
+    , quirks(prototype.quirks)
+    , keyboard_system(keyboard_system)
+    , timers_system(timers_system)
+    , video_system(video_system)
+    , random_system(random_system)
+    , sound_system(sound_system)
+    , timers_duration(prototype.timers_duration)
+    , frame_cycles(prototype.frame_cycles)
+    , halted(lanes, 0)
+    , faults(lanes)
+{
+    for (size_t i = 0; i < REGISTERS_SIZE; ++i) {
+        V[i].assign(lanes, prototype.V[i]);
+    }
+    for (size_t i = 0; i < STACK_SIZE; ++i) {
+        stack[i].assign(lanes, prototype.stack[i]);
+    }
+    I.assign(lanes, prototype.I);
+    pc.assign(lanes, prototype.pc);
+    sp.assign(lanes, prototype.sp);
+    delay_timer.assign(lanes, prototype.delay_timer);
+    sound_timer.assign(lanes, prototype.sound_timer);
+    vblank.assign(lanes, prototype.vblank);
+    memory.assign(lanes, prototype.memory);
+    video_memory.assign(lanes, prototype.video_memory);
+    audio.assign(lanes, prototype.audio);
+}
+
+size_t vm_batch_t::size() const noexcept {
+    return pc.size();
+}
+
+void vm_batch_t::run(uint64_t count) {
+    for (uint64_t i = 0; i < count && halted_count < size(); ++i) {
+        step();
+    }
+}
+
+void vm_batch_t::step() {
+    const size_t lanes = size();
+
+    // halted lanes are left out: they neither break lockstep, nor are changed by it
+    const auto first_lane = static_cast<size_t>(std::find(halted.begin(), halted.end(), 0) - halted.begin());
+    const uint16_t first_pc = pc[first_lane];
+
+    bool same_pc = true;
+    for (size_t lane = 0; lane < lanes; ++lane) {
+        same_pc &= halted[lane] || pc[lane] == first_pc;
+    }
+
+    if (same_pc && first_pc + 1u < MEMORY_SIZE) {
+        const auto opcode = fetch(memory[first_lane], first_pc);
+
+        // code is the same for all lanes, unless some of them wrote there
+        bool same_opcode = true;
+        if (written_memory.test(first_pc) || written_memory.test(first_pc + 1u)) {
+            for (size_t lane = 0; lane < lanes; ++lane) {
+                same_opcode &= halted[lane] || fetch(memory[lane], first_pc).bytes == opcode.bytes;
+            }
+        }
+
+        const bool executed = same_opcode
+            && (halted_count == 0 ? execute_lockstep<false>(first_pc, opcode) : execute_lockstep<true>(first_pc, opcode));
+        if (executed) {
+            advance_timers();
+            return;
+        }
+    }
+
+    for (size_t lane = 0; lane < lanes; ++lane) {
+        if (!halted[lane]) {
+            execute_lane(lane);
+        }
+    }
+    advance_timers();
+}
+
+template <bool MASKED>
+bool vm_batch_t::execute_lockstep(uint16_t current_pc, opcode_t opcode) {
+    const size_t lanes = size();
+
+    uint8_t* vx = V[opcode.get_x()].data();
+    const uint8_t* vy = V[opcode.get_y()].data();
+    uint8_t* vf = V[0xF].data();
+    const uint8_t* shifted = quirks.shifting ? vx : vy;
+    uint16_t* pcs = pc.data();
+    uint16_t* is = I.data();
+    const uint8_t* stopped = halted.data();
+    const uint8_t kk = opcode.get_kk();
+
+    const auto next_pc = static_cast<uint16_t>((current_pc + 2) % MEMORY_SIZE);
+    const auto skip_pc = static_cast<uint16_t>((current_pc + 4) % MEMORY_SIZE);
+
+    // every write of a kernel goes through it, halted lanes keep their values; a select, so loops stay vectorized
+    const auto set = [stopped](auto* values, size_t lane, auto value) {
+        using value_t = std::remove_pointer_t<decltype(values)>;
+        values[lane] = (MASKED && stopped[lane]) ? values[lane] : static_cast<value_t>(value);
+    };
+
+    const auto skip_if = [&](auto condition) {
+        for (size_t lane = 0; lane < lanes; ++lane) {
+            set(pcs, lane, condition(lane) ? skip_pc : next_pc);
+        }
+        return true;
+    };
+    const auto fill = [&](auto* values, auto value) {
+        for (size_t lane = 0; lane < lanes; ++lane) {
+            set(values, lane, value);
+        }
+    };
+
+    switch (opcode.get_nibble<3>()) {
+        case 0x1:
+            fill(pcs, opcode.get_nnn());
+            return true;
+        case 0x3: return skip_if([&](size_t lane) { return vx[lane] == kk; });
+        case 0x4: return skip_if([&](size_t lane) { return vx[lane] != kk; });
+        case 0x5: return skip_if([&](size_t lane) { return vx[lane] == vy[lane]; });
+        case 0x9: return skip_if([&](size_t lane) { return vx[lane] != vy[lane]; });
+        case 0x6:
+            fill(vx, kk);
+            break;
+        case 0x7:
+            for (size_t lane = 0; lane < lanes; ++lane) {
+                set(vx, lane, vx[lane] + kk);
+            }
+            break;
+        case 0x8: switch (opcode.get_n()) {
+            case 0x0:
+                for (size_t lane = 0; lane < lanes; ++lane) {
+                    set(vx, lane, vy[lane]);
+                }
+                break;
+            case 0x1:
+                for (size_t lane = 0; lane < lanes; ++lane) {
+                    set(vx, lane, vx[lane] | vy[lane]);
+                }
+                if (quirks.vf_reset) {
+                    fill(vf, 0);
+                }
+                break;
+            case 0x2:
+                for (size_t lane = 0; lane < lanes; ++lane) {
+                    set(vx, lane, vx[lane] & vy[lane]);
+                }
+                if (quirks.vf_reset) {
+                    fill(vf, 0);
+                }
+                break;
+            case 0x3:
+                for (size_t lane = 0; lane < lanes; ++lane) {
+                    set(vx, lane, vx[lane] ^ vy[lane]);
+                }
+                if (quirks.vf_reset) {
+                    fill(vf, 0);
+                }
+                break;
+            case 0x4:
+                for (size_t lane = 0; lane < lanes; ++lane) {
+                    const unsigned result = vx[lane] + vy[lane];
+                    set(vx, lane, result);
+                    set(vf, lane, result > 0xFF);
+                }
+                break;
+            case 0x5:
+                for (size_t lane = 0; lane < lanes; ++lane) {
+                    const int result = vx[lane] - vy[lane];
+                    set(vx, lane, result);
+                    set(vf, lane, result > 0);
+                }
+                break;
+            case 0x6:
+                for (size_t lane = 0; lane < lanes; ++lane) {
+                    const uint8_t value = shifted[lane];
+                    set(vx, lane, value >> 1);
+                    set(vf, lane, value & 0x1);
+                }
+                break;
+            case 0x7:
+                for (size_t lane = 0; lane < lanes; ++lane) {
+                    const int result = vy[lane] - vx[lane];
+                    set(vx, lane, result);
+                    set(vf, lane, result > 0);
+                }
+                break;
+            case 0xE:
+                for (size_t lane = 0; lane < lanes; ++lane) {
+                    const uint8_t value = shifted[lane];
+                    set(vx, lane, value << 1);
+                    set(vf, lane, value >> 7);
+                }
+                break;
+            default:
+                return false;
+        }
+        break;
+        case 0xA:
+            fill(is, opcode.get_nnn());
+            break;
+        case 0xB: {
+            const uint8_t* offsets = quirks.jump_vx ? vx : V[0].data();
+            for (size_t lane = 0; lane < lanes; ++lane) {
+                set(pcs, lane, opcode.get_nnn() + offsets[lane]);
+            }
+            return true;
+        }
+        case 0xF: switch (kk) {
+            case 0x07:
+                for (size_t lane = 0; lane < lanes; ++lane) {
+                    set(vx, lane, delay_timer[lane]);
+                }
+                break;
+            case 0x15:
+                for (size_t lane = 0; lane < lanes; ++lane) {
+                    set(delay_timer.data(), lane, vx[lane]);
+                }
+                break;
+            case 0x18:
+                for (size_t lane = 0; lane < lanes; ++lane) {
+                    set(sound_timer.data(), lane, vx[lane]);
+                }
+                break;
+            case 0x1E:
+                for (size_t lane = 0; lane < lanes; ++lane) {
+                    set(is, lane, is[lane] + vx[lane]);
+                }
+                break;
+            case 0x29:
+                for (size_t lane = 0; lane < lanes; ++lane) {
+                    set(is, lane, vx[lane] * 5);
+                }
+                break;
+            default:
+                return false;
+        }
+        break;
+        default:
+            return false;
+    }
+
+    fill(pcs, next_pc);
+    return true;
+}
+
+void vm_batch_t::execute_lane(size_t lane) {
+    const auto& table = get_lane_dispatch_table(settings.emulator_type);
+
+    lane_vm_t vm(*this, lane);
+    const auto opcode = fetch(memory[lane], vm.pc);
+
+    table[opcode.bytes](vm, opcode);
+    vm.store(*this, lane);
+
+    if (vm.fault != fault_kind_t::NONE) [[unlikely]] {
+        halted[lane] = 1;
+        faults[lane] = fault_t{
+            .kind = vm.fault,
+            .pc = vm.pc,
+            .opcode = opcode,
+            .I = vm.I,
+            .sp = vm.sp,
+            .V = vm.V,
+        };
+        ++halted_count;
+    }
+}
+
+void vm_batch_t::advance_timers() {
+    const size_t lanes = size();
+    uint64_t ticks = 0;
+    if (settings.cycles_per_frame > 0) {
+        ticks = ++frame_cycles / settings.cycles_per_frame;
+        frame_cycles %= settings.cycles_per_frame;
+    } else {
+        timers_duration += settings.op_duration;
+        for (; timers_duration >= settings.timer_duration; ++ticks) {
+            timers_duration -= settings.timer_duration;
+        }
+    }
+
+    for (uint64_t tick = 0; tick < ticks; ++tick) {
+        // halted lanes stopped their clocks
+        for (size_t lane = 0; lane < lanes; ++lane) {
+            const bool running = !halted[lane];
+            delay_timer[lane] -= (delay_timer[lane] > 0) & running;
+            sound_timer[lane] -= (sound_timer[lane] > 0) & running;
+            vblank[lane] |= running;
+        }
+        timers_system.tick(settings.timer_duration);
+    }
+
+    if (ticks > 0) {
+        // lanes are not heard, like they are not presented
+        sound_system.play_sound(settings.timer_duration * ticks, std::chrono::nanoseconds::zero(), audio_t{});
+    }
+}
+
+void vm_batch_t::load_lane(size_t lane, const vm_t& vm) {
+    for (size_t i = 0; i < REGISTERS_SIZE; ++i) {
+        V[i][lane] = vm.V[i];
+    }
+    for (size_t i = 0; i < STACK_SIZE; ++i) {
+        stack[i][lane] = vm.stack[i];
+    }
+    I[lane] = vm.I;
+    pc[lane] = vm.pc;
+    sp[lane] = vm.sp;
+    delay_timer[lane] = vm.delay_timer;
+    sound_timer[lane] = vm.sound_timer;
+    vblank[lane] = vm.vblank;
+    video_memory[lane] = vm.video_memory;
+    audio[lane] = vm.audio;
+
+    for (size_t address = 0; address < MEMORY_SIZE; ++address) {
+        if (memory[lane][address] != vm.memory[address]) {
+            written_memory.set(address, 1);
+        }
+    }
+    memory[lane] = vm.memory;
+
+    if (halted[lane]) {
+        halted[lane] = 0;
+        faults[lane] = fault_t{};
+        --halted_count;
+    }
+}
+
+void vm_batch_t::store_lane(size_t lane, vm_t& vm) const {
+    for (size_t i = 0; i < REGISTERS_SIZE; ++i) {
+        vm.V[i] = V[i][lane];
+    }
+    for (size_t i = 0; i < STACK_SIZE; ++i) {
+        vm.stack[i] = stack[i][lane];
+    }
+    vm.I = I[lane];
+    vm.pc = pc[lane];
+    vm.sp = sp[lane];
+    vm.delay_timer = delay_timer[lane];
+    vm.sound_timer = sound_timer[lane];
+    vm.vblank = vblank[lane];
+    vm.video_memory = video_memory[lane];
+    vm.dirty_rows.set();
+    vm.audio = audio[lane];
+    vm.timers_duration = timers_duration;
+    vm.frame_cycles = frame_cycles;
+
+    // memory was replaced as a whole, caches of engines have to go
+    vm.memory = memory[lane];
+    vm.written_memory.set(0, MEMORY_SIZE);
+}
+
+bool vm_batch_t::is_halted(size_t lane) const noexcept {
+    return halted[lane] != 0;
+}
+
+fault_t vm_batch_t::get_fault(size_t lane) const noexcept {
+    return faults[lane];
+}
+
+} // namespace chip8
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+#include <core/common.h>
+#include <core/iface/keyboard.h>
+#include <core/iface/random.h>
+#include <core/iface/sound.h>
+#include <core/iface/timers.h>
+#include <core/iface/video.h>
+#include <core/vm.h>
+
+
+namespace chip8 {
+
+/**
+ * Many copies of the same vm, stored as structure of arrays: every register is a vector with one value per lane.
+ *
+ * Every step runs one instruction on every lane. While all lanes are at the same pc with the same opcode,
+ * instruction is executed for all of them at once, by loops over the lanes, that compiler vectorizes.
+ * Otherwise (and for instructions, that talk to peripherals or memory) lanes are executed one by one,
+ * with the generic semantics from instructions.h.
+ *
+ * Peripherals are shared by all lanes, it is meant to run headless, with no-op peripherals from impl_basic.
+ * Timers tick for all lanes together, as all of them execute the same number of instructions.
+ * With settings.cycles_per_frame every instruction is one cycle, settings.cycle_costs are ignored.
+ * Lane, that faulted, is halted: it keeps its state and does not run anymore, the other lanes go on
+ * and still run in lockstep without it.
+ * Exceptions of peripherals are not faults, they leave run() as they are.
+ */
+struct vm_batch_t {
+    vm_batch_t(
+        size_t lanes,
+        const vm_t& prototype,
+        keyboard_system_iface_t& keyboard_system,
+        timers_system_iface_t& timers_system,
+        video_system_iface_t& video_system,
+        random_system_iface_t& random_system,
+        sound_system_iface_t& sound_system
+    );
+
+    vm_batch_t(const vm_batch_t&) = delete;
+    vm_batch_t& operator=(const vm_batch_t&) = delete;
+
+    size_t size() const noexcept;
+
+    // runs `count` instructions on every lane, that is not halted
+    void run(uint64_t count);
+
+    // copies state of the vm into the lane, timers_duration and frame_cycles are shared and stay as they are
+    void load_lane(size_t lane, const vm_t& vm);
+    // copies state of the lane into the vm
+    void store_lane(size_t lane, vm_t& vm) const;
+
+    bool is_halted(size_t lane) const noexcept;
+    // fault, that halted the lane, empty if lane is running
+    fault_t get_fault(size_t lane) const noexcept;
+
+    // settings
+    const vm_t::settings_t settings;
+    const quirks_t quirks;
+
+    // registers, one value per lane
+    std::array<std::vector<uint8_t>, REGISTERS_SIZE> V;
+    std::vector<uint16_t> I;
+    std::vector<uint16_t> pc;
+    std::vector<uint8_t> sp;
+    std::vector<uint8_t> delay_timer;
+    std::vector<uint8_t> sound_timer;
+    std::vector<uint8_t> vblank;
+
+    // memory, one per lane
+    std::array<std::vector<uint16_t>, STACK_SIZE> stack;
+    std::vector<std::array<uint8_t, MEMORY_SIZE>> memory;
+    std::vector<video_memory_t> video_memory;
+    std::vector<audio_t> audio;
+
+    // addresses, where memory of lanes might differ, opcodes there are compared before lockstep execution
+    memory_bitmap_t written_memory;
+
+    // peripherals
+    keyboard_system_iface_t& keyboard_system;
+    timers_system_iface_t& timers_system;
+    video_system_iface_t& video_system;
+    random_system_iface_t& random_system;
+    sound_system_iface_t& sound_system;
+
+    std::chrono::nanoseconds timers_duration = std::chrono::nanoseconds::zero();
+    uint64_t frame_cycles = 0;
+
+private:
+    void step();
+    // false, if instruction has no lockstep implementation; MASKED leaves halted lanes as they are
+    template <bool MASKED>
+    bool execute_lockstep(uint16_t pc, opcode_t opcode);
+    void execute_lane(size_t lane);
+    void advance_timers();
+
+    std::vector<uint8_t> halted;
+    std::vector<fault_t> faults;
+    size_t halted_count = 0;
+};
+
+} // namespace chip8
@@ -0,0 +1,438 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+#include <core/common.h>
+
+
+namespace chip8::x86_64 {
+
+/**
+ * Tiny x86-64 assembler, only the subset needed by JIT.
+ * Register operations are 32-bit (upper half of a host register is always zeroed by them),
+ * byte/word forms access memory; byte forms of register operations keep the upper bits as they are.
+ */
+
+enum reg_t : uint8_t {
+    RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+    R8, R9, R10, R11, R12, R13, R14, R15,
+};
+
+enum condition_t : uint8_t {
+    CC_B = 0x2,     // unsigned below, carry
+    CC_AE = 0x3,
+    CC_E = 0x4,
+    CC_NE = 0x5,
+    CC_BE = 0x6,
+    CC_A = 0x7,     // unsigned above
+};
+
+enum alu_t : uint8_t {
+    ALU_ADD = 0,
+    ALU_OR = 1,
+    ALU_AND = 4,
+    ALU_SUB = 5,
+    ALU_XOR = 6,
+    ALU_CMP = 7,
+};
+
+// [base + index * scale + disp]
+struct mem_t {
+    reg_t base;
+    int32_t disp = 0;
+    reg_t index = RSP; // RSP means "no index", it can not be encoded as index anyway
+    uint8_t scale = 1;
+};
+
+struct label_t {
+    static inline constexpr size_t UNBOUND = std::numeric_limits<size_t>::max();
+
+    size_t position = UNBOUND;
+    std::vector<size_t> fixups;
+};
+
+struct emitter_t {
+    bytes_owned code;
+    // address, where the code is going to be placed, needed for jumps outside of it
+    const uint8_t* origin = nullptr;
+
+    void emit_byte(uint8_t value) {
+        code.push_back(value);
+    }
+
+    void emit_word(uint16_t value) {
+        emit_raw(&value, sizeof(value));
+    }
+
+    void emit_dword(uint32_t value) {
+        emit_raw(&value, sizeof(value));
+    }
+
+    void emit_qword(uint64_t value) {
+        emit_raw(&value, sizeof(value));
+    }
+
+    void push(reg_t reg) {
+        emit_rex(false, 0, 0, reg, false);
+        emit_byte(0x50 + (reg & 7));
+    }
+
+    void pop(reg_t reg) {
+        emit_rex(false, 0, 0, reg, false);
+        emit_byte(0x58 + (reg & 7));
+    }
+
+    void ret() {
+        emit_byte(0xC3);
+    }
+
+    void mov(reg_t dst, reg_t src) {
+        emit_rex(false, src, 0, dst, false);
+        emit_byte(0x89);
+        emit_modrm_reg(src, dst);
+    }
+
+    void mov_imm(reg_t dst, uint32_t imm) {
+        emit_rex(false, 0, 0, dst, false);
+        emit_byte(0xB8 + (dst & 7));
+        emit_dword(imm);
+    }
+
+    void mov_imm64(reg_t dst, uint64_t imm) {
+        emit_rex(true, 0, 0, dst, false);
+        emit_byte(0xB8 + (dst & 7));
+        emit_qword(imm);
+    }
+
+    void load_dword(reg_t dst, const mem_t& src) {
+        emit_rex(false, dst, src.index, src.base, false);
+        emit_byte(0x8B);
+        emit_modrm_mem(dst, src);
+    }
+
+    void load_qword(reg_t dst, const mem_t& src) {
+        emit_rex(true, dst, src.index, src.base, false);
+        emit_byte(0x8B);
+        emit_modrm_mem(dst, src);
+    }
+
+    void movzx_byte(reg_t dst, const mem_t& src) {
+        emit_rex(false, dst, src.index, src.base, false);
+        emit_byte(0x0F);
+        emit_byte(0xB6);
+        emit_modrm_mem(dst, src);
+    }
+
+    void movzx_word(reg_t dst, const mem_t& src) {
+        emit_rex(false, dst, src.index, src.base, false);
+        emit_byte(0x0F);
+        emit_byte(0xB7);
+        emit_modrm_mem(dst, src);
+    }
+
+    void movzx_word(reg_t dst, reg_t src) {
+        emit_rex(false, dst, 0, src, false);
+        emit_byte(0x0F);
+        emit_byte(0xB7);
+        emit_modrm_reg(dst, src);
+    }
+
+    // forced rex, so SPL/BPL/SIL/DIL are addressed instead of AH/CH/DH/BH
+    void movzx_byte(reg_t dst, reg_t src) {
+        emit_rex(false, dst, 0, src, true);
+        emit_byte(0x0F);
+        emit_byte(0xB6);
+        emit_modrm_reg(dst, src);
+    }
+
+    void store_byte(const mem_t& dst, reg_t src) {
+        // forced rex, so SPL/BPL/SIL/DIL are addressed instead of AH/CH/DH/BH
+        emit_rex(false, src, dst.index, dst.base, true);
+        emit_byte(0x88);
+        emit_modrm_mem(src, dst);
+    }
+
+    void store_byte_imm(const mem_t& dst, uint8_t imm) {
+        emit_rex(false, 0, dst.index, dst.base, false);
+        emit_byte(0xC6);
+        emit_modrm_mem(0, dst);
+        emit_byte(imm);
+    }
+
+    void store_word(const mem_t& dst, reg_t src) {
+        emit_byte(0x66);
+        emit_rex(false, src, dst.index, dst.base, false);
+        emit_byte(0x89);
+        emit_modrm_mem(src, dst);
+    }
+
+    void store_word_imm(const mem_t& dst, uint16_t imm) {
+        emit_byte(0x66);
+        emit_rex(false, 0, dst.index, dst.base, false);
+        emit_byte(0xC7);
+        emit_modrm_mem(0, dst);
+        emit_word(imm);
+    }
+
+    void store_dword(const mem_t& dst, reg_t src) {
+        emit_rex(false, src, dst.index, dst.base, false);
+        emit_byte(0x89);
+        emit_modrm_mem(src, dst);
+    }
+
+    void store_qword(const mem_t& dst, reg_t src) {
+        emit_rex(true, src, dst.index, dst.base, false);
+        emit_byte(0x89);
+        emit_modrm_mem(src, dst);
+    }
+
+    void store_dword_imm(const mem_t& dst, uint32_t imm) {
+        emit_rex(false, 0, dst.index, dst.base, false);
+        emit_byte(0xC7);
+        emit_modrm_mem(0, dst);
+        emit_dword(imm);
+    }
+
+    void lea(reg_t dst, const mem_t& src) {
+        emit_rex(false, dst, src.index, src.base, false);
+        emit_byte(0x8D);
+        emit_modrm_mem(dst, src);
+    }
+
+    void alu(alu_t op, reg_t dst, reg_t src) {
+        emit_rex(false, src, 0, dst, false);
+        emit_byte(static_cast<uint8_t>(op * 8 + 1));
+        emit_modrm_reg(src, dst);
+    }
+
+    void alu_byte(alu_t op, reg_t dst, reg_t src) {
+        emit_rex(false, src, 0, dst, true);
+        emit_byte(static_cast<uint8_t>(op * 8));
+        emit_modrm_reg(src, dst);
+    }
+
+    void alu_byte_imm(alu_t op, reg_t dst, uint8_t imm) {
+        emit_rex(false, 0, 0, dst, true);
+        emit_byte(0x80);
+        emit_modrm_reg(op, dst);
+        emit_byte(imm);
+    }
+
+    void alu_imm(alu_t op, reg_t dst, int32_t imm) {
+        emit_rex(false, 0, 0, dst, false);
+        if (imm >= std::numeric_limits<int8_t>::min() && imm <= std::numeric_limits<int8_t>::max()) {
+            emit_byte(0x83);
+            emit_modrm_reg(op, dst);
+            emit_byte(static_cast<uint8_t>(imm));
+        } else {
+            emit_byte(0x81);
+            emit_modrm_reg(op, dst);
+            emit_dword(static_cast<uint32_t>(imm));
+        }
+    }
+
+    void alu_mem(alu_t op, const mem_t& dst, reg_t src) {
+        emit_rex(false, src, dst.index, dst.base, false);
+        emit_byte(static_cast<uint8_t>(op * 8 + 1));
+        emit_modrm_mem(src, dst);
+    }
+
+    void alu_mem_imm(alu_t op, const mem_t& dst, int32_t imm) {
+        emit_rex(false, 0, dst.index, dst.base, false);
+        if (imm >= std::numeric_limits<int8_t>::min() && imm <= std::numeric_limits<int8_t>::max()) {
+            emit_byte(0x83);
+            emit_modrm_mem(op, dst);
+            emit_byte(static_cast<uint8_t>(imm));
+        } else {
+            emit_byte(0x81);
+            emit_modrm_mem(op, dst);
+            emit_dword(static_cast<uint32_t>(imm));
+        }
+    }
+
+    void test64(reg_t dst, reg_t src) {
+        emit_rex(true, src, 0, dst, false);
+        emit_byte(0x85);
+        emit_modrm_reg(src, dst);
+    }
+
+    void alu_byte_imm(alu_t op, const mem_t& dst, uint8_t imm) {
+        emit_rex(false, 0, dst.index, dst.base, false);
+        emit_byte(0x80);
+        emit_modrm_mem(op, dst);
+        emit_byte(imm);
+    }
+
+    void shl_imm(reg_t dst, uint8_t count) {
+        emit_rex(false, 0, 0, dst, false);
+        emit_byte(0xC1);
+        emit_modrm_reg(4, dst);
+        emit_byte(count);
+    }
+
+    void shr_imm(reg_t dst, uint8_t count) {
+        emit_rex(false, 0, 0, dst, false);
+        emit_byte(0xC1);
+        emit_modrm_reg(5, dst);
+        emit_byte(count);
+    }
+
+    void imul_imm(reg_t dst, reg_t src, int32_t imm) {
+        emit_rex(false, dst, 0, src, false);
+        if (imm >= std::numeric_limits<int8_t>::min() && imm <= std::numeric_limits<int8_t>::max()) {
+            emit_byte(0x6B);
+            emit_modrm_reg(dst, src);
+            emit_byte(static_cast<uint8_t>(imm));
+        } else {
+            emit_byte(0x69);
+            emit_modrm_reg(dst, src);
+            emit_dword(static_cast<uint32_t>(imm));
+        }
+    }
+
+    // writes the low byte only, the rest of destination is left as it is
+    void setcc(condition_t condition, reg_t dst) {
+        emit_rex(false, 0, 0, dst, true);
+        emit_byte(0x0F);
+        emit_byte(0x90 + condition);
+        emit_modrm_reg(0, dst);
+    }
+
+    void cmovcc(condition_t condition, reg_t dst, reg_t src) {
+        emit_rex(false, dst, 0, src, false);
+        emit_byte(0x0F);
+        emit_byte(0x40 + condition);
+        emit_modrm_reg(dst, src);
+    }
+
+    void jcc(condition_t condition, label_t& label) {
+        emit_byte(0x0F);
+        emit_byte(0x80 + condition);
+        emit_rel32(label);
+    }
+
+    void jmp(label_t& label) {
+        emit_byte(0xE9);
+        emit_rel32(label);
+    }
+
+    void jmp(reg_t target) {
+        emit_rex(false, 0, 0, target, false);
+        emit_byte(0xFF);
+        emit_modrm_reg(4, target);
+    }
+
+    void call(reg_t target) {
+        emit_rex(false, 0, 0, target, false);
+        emit_byte(0xFF);
+        emit_modrm_reg(2, target);
+    }
+
+    void call(const mem_t& target) {
+        emit_rex(false, 0, target.index, target.base, false);
+        emit_byte(0xFF);
+        emit_modrm_mem(2, target);
+    }
+
+    void call(label_t& label) {
+        emit_byte(0xE8);
+        emit_rel32(label);
+    }
+
+    void jmp(const mem_t& target) {
+        emit_rex(false, 0, target.index, target.base, false);
+        emit_byte(0xFF);
+        emit_modrm_mem(4, target);
+    }
+
+    // jump to the code outside of this buffer, origin must be set
+    void jmp(const uint8_t* target) {
+        emit_byte(0xE9);
+        auto rel = static_cast<int32_t>(target - (origin + code.size() + 4));
+        emit_dword(static_cast<uint32_t>(rel));
+    }
+
+    void bind(label_t& label) {
+        label.position = code.size();
+        for (auto fixup : label.fixups) {
+            patch_rel32(fixup, label.position);
+        }
+        label.fixups.clear();
+    }
+
+private:
+    void emit_raw(const void* data, size_t size) {
+        auto bytes = static_cast<const uint8_t*>(data);
+        code.append(bytes, size);
+    }
+
+    void emit_rex(bool wide, uint8_t reg, uint8_t index, uint8_t base, bool force) {
+        uint8_t rex = 0x40
+            | (wide ? 0x8 : 0)
+            | ((reg & 8) ? 0x4 : 0)
+            | ((index & 8) ? 0x2 : 0)
+            | ((base & 8) ? 0x1 : 0);
+
+        if (rex != 0x40 || force) {
+            emit_byte(rex);
+        }
+    }
+
+    void emit_modrm_reg(uint8_t reg, uint8_t rm) {
+        emit_byte(static_cast<uint8_t>(0xC0 | ((reg & 7) << 3) | (rm & 7)));
+    }
+
+    void emit_modrm_mem(uint8_t reg, const mem_t& mem) {
+        const uint8_t base = mem.base & 7;
+        const bool has_index = mem.index != RSP;
+
+        uint8_t mod = 0x2;
+        if (mem.disp == 0 && base != RBP) {
+            mod = 0x0;
+        } else if (mem.disp >= std::numeric_limits<int8_t>::min() && mem.disp <= std::numeric_limits<int8_t>::max()) {
+            mod = 0x1;
+        }
+
+        if (has_index || base == RSP) {
+            emit_byte(static_cast<uint8_t>((mod << 6) | ((reg & 7) << 3) | RSP));
+
+            uint8_t scale_bits = 0;
+            switch (mem.scale) {
+                case 2: scale_bits = 1; break;
+                case 4: scale_bits = 2; break;
+                case 8: scale_bits = 3; break;
+                default: scale_bits = 0; break;
+            }
+            emit_byte(static_cast<uint8_t>((scale_bits << 6) | ((mem.index & 7) << 3) | base));
+        } else {
+            emit_byte(static_cast<uint8_t>((mod << 6) | ((reg & 7) << 3) | base));
+        }
+
+        if (mod == 0x1) {
+            emit_byte(static_cast<uint8_t>(mem.disp));
+        } else if (mod == 0x2) {
+            emit_dword(static_cast<uint32_t>(mem.disp));
+        }
+    }
+
+    void emit_rel32(label_t& label) {
+        auto fixup = code.size();
+        emit_dword(0);
+
+        if (label.position == label_t::UNBOUND) {
+            label.fixups.push_back(fixup);
+        } else {
+            patch_rel32(fixup, label.position);
+        }
+    }
+
+    void patch_rel32(size_t fixup, size_t target) {
+        auto rel = static_cast<int32_t>(static_cast<int64_t>(target) - static_cast<int64_t>(fixup + 4));
+        std::memcpy(code.data() + fixup, &rel, sizeof(rel));
+    }
+};
+
+} // namespace chip8::x86_64
@@ -0,0 +1,38 @@
+#include "keyboard_queue.h"
+
+#include <stdexcept>
+
+
+namespace chip8 {
+
+void keyboard_system_queue_t::press(keyboard_key_t key) {
+    pressed.set(key % KEYPAD_SIZE);
+    presses.push_back(key);
+}
+
+void keyboard_system_queue_t::release(keyboard_key_t key) {
+    pressed.reset(key % KEYPAD_SIZE);
+}
+
+bool keyboard_system_queue_t::is_pressed(keyboard_key_t key) {
+    return pressed.test(key % KEYPAD_SIZE);
+}
+
+keyboard_key_t keyboard_system_queue_t::wait_for_keypress() {
+    const auto key = take_keypress();
+    if (!key) {
+        throw std::logic_error("keyboard: no key to wait for");
+    }
+    return *key;
+}
+
+std::optional<keyboard_key_t> keyboard_system_queue_t::take_keypress() {
+    if (presses.empty()) {
+        return std::nullopt;
+    }
+    const auto key = presses.front();
+    presses.pop_front();
+    return key;
+}
+
+} // namespace chip8
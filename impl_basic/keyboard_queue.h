@@ -0,0 +1,31 @@
+#pragma once
+
+#include <bitset>
+#include <deque>
+#include <optional>
+
+#include <core/common.h>
+#include <core/iface/keyboard.h>
+
+
+namespace chip8 {
+
+/**
+ * Keyboard, that never blocks: host feeds presses and releases, LD_VX_K takes queued presses.
+ * Without a press LD_VX_K stops the run with KEY_WAIT, for event loops, that drive many vms on one thread (run_loop_t).
+ */
+struct keyboard_system_queue_t : keyboard_system_iface_t {
+    void press(keyboard_key_t key);
+    void release(keyboard_key_t key);
+
+    bool is_pressed(keyboard_key_t key) override;
+    // the oldest queued press, throws, if there is none, as it would block forever
+    keyboard_key_t wait_for_keypress() override;
+    std::optional<keyboard_key_t> take_keypress() override;
+
+private:
+    std::bitset<KEYPAD_SIZE> pressed;
+    std::deque<keyboard_key_t> presses;
+};
+
+} // namespace chip8
@@ -0,0 +1,59 @@
+#include "sound_capture.h"
+
+#include <string_view>
+
+
+namespace chip8 {
+
+namespace {
+
+void write_u16(bytes_owned& out, uint16_t value) {
+    out.push_back(static_cast<uint8_t>(value));
+    out.push_back(static_cast<uint8_t>(value >> 8));
+}
+
+void write_u32(bytes_owned& out, uint32_t value) {
+    write_u16(out, static_cast<uint16_t>(value));
+    write_u16(out, static_cast<uint16_t>(value >> 16));
+}
+
+void write_tag(bytes_owned& out, std::string_view tag) {
+    out.append(reinterpret_cast<const uint8_t*>(tag.data()), tag.size());
+}
+
+} // namespace
+
+sound_system_capture_t::sound_system_capture_t(uint32_t sample_rate)
+    : generator(sample_rate)
+{}
+
+void sound_system_capture_t::play_sound(std::chrono::nanoseconds duration, std::chrono::nanoseconds audible, const audio_t& audio) {
+    generator.generate(duration, audible, audio, samples);
+}
+
+bytes_owned sound_system_capture_t::to_wav() const {
+    const auto sample_rate = generator.get_sample_rate();
+    const auto data_size = static_cast<uint32_t>(samples.size() * sizeof(int16_t));
+
+    // RIFF header, one PCM channel of little-endian 16-bit samples
+    bytes_owned wav;
+    write_tag(wav, "RIFF");
+    write_u32(wav, 36 + data_size);
+    write_tag(wav, "WAVE");
+    write_tag(wav, "fmt ");
+    write_u32(wav, 16);
+    write_u16(wav, 1);
+    write_u16(wav, 1);
+    write_u32(wav, sample_rate);
+    write_u32(wav, sample_rate * sizeof(int16_t));
+    write_u16(wav, sizeof(int16_t));
+    write_u16(wav, 16);
+    write_tag(wav, "data");
+    write_u32(wav, data_size);
+    for (auto sample : samples) {
+        write_u16(wav, static_cast<uint16_t>(sample));
+    }
+    return wav;
+}
+
+} // namespace chip8
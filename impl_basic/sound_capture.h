@@ -0,0 +1,33 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+#include <core/audio.h>
+#include <core/common.h>
+#include <core/iface/sound.h>
+
+
+namespace chip8 {
+
+/**
+ * Sound, that is kept instead of played: PCM of every frame is appended to `samples`, e.g. for headless runs.
+ */
+struct sound_system_capture_t : sound_system_iface_t {
+    static inline constexpr uint32_t DEFAULT_SAMPLE_RATE = 48000;
+
+    explicit sound_system_capture_t(uint32_t sample_rate = DEFAULT_SAMPLE_RATE);
+
+    void play_sound(std::chrono::nanoseconds duration, std::chrono::nanoseconds audible, const audio_t& audio) override;
+
+    // samples so far as a 16-bit mono WAV file
+    bytes_owned to_wav() const;
+
+    std::vector<int16_t> samples;
+
+private:
+    audio_generator_t generator;
+};
+
+} // namespace chip8
@@ -7,8 +7,9 @@
 
 namespace chip8 {
 
+// inline, so static_vm_t could compile the calls away
 struct sound_system_none_t : sound_system_iface_t {
-    void play_sound(std::chrono::nanoseconds duration) override;
+    void play_sound(std::chrono::nanoseconds, std::chrono::nanoseconds, const audio_t&) override {}
 };
 
 } // namespace chip8
@@ -0,0 +1,48 @@
+#include "sound_stream.h"
+
+#include <algorithm>
+
+
+namespace chip8 {
+
+sound_system_stream_t::sound_system_stream_t()
+    : sound_system_stream_t(settings_t{})
+{}
+
+sound_system_stream_t::sound_system_stream_t(settings_t settings)
+    : generator(settings.sample_rate)
+    , max_samples(std::max<size_t>(1, static_cast<size_t>(std::max<int64_t>(settings.latency.count(), 0) * settings.sample_rate / 1'000'000'000)))
+    , ring(max_samples)
+{}
+
+void sound_system_stream_t::play_sound(std::chrono::nanoseconds duration, std::chrono::nanoseconds audible, const audio_t& audio) {
+    frame.clear();
+    generator.generate(duration, audible, audio, frame);
+
+    // ring is filled up to the latency, not to its capacity
+    const auto queued = ring.size();
+    const auto fits = max_samples > queued ? std::min(frame.size(), max_samples - queued) : 0;
+    const auto pushed = ring.push(frame.data(), fits);
+    if (pushed < frame.size()) {
+        dropped_samples.fetch_add(frame.size() - pushed, std::memory_order_relaxed);
+    }
+}
+
+void sound_system_stream_t::drain(int16_t* samples, size_t count) noexcept {
+    const auto popped = ring.pop(samples, count);
+    if (popped < count) {
+        std::fill(samples + popped, samples + count, int16_t{0});
+        underruns.fetch_add(1, std::memory_order_relaxed);
+        missing_samples.fetch_add(count - popped, std::memory_order_relaxed);
+    }
+}
+
+auto sound_system_stream_t::get_stats() const noexcept -> stats_t {
+    return stats_t{
+        .underruns = underruns.load(std::memory_order_relaxed),
+        .missing_samples = missing_samples.load(std::memory_order_relaxed),
+        .dropped_samples = dropped_samples.load(std::memory_order_relaxed),
+    };
+}
+
+} // namespace chip8
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+#include <core/audio.h>
+#include <core/common.h>
+#include <core/iface/sound.h>
+#include <core/spsc_ring.h>
+
+
+namespace chip8 {
+
+/**
+ * Sound for an audio device, that pulls samples from its own thread: vm thread generates PCM into a wait-free ring,
+ * the callback of the device drains it. There are no locks on either side.
+ * Ring holds at most `latency` of sound: samples, that vm generates ahead of it, are dropped;
+ * when the ring runs dry, device gets silence for the rest of its buffer and an underrun is counted.
+ */
+struct sound_system_stream_t : sound_system_iface_t {
+    static inline constexpr uint32_t DEFAULT_SAMPLE_RATE = 48000;
+    static inline constexpr auto DEFAULT_LATENCY = std::chrono::milliseconds(50);
+
+    struct settings_t {
+        uint32_t sample_rate = DEFAULT_SAMPLE_RATE;
+        std::chrono::nanoseconds latency = DEFAULT_LATENCY;
+    };
+
+    struct stats_t {
+        // callbacks, that found fewer samples than they needed, and the samples they missed
+        uint64_t underruns = 0;
+        uint64_t missing_samples = 0;
+        // samples, that vm generated, while the ring was full
+        uint64_t dropped_samples = 0;
+    };
+
+    sound_system_stream_t();
+    explicit sound_system_stream_t(settings_t settings);
+
+    // producer, vm thread
+    void play_sound(std::chrono::nanoseconds duration, std::chrono::nanoseconds audible, const audio_t& audio) override;
+
+    // consumer, audio thread: fills all `count` samples, the ones missing in the ring with silence
+    void drain(int16_t* samples, size_t count) noexcept;
+
+    // may be called from any thread
+    stats_t get_stats() const noexcept;
+
+    uint32_t get_sample_rate() const noexcept {
+        return generator.get_sample_rate();
+    }
+
+private:
+    audio_generator_t generator;
+    // latency in samples, ring itself is rounded up to a power of two
+    const size_t max_samples;
+    spsc_ring_t<int16_t> ring;
+    // samples of the last frame, kept, so frames do not allocate
+    std::vector<int16_t> frame;
+
+    std::atomic<uint64_t> underruns{0};
+    std::atomic<uint64_t> missing_samples{0};
+    std::atomic<uint64_t> dropped_samples{0};
+};
+
+} // namespace chip8
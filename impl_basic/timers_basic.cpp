@@ -1,16 +1,73 @@
 #include "timers_basic.h"
 
-#include <iostream>
-#include <sstream>
+#include <algorithm>
+#include <cerrno>
 #include <thread>
 
-#include <core/vm.h>
+#if defined(__linux__)
+#include <time.h>
+#endif
 
 
 namespace chip8 {
 
+namespace {
+
+void sleep_until(std::chrono::steady_clock::time_point wake) {
+#if defined(__linux__)
+    // steady_clock is CLOCK_MONOTONIC there
+    const auto since_epoch = std::chrono::duration_cast<std::chrono::nanoseconds>(wake.time_since_epoch()).count();
+    timespec time{
+        .tv_sec = static_cast<time_t>(since_epoch / 1000000000),
+        .tv_nsec = static_cast<long>(since_epoch % 1000000000),
+    };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &time, nullptr) == EINTR) {}
+#else
+    std::this_thread::sleep_until(wake);
+#endif
+}
+
+} // namespace
+
+
+timers_system_basic_t::timers_system_basic_t(std::chrono::nanoseconds spin, std::chrono::nanoseconds max_lag)
+    : spin(spin)
+    , max_lag(max_lag)
+{}
+
 void timers_system_basic_t::tick(std::chrono::nanoseconds duration) {
-    std::this_thread::sleep_for(duration);
+    auto now = std::chrono::steady_clock::now();
+    if (deadline == std::chrono::steady_clock::time_point{}) {
+        deadline = now;
+    }
+    deadline += duration;
+
+    if (now < deadline) {
+        if (deadline - now > spin) {
+            sleep_until(deadline - spin);
+        }
+        while ((now = std::chrono::steady_clock::now()) < deadline) {}
+    }
+
+    const auto lateness = std::chrono::nanoseconds(now - deadline);
+    ++stats.frames;
+    stats.late_frames += lateness > LATE_FRAME;
+    stats.total_lateness += lateness;
+    stats.max_lateness = std::max(stats.max_lateness, lateness);
+
+    if (lateness > max_lag) {
+        // too far behind to catch up, frames would be rushed for too long
+        deadline = now;
+        ++stats.resyncs;
+    }
+}
+
+const timers_system_basic_t::stats_t& timers_system_basic_t::get_stats() const noexcept {
+    return stats;
+}
+
+void timers_system_basic_t::reset_stats() noexcept {
+    stats = stats_t{};
 }
 
 } // namespace chip8
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <chrono>
+#include <cstdint>
 
 #include <core/common.h>
 #include <core/iface/timers.h>
@@ -8,8 +9,46 @@
 
 namespace chip8 {
 
+/**
+ * Real time pacing: every tick waits for its absolute deadline, the previous deadline plus duration,
+ * so time of emulation between ticks and oversleeps do not add up to drift.
+ * Sleeps up to `spin` before the deadline (clock_nanosleep with TIMER_ABSTIME on linux), then spins for the rest.
+ * Late tick returns right away and the next ones catch up, unless vm is more than `max_lag` behind,
+ * then schedule starts anew from now.
+ */
 struct timers_system_basic_t : timers_system_iface_t {
+    static inline constexpr auto DEFAULT_SPIN = std::chrono::microseconds(500);
+    static inline constexpr auto DEFAULT_MAX_LAG = std::chrono::milliseconds(100);
+    // frames, that return later than this after their deadline, are counted as late
+    static inline constexpr auto LATE_FRAME = std::chrono::milliseconds(1);
+
+    struct stats_t {
+        uint64_t frames = 0;
+        uint64_t late_frames = 0;
+        uint64_t resyncs = 0;
+        // how much later than their deadlines ticks have returned
+        std::chrono::nanoseconds total_lateness = std::chrono::nanoseconds::zero();
+        std::chrono::nanoseconds max_lateness = std::chrono::nanoseconds::zero();
+
+        std::chrono::nanoseconds mean_lateness() const noexcept {
+            return frames > 0 ? total_lateness / static_cast<int64_t>(frames) : std::chrono::nanoseconds::zero();
+        }
+    };
+
+    explicit timers_system_basic_t(std::chrono::nanoseconds spin = DEFAULT_SPIN, std::chrono::nanoseconds max_lag = DEFAULT_MAX_LAG);
+
     void tick(std::chrono::nanoseconds duration) override;
+
+    const stats_t& get_stats() const noexcept;
+    void reset_stats() noexcept;
+
+private:
+    const std::chrono::nanoseconds spin;
+    const std::chrono::nanoseconds max_lag;
+
+    // the first tick starts the schedule
+    std::chrono::steady_clock::time_point deadline{};
+    stats_t stats;
 };
 
 } // namespace chip8
@@ -1,14 +0,0 @@
-#include "timers_instant.h"
-
-#include <iostream>
-#include <sstream>
-#include <thread>
-
-#include <core/vm.h>
-
-
-namespace chip8 {
-
-void timers_system_instant_t::tick(std::chrono::nanoseconds) {}
-
-} // namespace chip8
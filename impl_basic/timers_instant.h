@@ -1,6 +1,7 @@
 #pragma once
 
 #include <chrono>
+#include <cstdint>
 
 #include <core/common.h>
 #include <core/iface/timers.h>
@@ -8,8 +9,10 @@
 
 namespace chip8 {
 
+// inline, so static_vm_t could compile the calls away
 struct timers_system_instant_t : timers_system_iface_t {
-    void tick(std::chrono::nanoseconds) override;
+    void tick(std::chrono::nanoseconds) override {}
+    void tick_many(std::chrono::nanoseconds, uint64_t) override {}
 };
 
 } // namespace chip8
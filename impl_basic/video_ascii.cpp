@@ -6,20 +6,37 @@
 
 namespace chip8 {
 
-void video_system_ascii_t::render(const video_memory_t& video_memory) {
+namespace {
+
+// by the bits of XO-CHIP planes
+constexpr char PIXEL_COLORS[1 << VIDEO_PLANES] = {'.', '#', '+', '%'};
+
+} // namespace
+
+void video_system_ascii_t::render(const video_memory_t& video_memory, const video_rows_t& dirty_rows) {
     std::stringstream frame;
-    frame << "\033[2J\033[1;1H";
 
-    frame << "\n";
-    
-    for (size_t i = 0; i < VIDEO_HEIGHT; ++i) {
-        for (size_t j = 0; j < VIDEO_WIDTH; ++j) {
-            frame << (video_memory[i][j] ? '#' : '.');
+    // the whole screen is drawn once and after every switch of resolution, then only rows, that changed
+    const bool full = !screen_drawn || video_memory.hires != screen_hires;
+    if (full) {
+        frame << "\033[2J";
+        screen_drawn = true;
+        screen_hires = video_memory.hires;
+    }
+
+    for (size_t i = 0; i < video_memory.height(); ++i) {
+        if (!full && !dirty_rows.test(i)) {
+            continue;
+        }
+
+        // the first line of the terminal is left empty
+        frame << "\033[" << i + 2 << ";1H";
+        for (size_t j = 0; j < video_memory.width(); ++j) {
+            frame << PIXEL_COLORS[video_memory.get_color(i, j)];
         }
-        frame << '\n';
     }
 
-    frame << "\n\n";
+    frame << "\033[" << video_memory.height() + 4 << ";1H";
 
     frame << "info:\n";
     static size_t frame_counter = 0;
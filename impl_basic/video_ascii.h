@@ -8,9 +8,13 @@
 namespace chip8 {
 
 struct video_system_ascii_t : video_system_iface_t {
-    virtual void render(const video_memory_t& video_memory) override;
+    virtual void render(const video_memory_t& video_memory, const video_rows_t& dirty_rows) override;
 
     virtual ~video_system_ascii_t() override = default;
+
+private:
+    bool screen_drawn = false;
+    bool screen_hires = false;
 };
 
 } // namespace chip8
@@ -1,11 +0,0 @@
-#include "video_none.h"
-
-#include <iostream>
-#include <sstream>
-
-
-namespace chip8 {
-
-void video_system_none_t::render(const video_memory_t&) {}
-
-} // namespace chip8
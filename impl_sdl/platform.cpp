@@ -2,6 +2,9 @@
 
 #include <SDL2/SDL_events.h>
 
+#include <algorithm>
+#include <array>
+#include <cstring>
 #include <iostream>
 #include <optional>
 #include <sstream>
@@ -11,13 +14,68 @@
 
 namespace chip8::sdl {
 
-sdl_system_facade_t::sdl_system_facade_t() {
+namespace {
+
+using byte_pixels_t = std::array<uint32_t, 8>;
+
+// ARGB pixels of every byte of a row, so row is expanded by 8 copies of 32 bytes
+constexpr std::array<byte_pixels_t, 256> make_byte_pixels() {
+    std::array<byte_pixels_t, 256> table{};
+    for (size_t byte = 0; byte < table.size(); ++byte) {
+        for (size_t bit = 0; bit < 8; ++bit) {
+            table[byte][bit] = ((byte >> (7 - bit)) & 0x1) ? sdl_system_facade_t::PIXEL_ON : sdl_system_facade_t::PIXEL_OFF;
+        }
+    }
+    return table;
+}
+
+inline constexpr auto BYTE_PIXELS = make_byte_pixels();
+
+// words of the row, that are on the screen; colors of other planes than the first one take a pixel at a time
+void expand_row(const video_memory_t& video_memory, size_t row, uint32_t* pixels) noexcept {
+    constexpr auto BITS = video_memory_t::WORD_BITS;
+    for (size_t word = 0; word < video_memory.width() / BITS; ++word) {
+        bool single_plane = true;
+        for (size_t plane = 1; plane < VIDEO_PLANES; ++plane) {
+            single_plane = single_plane && video_memory.planes[plane][row][word] == 0;
+        }
+
+        auto* word_pixels = pixels + word * BITS;
+        if (single_plane) {
+            const auto bits = video_memory.planes[0][row][word];
+            for (size_t byte = 0; byte < BITS / 8; ++byte) {
+                const auto byte_bits = static_cast<uint8_t>(bits >> (BITS - 8 * (byte + 1)));
+                std::memcpy(word_pixels + 8 * byte, BYTE_PIXELS[byte_bits].data(), sizeof(byte_pixels_t));
+            }
+            continue;
+        }
+
+        for (size_t bit = 0; bit < BITS; ++bit) {
+            word_pixels[bit] = sdl_system_facade_t::PIXEL_COLORS[video_memory.get_color(row, word * BITS + bit)];
+        }
+    }
+}
+
+void check_sdl_call(int err_code, const char* name) {
+    if (err_code != 0) {
+        std::stringstream error;
+        error << name << " error: " << SDL_GetError() << std::endl;
+        throw std::runtime_error(error.str());
+    }
+}
+
+} // namespace
+
+
+sdl_system_facade_t::sdl_system_facade_t(bool vsync, sound_system_stream_t::settings_t audio)
+    : sound_system_sdl_t(audio)
+{
     if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_NOPARACHUTE) < 0) {
         std::cerr << "SDL could not initialize! SDL_Error: " << SDL_GetError() << std::endl;
         std::exit(EXIT_FAILURE);
     }
 
-    window = SDL_CreateWindow("CHIP-8", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, VIDEO_WIDTH * PIXEL_SIZE, VIDEO_HEIGHT * PIXEL_SIZE, SDL_WINDOW_SHOWN);
+    window = SDL_CreateWindow("CHIP-8", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, LORES_VIDEO_WIDTH * PIXEL_SIZE, LORES_VIDEO_HEIGHT * PIXEL_SIZE, SDL_WINDOW_SHOWN);
 
     if (window == nullptr) {
         std::stringstream error;
@@ -25,7 +83,11 @@ sdl_system_facade_t::sdl_system_facade_t() {
         throw std::runtime_error(error.str());
     }
 
-    renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
+    renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED | (vsync ? SDL_RENDERER_PRESENTVSYNC : 0));
+    if (renderer == nullptr) {
+        // no gpu, e.g. SDL_VIDEODRIVER=dummy
+        renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_SOFTWARE);
+    }
 
     if (renderer == nullptr) {
         std::stringstream error;
@@ -34,34 +96,58 @@ sdl_system_facade_t::sdl_system_facade_t() {
         throw std::runtime_error(error.str());
     }
 
+    texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, VIDEO_WIDTH, VIDEO_HEIGHT);
+
+    if (texture == nullptr) {
+        std::stringstream error;
+        error << "Texture could not be created! SDL_Error: " << SDL_GetError() << std::endl;
+        SDL_DestroyRenderer(renderer);
+        SDL_DestroyWindow(window);
+        throw std::runtime_error(error.str());
+    }
+
     ui_thread = std::thread(&sdl_system_facade_t::ui_thread_func, this);
 }
 
-void sdl_system_facade_t::render(const video_memory_t& video_memory) {
-    for (size_t i = 0; i < VIDEO_HEIGHT; ++i) {
-        for (size_t j = 0; j < VIDEO_WIDTH; ++j) {
-            SDL_Rect rect{
-                .x = static_cast<int>(j * PIXEL_SIZE),
-                .y = static_cast<int>(i * PIXEL_SIZE),
-                .w = PIXEL_SIZE,
-                .h = PIXEL_SIZE
-            };
-
-            if (video_memory[i][j]) {
-                SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
-            } else {
-                SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
-            }
-            auto err_code = SDL_RenderFillRect(renderer, &rect);
+void sdl_system_facade_t::render(const video_memory_t& video_memory, const video_rows_t& dirty_rows) {
+    // screen of the other resolution is drawn anew
+    if (video_memory.hires != texture_hires) {
+        texture_hires = video_memory.hires;
+        texture_filled = false;
+    }
 
-            if (err_code != 0) {
-                std::stringstream error;
-                error << "SDL_RenderFillRect error: " << SDL_GetError() << std::endl;
-                throw std::runtime_error(error.str());
-            }
+    // pixels keep the previous frame, only changed rows are expanded and uploaded
+    const auto width = video_memory.width();
+    const auto height = video_memory.height();
+    size_t first_row = height;
+    size_t last_row = 0;
+    for (size_t i = 0; i < height; ++i) {
+        if (texture_filled && !dirty_rows.test(i)) {
+            continue;
         }
+        expand_row(video_memory, i, pixels.data() + i * VIDEO_WIDTH);
+        first_row = std::min(first_row, i);
+        last_row = i;
+    }
+    texture_filled = true;
+
+    if (first_row < height) {
+        const SDL_Rect rows{
+            .x = 0,
+            .y = static_cast<int>(first_row),
+            .w = static_cast<int>(width),
+            .h = static_cast<int>(last_row - first_row + 1)
+        };
+        check_sdl_call(
+            SDL_UpdateTexture(texture, &rows, pixels.data() + first_row * VIDEO_WIDTH, VIDEO_WIDTH * sizeof(uint32_t)),
+            "SDL_UpdateTexture"
+        );
     }
 
+    // back buffer is undefined after SDL_RenderPresent, the whole screen is copied every frame;
+    // low resolution takes the top left quarter of the texture
+    const SDL_Rect screen{.x = 0, .y = 0, .w = static_cast<int>(width), .h = static_cast<int>(height)};
+    check_sdl_call(SDL_RenderCopy(renderer, texture, &screen, nullptr), "SDL_RenderCopy");
     SDL_RenderPresent(renderer);
 }
 
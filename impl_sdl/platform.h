@@ -1,6 +1,8 @@
 #pragma once
 
+#include <array>
 #include <atomic>
+#include <cstdint>
 #include <condition_variable>
 #include <mutex>
 #include <optional>
@@ -15,7 +17,8 @@
 
 #include <impl_basic/random_crand.h>
 #include <impl_basic/timers_basic.h>
-#include <impl_basic/sound_none.h>
+
+#include <impl_sdl/sound_sdl.h>
 
 
 namespace chip8::sdl {
@@ -24,8 +27,12 @@ struct sdl_system_facade_t : video_system_iface_t,
                              keyboard_system_iface_t,
                              timers_system_basic_t,
                              random_system_crand_t,
-                             sound_system_none_t {
+                             sound_system_sdl_t {
     static inline constexpr int PIXEL_SIZE = 16;
+    static inline constexpr uint32_t PIXEL_ON = 0xFFFFFFFF;   // ARGB
+    static inline constexpr uint32_t PIXEL_OFF = 0xFF000000;
+    // by the bits of XO-CHIP planes
+    static inline constexpr uint32_t PIXEL_COLORS[1 << VIDEO_PLANES] = {PIXEL_OFF, PIXEL_ON, 0xFFAAAAAA, 0xFF555555};
 
     // keymap
     // 1 2 3 4
@@ -83,15 +90,19 @@ struct sdl_system_facade_t : video_system_iface_t,
         throw std::runtime_error("invalid key");
     }
 
-    sdl_system_facade_t();
+    // vsync makes every present wait for the display, renderer falls back to software one, if there is no accelerated;
+    // audio latency is the most of sound, that waits in the ring for the device
+    explicit sdl_system_facade_t(bool vsync = false, sound_system_stream_t::settings_t audio = {});
 
     virtual ~sdl_system_facade_t() override {
+        close_audio();
+        SDL_DestroyTexture(texture);
         SDL_DestroyRenderer(renderer);
         SDL_DestroyWindow(window);
         SDL_Quit();
     }
 
-    virtual void render(const video_memory_t& video_memory) override;
+    virtual void render(const video_memory_t& video_memory, const video_rows_t& dirty_rows) override;
 
     virtual bool is_pressed(keyboard_key_t key) override;
 
@@ -102,6 +113,12 @@ struct sdl_system_facade_t : video_system_iface_t,
     SDL_Window* window = nullptr;
     SDL_Renderer* renderer = nullptr;
 
+    // screen, expanded to ARGB, it is scaled to the window by the renderer
+    SDL_Texture* texture = nullptr;
+    std::array<uint32_t, VIDEO_SIZE> pixels{};
+    bool texture_filled = false;
+    bool texture_hires = false;
+
     std::thread ui_thread;
 
     std::array<std::atomic<bool>, KEYPAD_SIZE> key_pressed;
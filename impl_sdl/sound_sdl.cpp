@@ -0,0 +1,55 @@
+#include "sound_sdl.h"
+
+#include <iostream>
+
+
+namespace chip8::sdl {
+
+sound_system_sdl_t::sound_system_sdl_t(settings_t settings, uint16_t buffer_samples)
+    : sound_system_stream_t(settings)
+{
+    // without audio the emulator still runs: device stays 0 and nothing drains the ring, it only drops samples
+    if (SDL_InitSubSystem(SDL_INIT_AUDIO) < 0) {
+        std::cerr << "SDL audio could not initialize, sound is off! SDL_Error: " << SDL_GetError() << std::endl;
+        return;
+    }
+
+    SDL_AudioSpec desired{};
+    desired.freq = static_cast<int>(get_sample_rate());
+    desired.format = AUDIO_S16SYS;
+    desired.channels = 1;
+    desired.samples = buffer_samples;
+    desired.callback = &sound_system_sdl_t::audio_callback;
+    desired.userdata = this;
+
+    // no changes allowed, SDL converts to the format of the device itself
+    device = SDL_OpenAudioDevice(nullptr, 0, &desired, nullptr, 0);
+    if (device == 0) {
+        std::cerr << "Audio device could not be opened, sound is off! SDL_Error: " << SDL_GetError() << std::endl;
+        SDL_QuitSubSystem(SDL_INIT_AUDIO);
+        return;
+    }
+
+    SDL_PauseAudioDevice(device, 0);
+}
+
+sound_system_sdl_t::~sound_system_sdl_t() {
+    close_audio();
+}
+
+void sound_system_sdl_t::close_audio() noexcept {
+    if (device == 0) {
+        return;
+    }
+    SDL_CloseAudioDevice(device);
+    SDL_QuitSubSystem(SDL_INIT_AUDIO);
+    device = 0;
+}
+
+void sound_system_sdl_t::audio_callback(void* userdata, Uint8* stream, int len) {
+    // audio thread of SDL, never blocks
+    auto* self = static_cast<sound_system_sdl_t*>(userdata);
+    self->drain(reinterpret_cast<int16_t*>(stream), static_cast<size_t>(len) / sizeof(int16_t));
+}
+
+} // namespace chip8::sdl
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstdint>
+
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_audio.h>
+
+#include <impl_basic/sound_stream.h>
+
+
+namespace chip8::sdl {
+
+/**
+ * Sound through an SDL audio device: its callback drains the ring of sound_system_stream_t.
+ * Any SDL audio driver works, SDL_AUDIODRIVER=dummy or disk run it on machines without a sound card.
+ * If audio can not be opened at all, the error is logged and sound is silent.
+ */
+struct sound_system_sdl_t : sound_system_stream_t {
+    // samples of one callback, a part of the latency, device asks for them at once
+    static inline constexpr uint16_t DEFAULT_BUFFER_SAMPLES = 512;
+
+    explicit sound_system_sdl_t(settings_t settings = {}, uint16_t buffer_samples = DEFAULT_BUFFER_SAMPLES);
+
+    virtual ~sound_system_sdl_t() override;
+
+    // stops the callback, before SDL is quit by the owner; called by the destructor as well
+    void close_audio() noexcept;
+
+private:
+    static void audio_callback(void* userdata, Uint8* stream, int len);
+
+    SDL_AudioDeviceID device = 0;
+};
+
+} // namespace chip8::sdl
@@ -0,0 +1,481 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <core/common.h>
+#include <core/fault.h>
+#include <core/quirks.h>
+#include <core/rom_library.h>
+#include <core/vm.h>
+
+#include <impl_basic/keyboard_queue.h>
+#include <impl_basic/sound_none.h>
+#include <impl_basic/timers_instant.h>
+#include <impl_basic/video_none.h>
+
+
+/**
+ * Golden-image regression runner: every entry of the manifest is a rom, run headless for a number of frames
+ * with scripted input, and the hash of its screen after the last frame. Entries run in parallel, one vm per entry.
+ *
+ * Manifest is text, one entry per line, '#' starts a comment:
+ *   <name> <rom> <profile> <frames> <input> <expected>
+ * - rom is relative to the manifest
+ * - profile is the emulator type chip8, schip, xochip or rom (by the rom library), with optional quirks after '/':
+ *   chip8 or schip, e.g. xochip/chip8
+ * - input is '-' or comma separated <frame>:<keys>, keys are a hex mask of keys, that are held from that frame on
+ * - expected is a hex hash of the screen, '-' if there is none yet
+ *
+ * With --traces every entry has <name>.trace in that directory, the hash of the screen after every frame,
+ * so a mismatch is reported with the first frame, that diverges. --update rewrites the manifest and traces
+ * with the actual hashes once, after all entries have run.
+ */
+
+namespace {
+
+using settings_t = chip8::vm_t::settings_t;
+
+inline constexpr const char* USAGE = "<manifest> [--jobs N] [--engine interpreter|jit|block_cache|threaded] [--traces DIR] [--update]";
+
+struct key_event_t {
+    uint64_t frame = 0;
+    uint16_t keys = 0;
+};
+
+struct entry_t {
+    std::string name;
+    std::string rom;
+    std::string profile;
+    uint64_t frames = 0;
+    std::string input;
+    std::optional<uint64_t> expected;
+
+    // parsed rom, profile and input
+    std::filesystem::path rom_path;
+    bool rom_type = false;
+    settings_t::emulator_type_t emulator_type = settings_t::CHIP_8;
+    std::optional<chip8::quirks_t> quirks;
+    std::vector<key_event_t> script;
+
+    // of the entry in the manifest and its comment, for updates
+    size_t line = 0;
+    std::string comment;
+};
+
+struct result_t {
+    uint64_t frames = 0;
+    // of the screen after the last frame
+    uint64_t hash = 0;
+    // after every frame, only for traces
+    std::vector<uint64_t> frame_hashes;
+    chip8::fault_t fault;
+    std::string error;
+};
+
+struct options_t {
+    std::filesystem::path manifest;
+    size_t jobs = std::max(1u, std::thread::hardware_concurrency());
+    settings_t::engine_t engine = settings_t::INTERPRETER;
+    std::optional<std::filesystem::path> traces;
+    bool update = false;
+};
+
+// the same sequence in every run, so images do not depend on the host
+struct random_lcg_t : chip8::random_system_iface_t {
+    uint8_t get_random_byte() override {
+        state = state * 1103515245 + 12345;
+        return static_cast<uint8_t>(state >> 16);
+    }
+
+    uint32_t state = 1;
+};
+
+std::string to_hex(uint64_t value) {
+    std::stringstream hex;
+    hex << std::hex << std::setw(16) << std::setfill('0') << value;
+    return hex.str();
+}
+
+// FNV-1a of all planes a word at a time, and the resolution
+uint64_t hash_screen(const chip8::video_memory_t& video_memory) noexcept {
+    uint64_t hash = 0xCBF29CE484222325;
+    for (const auto& plane : video_memory.planes) {
+        for (const auto& row : plane) {
+            for (auto word : row) {
+                hash = (hash ^ word) * 0x100000001B3;
+            }
+        }
+    }
+    return hash ^ static_cast<uint64_t>(video_memory.hires);
+}
+
+void parse_profile(entry_t& entry) {
+    const auto slash = entry.profile.find('/');
+    const auto type = std::string_view(entry.profile).substr(0, slash);
+    if (type == "chip8") {
+        entry.emulator_type = settings_t::CHIP_8;
+    } else if (type == "schip") {
+        entry.emulator_type = settings_t::SCHIP1_1;
+    } else if (type == "xochip") {
+        entry.emulator_type = settings_t::XO_CHIP;
+    } else if (type == "rom") {
+        entry.rom_type = true;
+    } else {
+        throw std::runtime_error("unknown emulator type: " + std::string(type));
+    }
+
+    if (slash == std::string::npos) {
+        return;
+    }
+    const auto quirks = std::string_view(entry.profile).substr(slash + 1);
+    if (quirks == "chip8") {
+        entry.quirks = chip8::CHIP_8_QUIRKS;
+    } else if (quirks == "schip") {
+        entry.quirks = chip8::SCHIP_QUIRKS;
+    } else {
+        throw std::runtime_error("unknown quirks: " + std::string(quirks));
+    }
+}
+
+void parse_input(entry_t& entry) {
+    if (entry.input == "-") {
+        return;
+    }
+    std::stringstream input(entry.input);
+    std::string event;
+    while (std::getline(input, event, ',')) {
+        const auto colon = event.find(':');
+        if (colon == std::string::npos) {
+            throw std::runtime_error("invalid input event: " + event);
+        }
+        entry.script.push_back({
+            .frame = std::stoull(event.substr(0, colon)),
+            .keys = static_cast<uint16_t>(std::stoul(event.substr(colon + 1), nullptr, 16)),
+        });
+    }
+    std::stable_sort(entry.script.begin(), entry.script.end(), [](const auto& a, const auto& b) {
+        return a.frame < b.frame;
+    });
+}
+
+std::vector<entry_t> read_manifest(const std::filesystem::path& path, std::vector<std::string>& lines) {
+    std::ifstream file(path);
+    if (!file.is_open()) {
+        throw std::runtime_error("failed to open manifest: " + path.string());
+    }
+
+    std::vector<entry_t> entries;
+    for (std::string line; std::getline(file, line);) {
+        lines.push_back(line);
+        const auto comment = line.find('#');
+        std::stringstream fields(line.substr(0, comment));
+
+        entry_t entry;
+        std::string frames;
+        std::string expected;
+        if (!(fields >> entry.name)) {
+            continue;
+        }
+        if (!(fields >> entry.rom >> entry.profile >> frames >> entry.input >> expected)) {
+            throw std::runtime_error("manifest line " + std::to_string(lines.size()) + ": expected 6 fields");
+        }
+
+        entry.rom_path = path.parent_path() / entry.rom;
+        entry.frames = std::stoull(frames);
+        if (expected != "-") {
+            entry.expected = std::stoull(expected, nullptr, 16);
+        }
+        entry.line = lines.size() - 1;
+        if (comment != std::string::npos) {
+            entry.comment = line.substr(comment);
+        }
+        parse_profile(entry);
+        parse_input(entry);
+        entries.push_back(std::move(entry));
+    }
+    return entries;
+}
+
+std::optional<std::vector<uint64_t>> read_trace(const std::filesystem::path& path) {
+    std::ifstream file(path);
+    if (!file.is_open()) {
+        return std::nullopt;
+    }
+    std::vector<uint64_t> hashes;
+    for (std::string line; std::getline(file, line);) {
+        hashes.push_back(std::stoull(line, nullptr, 16));
+    }
+    return hashes;
+}
+
+void write_trace(const std::filesystem::path& path, const std::vector<uint64_t>& hashes) {
+    std::ofstream file(path, std::ios::out | std::ios::trunc);
+    for (auto hash : hashes) {
+        file << to_hex(hash) << '\n';
+    }
+}
+
+// the whole manifest at once, through a temporary file, so an interrupted update leaves the old one
+void write_manifest(const std::filesystem::path& path, const std::vector<std::string>& lines) {
+    auto temporary = path;
+    temporary += ".tmp";
+    {
+        std::ofstream file(temporary, std::ios::out | std::ios::trunc);
+        for (const auto& line : lines) {
+            file << line << '\n';
+        }
+    }
+    std::filesystem::rename(temporary, path);
+}
+
+// `traced` keeps the hash of every frame, otherwise only the last screen is hashed
+result_t run_entry(const entry_t& entry, const chip8::rom_t& rom, settings_t::engine_t engine, bool traced) {
+    chip8::keyboard_system_queue_t keyboard_system;
+    chip8::timers_system_instant_t timers_system;
+    chip8::video_system_none_t video_system;
+    random_lcg_t random_system;
+    chip8::sound_system_none_t sound_system;
+
+    auto settings = rom.apply_profile({.engine = engine});
+    if (!entry.rom_type) {
+        settings.emulator_type = entry.emulator_type;
+    }
+    if (entry.quirks) {
+        settings.quirks = entry.quirks;
+    }
+
+    chip8::vm_t vm(std::move(settings), keyboard_system, timers_system, video_system, random_system, sound_system);
+    vm.load_data(chip8::CHIP8_STANDARD_FONTSET_VIEW, 0);
+    vm.load_data(rom.data, chip8::ROM_OFFSET);
+
+    result_t result;
+    if (traced) {
+        result.frame_hashes.reserve(entry.frames);
+    }
+
+    uint16_t keys = 0;
+    auto event = entry.script.begin();
+    for (uint64_t frame = 0; frame < entry.frames; ++frame) {
+        // presses are queued for LD_VX_K as well
+        for (; event != entry.script.end() && event->frame <= frame; ++event) {
+            for (uint8_t key = 0; key < chip8::KEYPAD_SIZE; ++key) {
+                const bool pressed = (event->keys >> key) & 0x1;
+                if (pressed != static_cast<bool>((keys >> key) & 0x1)) {
+                    pressed ? keyboard_system.press(static_cast<chip8::keyboard_key_t>(key)) : keyboard_system.release(static_cast<chip8::keyboard_key_t>(key));
+                }
+            }
+            keys = event->keys;
+        }
+
+        // waiting for a key takes the rest of the frame, the script goes on
+        const auto fault = vm.emulate_frames(1);
+        if (fault.kind == chip8::fault_kind_t::KEY_WAIT) {
+            vm.advance_timers(vm.instructions_until_tick());
+        } else if (fault) {
+            result.fault = fault;
+            break;
+        }
+        ++result.frames;
+        if (traced) {
+            result.frame_hashes.push_back(hash_screen(vm.video_memory));
+        }
+    }
+
+    result.hash = hash_screen(vm.video_memory);
+    return result;
+}
+
+std::optional<settings_t::engine_t> parse_engine(std::string_view name) {
+    if (name == "interpreter") {
+        return settings_t::INTERPRETER;
+    }
+    if (name == "jit") {
+        return settings_t::JIT;
+    }
+    if (name == "block_cache") {
+        return settings_t::BLOCK_CACHE;
+    }
+    if (name == "threaded") {
+        return settings_t::THREADED;
+    }
+    return std::nullopt;
+}
+
+std::optional<options_t> parse_options(int argc, char** argv) {
+    if (argc < 2) {
+        return std::nullopt;
+    }
+
+    options_t options;
+    options.manifest = argv[1];
+    for (int i = 2; i < argc; ++i) {
+        const auto arg = std::string_view(argv[i]);
+        const bool has_value = i + 1 < argc;
+        if (arg == "--jobs" && has_value) {
+            options.jobs = std::max<size_t>(1, std::stoul(argv[++i]));
+        } else if (arg == "--engine" && has_value) {
+            const auto engine = parse_engine(argv[++i]);
+            if (!engine) {
+                return std::nullopt;
+            }
+            options.engine = *engine;
+        } else if (arg == "--traces" && has_value) {
+            options.traces = argv[++i];
+        } else if (arg == "--update") {
+            options.update = true;
+        } else {
+            return std::nullopt;
+        }
+    }
+    return options;
+}
+
+int run(const options_t& options) {
+    std::vector<std::string> lines;
+    auto entries = read_manifest(options.manifest, lines);
+
+    // roms are mapped once, entries with the same image share it
+    chip8::rom_library_t library;
+    std::vector<const chip8::rom_t*> roms(entries.size(), nullptr);
+    std::vector<result_t> results(entries.size());
+    for (size_t i = 0; i < entries.size(); ++i) {
+        try {
+            roms[i] = &library.add_file(entries[i].rom_path);
+        } catch (const std::exception& e) {
+            results[i].error = e.what();
+        }
+    }
+
+    // workers take the next entry, until there are none left
+    const auto start = std::chrono::steady_clock::now();
+    std::atomic<size_t> next{0};
+    auto worker = [&] {
+        for (size_t i = next.fetch_add(1); i < entries.size(); i = next.fetch_add(1)) {
+            if (roms[i] == nullptr) {
+                continue;
+            }
+            try {
+                results[i] = run_entry(entries[i], *roms[i], options.engine, options.traces.has_value());
+            } catch (const std::exception& e) {
+                results[i].error = e.what();
+            }
+        }
+    };
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < std::min(options.jobs, entries.size()); ++i) {
+        workers.emplace_back(worker);
+    }
+    for (auto& thread : workers) {
+        thread.join();
+    }
+    const auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start);
+
+    size_t passed = 0;
+    size_t mismatched = 0;
+    size_t failed = 0;
+    size_t updated = 0;
+    uint64_t frames = 0;
+    std::vector<std::pair<std::filesystem::path, const std::vector<uint64_t>*>> trace_updates;
+    for (size_t i = 0; i < entries.size(); ++i) {
+        auto& entry = entries[i];
+        const auto& result = results[i];
+        frames += result.frames;
+
+        if (!result.error.empty() || result.fault) {
+            ++failed;
+            std::cout << "FAILED " << entry.name << ": ";
+            if (!result.error.empty()) {
+                std::cout << result.error << std::endl;
+            } else {
+                std::cout << "fault after " << result.frames << " frames" << std::endl << result.fault.describe() << std::endl;
+            }
+            continue;
+        }
+
+        const auto trace_path = options.traces ? std::optional(*options.traces / (entry.name + ".trace")) : std::nullopt;
+        const auto trace = trace_path ? read_trace(*trace_path) : std::nullopt;
+
+        if (entry.expected == result.hash && (!trace || *trace == result.frame_hashes)) {
+            ++passed;
+            // traces of a manifest, that passes, are created by the first update with --traces
+            if (options.update && trace_path && !trace) {
+                trace_updates.emplace_back(*trace_path, &result.frame_hashes);
+            }
+            continue;
+        }
+
+        if (entry.expected) {
+            ++mismatched;
+            std::cout << "MISMATCH " << entry.name << ": expected " << to_hex(*entry.expected) << ", got " << to_hex(result.hash);
+            if (trace) {
+                const auto diverged = std::mismatch(trace->begin(), trace->end(), result.frame_hashes.begin(), result.frame_hashes.end());
+                std::cout << ", first diverging frame " << (diverged.second - result.frame_hashes.begin());
+            }
+            std::cout << std::endl;
+        } else {
+            std::cout << "NEW " << entry.name << ": " << to_hex(result.hash) << std::endl;
+        }
+
+        // updates are only collected here, files are written once below
+        if (options.update) {
+            ++updated;
+            std::stringstream line;
+            line << entry.name << ' ' << entry.rom << ' ' << entry.profile << ' ' << entry.frames << ' ' << entry.input << ' ' << to_hex(result.hash);
+            if (!entry.comment.empty()) {
+                line << ' ' << entry.comment;
+            }
+            lines[entry.line] = line.str();
+            if (trace_path) {
+                trace_updates.emplace_back(*trace_path, &result.frame_hashes);
+            }
+        }
+    }
+
+    if (updated > 0) {
+        write_manifest(options.manifest, lines);
+    }
+    for (const auto& [path, hashes] : trace_updates) {
+        write_trace(path, *hashes);
+    }
+
+    std::cout << entries.size() << " entries: " << passed << " passed, " << mismatched << " mismatched, " << failed << " failed";
+    if (options.update) {
+        std::cout << ", " << updated << " updated";
+    }
+    std::cout << std::endl;
+    std::cout << library.roms().size() << " unique roms, " << frames << " frames in " << std::fixed << std::setprecision(3)
+              << elapsed.count() << " s on " << options.jobs << " jobs, "
+              << std::setprecision(0) << (elapsed.count() > 0 ? static_cast<double>(frames) / elapsed.count() : 0.0) << " frames/s" << std::endl;
+
+    return failed > 0 || (mismatched > 0 && !options.update) ? 1 : 0;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    const auto options = parse_options(argc, argv);
+    if (!options) {
+        std::cerr << "usage: " << argv[0] << " " << USAGE << std::endl;
+        return 2;
+    }
+
+    try {
+        return run(*options);
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 2;
+    }
+}
@@ -0,0 +1,1236 @@
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <optional>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+
+#include <gtest/gtest.h>
+
+#include <core/audio.h>
+#include <core/common.h>
+#include <core/cycles.h>
+#include <core/dispatch_table.h>
+#include <core/instruction_decoder.h>
+#include <core/instructions.h>
+#include <core/profiler.h>
+#include <core/replay.h>
+#include <core/rewind.h>
+#include <core/rom_library.h>
+#include <core/run_loop.h>
+#include <core/scheduler.h>
+#include <core/spsc_ring.h>
+#include <core/static_vm.h>
+#include <core/vm.h>
+#include <core/vm_batch.h>
+
+#include <impl_basic/keyboard_fake.h>
+#include <impl_basic/keyboard_queue.h>
+#include <impl_basic/sound_capture.h>
+#include <impl_basic/sound_stream.h>
+#include <impl_basic/timers_basic.h>
+#include <impl_basic/timers_instant.h>
+#include <impl_basic/video_none.h>
+#include <impl_basic/sound_none.h>
+
+
+// deterministic, so different vms can be compared
+struct random_mock_t : chip8::random_system_iface_t {
+    uint8_t get_random_byte() override {
+        if (!fixed) {
+            state = state * 1103515245 + 12345;
+        }
+        return static_cast<uint8_t>(state >> 16);
+    }
+
+    uint32_t state = 1;
+    // same byte every time, for vms, that share one random system and have to match separate ones
+    bool fixed = false;
+};
+
+// remembers presented frames
+struct video_mock_t : chip8::video_system_none_t {
+    void render(const chip8::video_memory_t& video_memory, const chip8::video_rows_t& dirty_rows) override {
+        ++frames;
+        last_frame = video_memory;
+        last_dirty_rows = dirty_rows;
+    }
+
+    size_t frames = 0;
+    chip8::video_memory_t last_frame;
+    chip8::video_rows_t last_dirty_rows;
+};
+
+chip8::bytes_owned to_bytes(const std::vector<uint16_t>& opcodes) {
+    chip8::bytes_owned program;
+    for (auto opcode : opcodes) {
+        program.push_back(static_cast<uint8_t>(opcode >> 8));
+        program.push_back(static_cast<uint8_t>(opcode & 0xFF));
+    }
+    return program;
+}
+
+struct core_env_t {
+    std::unique_ptr<chip8::keyboard_system_fake_t> keyboard_system = std::make_unique<chip8::keyboard_system_fake_t>();
+    std::unique_ptr<chip8::timers_system_instant_t> timers_system = std::make_unique<chip8::timers_system_instant_t>();
+    std::unique_ptr<video_mock_t> video_system = std::make_unique<video_mock_t>();
+    std::unique_ptr<random_mock_t> random_system = std::make_unique<random_mock_t>();
+    std::unique_ptr<chip8::sound_system_none_t> sound_system = std::make_unique<chip8::sound_system_none_t>();
+
+    chip8::vm_t vm;
+
+    core_env_t(chip8::vm_t::settings_t settings = {})
+        : vm(
+            std::move(settings),
+            *keyboard_system,
+            *timers_system,
+            *video_system,
+            *random_system,
+            *sound_system
+        )
+    {
+        vm.load_data(chip8::CHIP8_STANDARD_FONTSET_VIEW, 0);
+    }
+
+    void load_program(const std::vector<uint16_t>& opcodes) {
+        vm.load_data(to_bytes(opcodes), chip8::ROM_OFFSET);
+    }
+};
+
+/**
+ * Random, but well-formed program: jumps and I stay inside first kilobytes of memory,
+ * stores often land on the program itself.
+ */
+std::vector<uint16_t> random_program(uint32_t seed, size_t size = 128) {
+    std::mt19937 gen(seed);
+    auto random = [&gen](uint32_t bound) -> uint16_t { return static_cast<uint16_t>(gen() % bound); };
+
+    std::vector<uint16_t> program;
+    for (size_t i = 0; i < size; ++i) {
+        const uint16_t x = random(16) << 8;
+        const uint16_t y = random(16) << 4;
+        const uint16_t kk = random(256);
+        const uint16_t addr = static_cast<uint16_t>(chip8::ROM_OFFSET + 2 * random(size));
+
+        static constexpr uint16_t ALU_OPS[] = {0x0, 0x1, 0x2, 0x3, 0x4, 0x5, 0x6, 0x7, 0xE};
+        static constexpr uint16_t MISC_OPS[] = {0x07, 0x15, 0x18, 0x29, 0x33, 0x55, 0x65};
+        // CLS and SCHIP/XO-CHIP ones, that are unknown to CHIP-8
+        static constexpr uint16_t DISPLAY_OPS[] = {0x00E0, 0x00E0, 0x00E0, 0x00C3, 0x00FB, 0x00FC, 0x00FE, 0x00FF, 0xF301, 0xF002, 0xF53A};
+
+        switch (random(12)) {
+            case 0: program.push_back(random(8) == 0 ? DISPLAY_OPS[random(std::size(DISPLAY_OPS))] : 0x00EE); break;
+            case 1: program.push_back(static_cast<uint16_t>((random(2) ? 0x1000 : 0x2000) | addr)); break;
+            case 2: program.push_back(static_cast<uint16_t>((0x3000 + 0x1000 * random(2)) | x | kk)); break;
+            case 3: program.push_back(static_cast<uint16_t>((random(2) ? 0x5000 : 0x9000) | x | y)); break;
+            case 4: program.push_back(static_cast<uint16_t>(0x6000 | x | kk)); break;
+            case 5: program.push_back(static_cast<uint16_t>(0x7000 | x | kk)); break;
+            case 6: case 7: program.push_back(static_cast<uint16_t>(0x8000 | x | y | ALU_OPS[random(std::size(ALU_OPS))])); break;
+            case 8: program.push_back(static_cast<uint16_t>(0xA000 | (chip8::ROM_OFFSET + random(0x200)))); break;
+            case 9: program.push_back(static_cast<uint16_t>(random(2) ? 0xB000 | (addr - 0x100) : 0xC000 | x | kk)); break;
+            case 10: program.push_back(static_cast<uint16_t>(0xD000 | x | y | random(16))); break;
+            default: program.push_back(static_cast<uint16_t>(0xF000 | x | MISC_OPS[random(std::size(MISC_OPS))])); break;
+        }
+    }
+    return program;
+}
+
+void expect_same_state(const chip8::vm_t& expected, const chip8::vm_t& actual) {
+    EXPECT_EQ(expected.V, actual.V);
+    EXPECT_EQ(expected.I, actual.I);
+    EXPECT_EQ(expected.pc, actual.pc);
+    EXPECT_EQ(expected.sp, actual.sp);
+    EXPECT_EQ(expected.stack, actual.stack);
+    EXPECT_EQ(expected.delay_timer, actual.delay_timer);
+    EXPECT_EQ(expected.sound_timer, actual.sound_timer);
+    EXPECT_EQ(expected.timers_duration, actual.timers_duration);
+    EXPECT_EQ(expected.frame_cycles, actual.frame_cycles);
+    EXPECT_EQ(expected.vblank, actual.vblank);
+    EXPECT_TRUE(expected.memory == actual.memory);
+    EXPECT_TRUE(expected.video_memory == actual.video_memory);
+    EXPECT_TRUE(expected.audio == actual.audio);
+}
+
+// none of the profiles, so instructions check it at runtime
+inline constexpr chip8::quirks_t CUSTOM_QUIRKS = {
+    .vf_reset = true,
+    .memory_increment = false,
+    .jump_vx = true,
+    .clipping = false,
+    .shifting = true,
+    .display_wait = true,
+};
+
+// runs the same random programs on the interpreter and on the engine, in random slices
+void expect_same_as_interpreter(chip8::vm_t::settings_t::engine_t engine, std::optional<chip8::quirks_t> quirks = std::nullopt) {
+    for (uint32_t seed = 0; seed < 300; ++seed) {
+        const auto type = static_cast<chip8::vm_t::settings_t::emulator_type_t>(seed % 3);
+        const auto program = random_program(seed);
+        // every fourth vm has short frames of cycles instead of durations
+        const uint32_t cycles_per_frame = seed % 4 == 3 ? 7 + seed % 5 : 0;
+
+        core_env_t expected({.emulator_type = type, .quirks = quirks, .cycles_per_frame = cycles_per_frame});
+        core_env_t actual({.emulator_type = type, .engine = engine, .quirks = quirks, .cycles_per_frame = cycles_per_frame});
+        expected.load_program(program);
+        actual.load_program(program);
+
+        std::mt19937 gen(seed);
+        for (size_t slice = 0; slice < 50; ++slice) {
+            const auto count = 1 + gen() % 64;
+            const auto expected_fault = expected.vm.emulate_instructions(count);
+            const auto actual_fault = actual.vm.emulate_instructions(count);
+
+            ASSERT_EQ(expected_fault, actual_fault) << "seed: " << seed;
+            if (expected_fault) {
+                break;
+            }
+        }
+
+        expect_same_state(expected.vm, actual.vm);
+        if (::testing::Test::HasFailure()) {
+            FAIL() << "seed: " << seed;
+        }
+    }
+}
+
+
+TEST(DispatchTableTests, MatchesDecoder) {
+    for (auto type : {chip8::vm_t::settings_t::CHIP_8, chip8::vm_t::settings_t::SCHIP1_1, chip8::vm_t::settings_t::XO_CHIP}) {
+        const auto& table = chip8::get_dispatch_table(type, CUSTOM_QUIRKS);
+
+        for (size_t bytes = 0; bytes < chip8::OPCODES_COUNT; ++bytes) {
+            auto instruction_opt = chip8::decode_instruction(chip8::opcode_t{static_cast<uint16_t>(bytes)}, type);
+            auto expected = instruction_opt
+                ? instruction_opt.value().get().executor
+                : chip8::instructions::UNKNOWN.executor;
+
+            ASSERT_EQ(expected, table[bytes]) << "opcode: " << bytes;
+        }
+    }
+}
+
+TEST(DispatchTableTests, ProfilesMatchRuntimeQuirks) {
+    for (uint32_t seed = 0; seed < 100; ++seed) {
+        const auto type = static_cast<chip8::vm_t::settings_t::emulator_type_t>(seed % 3);
+        const auto program = random_program(seed);
+
+        // the first one runs specialized table of the profile, the second one executors, that read vm.quirks
+        core_env_t expected({.emulator_type = type});
+        core_env_t actual({.emulator_type = type});
+        expected.load_program(program);
+        actual.load_program(program);
+        ASSERT_NE(&chip8::get_dispatch_table(type, CUSTOM_QUIRKS), &actual.vm.dispatch_table);
+
+        for (size_t step = 0; step < 1000; ++step) {
+            const auto opcode = chip8::opcode_t{static_cast<uint16_t>(actual.vm.memory[actual.vm.pc] << 8 | actual.vm.memory[actual.vm.pc + 1u])};
+            const auto instruction_opt = chip8::decode_instruction(opcode, type);
+            if (!instruction_opt) {
+                break;
+            }
+
+            const auto expected_fault = expected.vm.emulate_one_instruction();
+            instruction_opt.value().get().executor(actual.vm, opcode);
+            const auto actual_fault = actual.vm.take_fault();
+
+            ASSERT_EQ(expected_fault, actual_fault) << "seed: " << seed;
+            if (expected_fault) {
+                break;
+            }
+            actual.vm.advance_timers(1);
+        }
+
+        expect_same_state(expected.vm, actual.vm);
+        if (::testing::Test::HasFailure()) {
+            FAIL() << "seed: " << seed;
+        }
+    }
+}
+
+TEST(DispatchTableTests, UnknownOpcodeTraps) {
+    core_env_t env;
+    env.load_program({0x0123});
+
+    const auto fault = env.vm.emulate_one_instruction();
+    EXPECT_EQ(chip8::fault_kind_t::UNKNOWN_OPCODE, fault.kind);
+    EXPECT_EQ(chip8::ROM_OFFSET, fault.pc);
+    EXPECT_EQ(0x0123, fault.opcode.bytes);
+    EXPECT_EQ(chip8::fault_kind_t::NONE, env.vm.fault);
+
+    // pc stays at the trap
+    EXPECT_EQ(fault, env.vm.emulate_instructions(10));
+}
+
+TEST(VideoTests, DrawClipsAndCollides) {
+    core_env_t env;
+    env.load_program({
+        0x603C, // LD V0, 60
+        0x611E, // LD V1, 30
+        0xA20C, // LD I, 0x20C
+        0xD013, // DRW V0, V1, 3
+        0xD013, // DRW V0, V1, 3
+        0x120A, // JP 0x20A
+        0xFF81, // sprite
+        0xFF00,
+    });
+
+    env.vm.emulate_instructions(4);
+    EXPECT_EQ(0, env.vm.V[0xF]);
+    EXPECT_EQ(0xFu, env.vm.video_memory.planes[0][30][0]);
+    EXPECT_EQ(0x8u, env.vm.video_memory.planes[0][31][0]);
+    EXPECT_TRUE(env.vm.video_memory.get_pixel(31, 60));
+    EXPECT_FALSE(env.vm.video_memory.get_pixel(31, 61));
+    // nothing wraps to the top
+    EXPECT_EQ(0u, env.vm.video_memory.planes[0][0][0]);
+
+    env.vm.emulate_instructions(1);
+    EXPECT_EQ(1, env.vm.V[0xF]);
+    EXPECT_EQ(chip8::video_memory_t{}, env.vm.video_memory);
+}
+
+TEST(VideoTests, DrawWrapsAndWaitsForTick) {
+    core_env_t env({.quirks = chip8::quirks_t{.clipping = false, .display_wait = true}});
+    env.load_program({
+        0x603C, // LD V0, 60
+        0x611E, // LD V1, 30
+        0xA208, // LD I, 0x208
+        0xD013, // DRW V0, V1, 3
+        0xFF81, // sprite
+        0xFF00,
+    });
+
+    // no tick happened yet, DRW stays at its pc
+    env.vm.vblank = false;
+    env.vm.emulate_instructions(5);
+    EXPECT_EQ(0x206, env.vm.pc);
+    EXPECT_EQ(chip8::video_memory_t{}, env.vm.video_memory);
+
+    env.vm.vblank = true;
+    env.vm.emulate_instructions(1);
+    EXPECT_EQ(0x208, env.vm.pc);
+    EXPECT_FALSE(env.vm.vblank);
+    EXPECT_TRUE(env.vm.video_memory.get_pixel(30, 63));
+    EXPECT_TRUE(env.vm.video_memory.get_pixel(30, 0));
+    EXPECT_TRUE(env.vm.video_memory.get_pixel(31, 60));
+    EXPECT_TRUE(env.vm.video_memory.get_pixel(31, 3));
+    EXPECT_FALSE(env.vm.video_memory.get_pixel(31, 2));
+    // the third row wraps to the top
+    EXPECT_EQ(0xF00000000000000Fu, env.vm.video_memory.planes[0][0][0]);
+    EXPECT_EQ(0u, env.vm.video_memory.planes[0][1][0]);
+}
+
+TEST(VideoTests, HiresScrollsWholeWords) {
+    core_env_t env({.emulator_type = chip8::vm_t::settings_t::SCHIP1_1});
+    std::vector<uint16_t> program = {
+        0x00FF, // HIGH
+        0x6038, // LD V0, 56
+        0x6100, // LD V1, 0
+        0xA210, // LD I, 0x210
+        0xD010, // DRW V0, V1, 0
+        0x00C2, // SCD 2
+        0x00FB, // SCR
+        0x120E, // JP 0x20E
+        0xFFFF, // 16x16 sprite
+        0x8001,
+    };
+    program.resize(program.size() + 14);
+    env.load_program(program);
+
+    // the sprite crosses the boundary of words
+    env.vm.emulate_instructions(5);
+    EXPECT_EQ(0, env.vm.V[0xF]);
+    EXPECT_EQ(128u, env.vm.video_memory.width());
+    EXPECT_EQ((chip8::video_memory_t::row_t{0xFF, 0xFF00000000000000}), env.vm.video_memory.planes[0][0]);
+    EXPECT_EQ((chip8::video_memory_t::row_t{0x80, 0x0100000000000000}), env.vm.video_memory.planes[0][1]);
+
+    env.vm.emulate_instructions(2);
+    EXPECT_EQ(chip8::video_memory_t::row_t{}, env.vm.video_memory.planes[0][0]);
+    EXPECT_EQ(chip8::video_memory_t::row_t{}, env.vm.video_memory.planes[0][1]);
+    EXPECT_EQ((chip8::video_memory_t::row_t{0xF, 0xFFF0000000000000}), env.vm.video_memory.planes[0][2]);
+    EXPECT_EQ((chip8::video_memory_t::row_t{0x8, 0x0010000000000000}), env.vm.video_memory.planes[0][3]);
+
+    // CHIP-8 does not know SCHIP opcodes
+    core_env_t chip8_env;
+    chip8_env.load_program({0x00FF});
+    EXPECT_EQ(chip8::fault_kind_t::UNKNOWN_OPCODE, chip8_env.vm.emulate_one_instruction().kind);
+}
+
+TEST(VideoTests, DrawsOnSelectedPlanes) {
+    core_env_t env({.emulator_type = chip8::vm_t::settings_t::XO_CHIP});
+    env.load_program({
+        0xF301, // PLANE 3
+        0xA20C, // LD I, 0x20C
+        0xD001, // DRW V0, V0, 1
+        0xF201, // PLANE 2
+        0x00E0, // CLS
+        0x120A, // JP 0x20A
+        0xF00F, // sprites of both planes
+    });
+
+    // every plane takes the next sprite
+    env.vm.emulate_instructions(3);
+    EXPECT_EQ(1, env.vm.video_memory.get_color(0, 0));
+    EXPECT_EQ(2, env.vm.video_memory.get_color(0, 4));
+    EXPECT_EQ(0, env.vm.video_memory.get_color(0, 8));
+
+    // only the selected plane is cleared
+    env.vm.emulate_instructions(2);
+    EXPECT_EQ(1, env.vm.video_memory.get_color(0, 0));
+    EXPECT_EQ(0, env.vm.video_memory.get_color(0, 4));
+
+    // the only selected plane takes the first sprite
+    env.vm.pc = 0x204;
+    env.vm.emulate_instructions(1);
+    EXPECT_EQ(3, env.vm.video_memory.get_color(0, 0));
+    EXPECT_EQ(0, env.vm.video_memory.get_color(0, 4));
+}
+
+TEST(VideoTests, PresentsChangedRowsOncePerTick) {
+    core_env_t env({.timer_duration = std::chrono::milliseconds(10), .op_duration = std::chrono::milliseconds(1)});
+    env.load_program({
+        0x6000, // LD V0, 0
+        0x6102, // LD V1, 2
+        0xA000, // LD I, 0x000 (font of 0)
+        0xD015, // DRW V0, V1, 5
+        0xD015, // DRW V0, V1, 5
+        0xD015, // DRW V0, V1, 5
+        0x120C, // JP 0x20C
+    });
+
+    env.vm.emulate_instructions(9);
+    EXPECT_EQ(0u, env.video_system->frames);
+
+    // three draws are one frame at the tick
+    env.vm.emulate_instructions(1);
+    EXPECT_EQ(1u, env.video_system->frames);
+    EXPECT_EQ(env.vm.video_memory, env.video_system->last_frame);
+    EXPECT_EQ(chip8::video_rows_t{0b1111100}, env.video_system->last_dirty_rows);
+
+    // unchanged frames are not presented, drawn and erased rows are unchanged too
+    env.load_program({0x6000, 0x6102, 0xA000, 0xD015, 0xD015, 0x120A});
+    env.vm.pc = chip8::ROM_OFFSET;
+    env.vm.emulate_instructions(100);
+    EXPECT_EQ(1u, env.video_system->frames);
+}
+
+TEST(AudioTests, PlaysPatternAtPitch) {
+    core_env_t env;
+    chip8::sound_system_capture_t capture(8000);
+    chip8::vm_t vm({.emulator_type = chip8::vm_t::settings_t::XO_CHIP, .cycles_per_frame = 7},
+                   *env.keyboard_system, *env.timers_system, *env.video_system, *env.random_system, capture);
+    std::vector<uint16_t> program = {
+        0xA20E, // LD I, 0x20E
+        0xF002, // LD AUDIO, [I]
+        0x6070, // LD V0, 112
+        0xF03A, // LD PITCH, V0
+        0x6102, // LD V1, 2
+        0xF118, // LD ST, V1
+        0x120C, // JP 0x20C
+    };
+    program.resize(program.size() + chip8::AUDIO_PATTERN_SIZE / 2, 0xF0F0);
+    vm.load_data(to_bytes(program), chip8::ROM_OFFSET);
+
+    ASSERT_FALSE(vm.emulate_frames(4));
+    EXPECT_EQ(112, vm.audio.pitch);
+
+    // 8000 bits per second at the pitch, one bit per sample: the pattern through two frames of the sound timer, then silence
+    const size_t frame = 8000 * vm.settings.timer_duration.count() / 1'000'000'000;
+    ASSERT_EQ(8000 * 4 * vm.settings.timer_duration.count() / 1'000'000'000, capture.samples.size());
+    for (size_t i = 0; i < capture.samples.size(); ++i) {
+        const int16_t expected = i >= 2 * frame ? 0 : (i % 8 < 4 ? chip8::audio_generator_t::AMPLITUDE : -chip8::audio_generator_t::AMPLITUDE);
+        ASSERT_EQ(expected, capture.samples[i]) << "sample: " << i;
+    }
+
+    // low pitches fill runs of samples
+    chip8::audio_generator_t generator(32 * 8000);
+    std::vector<int16_t> samples;
+    generator.generate(std::chrono::milliseconds(10), std::chrono::milliseconds(10), vm.audio, samples);
+    ASSERT_EQ(32 * 80u, samples.size());
+    for (size_t i = 0; i < samples.size(); ++i) {
+        const int16_t expected = i / 32 % 8 < 4 ? chip8::audio_generator_t::AMPLITUDE : -chip8::audio_generator_t::AMPLITUDE;
+        ASSERT_EQ(expected, samples[i]) << "sample: " << i;
+    }
+
+    const auto wav = capture.to_wav();
+    EXPECT_EQ(44 + 2 * capture.samples.size(), wav.size());
+    EXPECT_EQ(chip8::bytes_view(reinterpret_cast<const uint8_t*>("RIFF"), 4), wav.substr(0, 4));
+}
+
+TEST(AudioTests, StreamsThroughRing) {
+    // the consumer gets every value in order, however the two threads interleave
+    chip8::spsc_ring_t<uint32_t> ring(100);
+    ASSERT_EQ(128u, ring.capacity());
+    constexpr uint32_t VALUES = 50000;
+    std::thread producer([&ring] {
+        std::vector<uint32_t> chunk(37);
+        for (uint32_t next = 0; next < VALUES;) {
+            for (size_t i = 0; i < chunk.size(); ++i) {
+                chunk[i] = next + static_cast<uint32_t>(i);
+            }
+            const auto pushed = ring.push(chunk.data(), std::min<size_t>(chunk.size(), VALUES - next));
+            if (pushed == 0) {
+                std::this_thread::yield();
+            }
+            next += static_cast<uint32_t>(pushed);
+        }
+    });
+    std::vector<uint32_t> chunk(53);
+    for (uint32_t expected = 0; expected < VALUES;) {
+        const auto popped = ring.pop(chunk.data(), chunk.size());
+        if (popped == 0) {
+            std::this_thread::yield();
+        }
+        for (size_t i = 0; i < popped; ++i, ++expected) {
+            ASSERT_EQ(expected, chunk[i]);
+        }
+    }
+    producer.join();
+    EXPECT_EQ(0u, ring.size());
+
+    // 10ms of latency at 8000 samples per second: the rest of a 20ms frame is dropped, the device runs dry after it
+    chip8::sound_system_stream_t stream({.sample_rate = 8000, .latency = std::chrono::milliseconds(10)});
+    stream.play_sound(std::chrono::milliseconds(20), std::chrono::milliseconds(20), chip8::audio_t{});
+    EXPECT_EQ(80u, stream.get_stats().dropped_samples);
+
+    std::vector<int16_t> device(100, 1);
+    stream.drain(device.data(), device.size());
+    EXPECT_NE(0, device[79]);
+    EXPECT_TRUE(std::all_of(device.begin() + 80, device.end(), [](auto sample) { return sample == 0; }));
+    EXPECT_EQ(1u, stream.get_stats().underruns);
+    EXPECT_EQ(20u, stream.get_stats().missing_samples);
+
+    stream.play_sound(std::chrono::milliseconds(5), std::chrono::milliseconds(0), chip8::audio_t{});
+    stream.drain(device.data(), 40);
+    EXPECT_EQ(1u, stream.get_stats().underruns);
+}
+
+TEST(EngineTests, JitMatchesInterpreter) {
+    expect_same_as_interpreter(chip8::vm_t::settings_t::JIT);
+}
+
+TEST(EngineTests, BlockCacheMatchesInterpreter) {
+    expect_same_as_interpreter(chip8::vm_t::settings_t::BLOCK_CACHE);
+}
+
+TEST(EngineTests, SelfModifyingCode) {
+    // the first instruction is executed, then overwritten with LD V1, 0x55 and executed again
+    const std::vector<uint16_t> program = {
+        0x6111, // 0x200: LD V1, 0x11
+        0x3201, // 0x202: SE V2, 1
+        0x1208, // 0x204: JP 0x208
+        0x1206, // 0x206: JP 0x206
+        0x6201, // 0x208: LD V2, 1
+        0xA200, // 0x20A: LD I, 0x200
+        0x6061, // 0x20C: LD V0, 0x61
+        0x6155, // 0x20E: LD V1, 0x55
+        0xF155, // 0x210: LD [I], V1
+        0x1200, // 0x212: JP 0x200
+    };
+
+    for (auto engine : {chip8::vm_t::settings_t::JIT, chip8::vm_t::settings_t::BLOCK_CACHE, chip8::vm_t::settings_t::THREADED}) {
+        core_env_t expected;
+        core_env_t actual({.engine = engine});
+        expected.load_program(program);
+        actual.load_program(program);
+
+        expected.vm.emulate_instructions(1);
+        actual.vm.emulate_instructions(1);
+        expected.vm.emulate_instructions(20);
+        actual.vm.emulate_instructions(20);
+
+        EXPECT_EQ(0x55, actual.vm.V[1]) << "engine: " << engine;
+        expect_same_state(expected.vm, actual.vm);
+    }
+}
+
+TEST(EngineTests, ReturnsAcrossRuns) {
+    // nested calls return within a run, the ones, that a previous run made, return in the next one
+    const std::vector<uint16_t> program = {
+        0x220A, // 0x200: CALL 0x20A
+        0x7001, // 0x202: ADD V0, 1
+        0x220A, // 0x204: CALL 0x20A
+        0x1200, // 0x206: JP 0x200
+        0x0000, // 0x208
+        0x7101, // 0x20A: ADD V1, 1
+        0x2210, // 0x20C: CALL 0x210
+        0x00EE, // 0x20E: RET
+        0x7201, // 0x210: ADD V2, 1
+        0x00EE, // 0x212: RET
+    };
+
+    for (auto engine : {chip8::vm_t::settings_t::JIT, chip8::vm_t::settings_t::BLOCK_CACHE, chip8::vm_t::settings_t::THREADED}) {
+        core_env_t expected;
+        core_env_t actual({.engine = engine});
+        expected.load_program(program);
+        actual.load_program(program);
+
+        for (uint64_t count = 1; count < 200; count += count % 7 + 1) {
+            ASSERT_FALSE(expected.vm.emulate_instructions(count));
+            ASSERT_FALSE(actual.vm.emulate_instructions(count)) << "engine: " << engine;
+            expect_same_state(expected.vm, actual.vm);
+        }
+    }
+}
+
+TEST(EngineTests, ThreadedMatchesInterpreter) {
+    expect_same_as_interpreter(chip8::vm_t::settings_t::THREADED);
+}
+
+TEST(EngineTests, CustomQuirksMatchInterpreter) {
+    for (auto engine : {chip8::vm_t::settings_t::JIT, chip8::vm_t::settings_t::BLOCK_CACHE, chip8::vm_t::settings_t::THREADED}) {
+        expect_same_as_interpreter(engine, CUSTOM_QUIRKS);
+    }
+}
+
+TEST(EngineTests, FaultsAndWrapsMemory) {
+    for (auto engine : {chip8::vm_t::settings_t::INTERPRETER, chip8::vm_t::settings_t::JIT, chip8::vm_t::settings_t::BLOCK_CACHE, chip8::vm_t::settings_t::THREADED}) {
+        // endless recursion overflows the stack on the 17th call
+        core_env_t recursion({.engine = engine});
+        recursion.load_program({0x6007, 0x2202});
+
+        const auto fault = recursion.vm.emulate_instructions(100);
+        EXPECT_EQ(chip8::fault_kind_t::STACK_OVERFLOW, fault.kind) << "engine: " << engine;
+        EXPECT_EQ(0x202, fault.pc);
+        EXPECT_EQ(0x2202, fault.opcode.bytes);
+        EXPECT_EQ(chip8::STACK_SIZE, fault.sp);
+        EXPECT_EQ(7, fault.V[0]);
+        EXPECT_EQ(0x202, recursion.vm.pc);
+        EXPECT_EQ(fault, recursion.vm.emulate_instructions(100));
+
+        // stores and sprites at the end of memory go on at its start
+        core_env_t wrapping({.engine = engine});
+        wrapping.load_program({0x6001, 0x6102, 0x6203, 0xAFFE, 0xF255, 0xAFFE, 0xD345, 0x120E});
+
+        EXPECT_FALSE(wrapping.vm.emulate_instructions(20)) << "engine: " << engine;
+        EXPECT_EQ(1, wrapping.vm.memory[0xFFE]);
+        EXPECT_EQ(2, wrapping.vm.memory[0xFFF]);
+        EXPECT_EQ(3, wrapping.vm.memory[0x000]);
+        const uint8_t rows[] = {1, 2, 3, 0x90, 0x90};
+        for (size_t row = 0; row < std::size(rows); ++row) {
+            EXPECT_EQ(uint64_t{rows[row]} << 56, wrapping.vm.video_memory.planes[0][row][0]) << "row: " << row;
+        }
+    }
+}
+
+TEST(EngineTests, SkipsIdleLoops) {
+    struct keyboard_counter_t : chip8::keyboard_system_fake_t {
+        bool is_pressed(chip8::keyboard_key_t) override {
+            ++calls;
+            return false;
+        }
+
+        size_t calls = 0;
+    };
+
+    // waits for DT = 5 to run out, then for a key forever; a frame is thousands of instructions
+    const std::vector<uint16_t> program = {0x6005, 0xF015, 0xF107, 0x3100, 0x1204, 0xE29E, 0x120A};
+    constexpr auto op_duration = std::chrono::microseconds(1);
+
+    using settings_t = chip8::vm_t::settings_t;
+    for (auto engine : {settings_t::INTERPRETER, settings_t::JIT, settings_t::BLOCK_CACHE, settings_t::THREADED}) {
+        // single steps run every iteration
+        core_env_t expected({.op_duration = op_duration});
+        expected.load_program(program);
+
+        core_env_t env;
+        keyboard_counter_t keyboard;
+        chip8::vm_t vm({.op_duration = op_duration, .engine = engine}, keyboard, *env.timers_system, *env.video_system, *env.random_system, *env.sound_system);
+        vm.memory = expected.vm.memory;
+
+        for (size_t tick = 0; tick < 10; ++tick) {
+            for (auto count = expected.vm.instructions_until_tick(); count > 0; --count) {
+                ASSERT_FALSE(expected.vm.emulate_one_instruction());
+            }
+            ASSERT_FALSE(vm.emulate_instructions(vm.instructions_until_tick())) << "engine: " << engine;
+            expect_same_state(expected.vm, vm);
+        }
+        EXPECT_GE(vm.pc, 0x20A);
+        // about once per frame, instead of every other instruction
+        EXPECT_LE(keyboard.calls, 20u) << "engine: " << engine;
+    }
+}
+
+TEST(EngineTests, StaticVmMatchesInterpreter) {
+    using static_vm_t = chip8::static_vm_t<chip8::keyboard_system_fake_t, chip8::timers_system_instant_t, video_mock_t,
+                                           random_mock_t, chip8::sound_system_none_t>;
+
+    for (uint32_t seed = 0; seed < 100; ++seed) {
+        const auto type = static_cast<chip8::vm_t::settings_t::emulator_type_t>(seed % 3);
+        const auto quirks = seed % 5 == 0 ? std::optional(CUSTOM_QUIRKS) : std::nullopt;
+        const uint32_t cycles_per_frame = seed % 4 == 3 ? 7 + seed % 5 : 0;
+
+        core_env_t expected({.emulator_type = type, .quirks = quirks, .cycles_per_frame = cycles_per_frame});
+        expected.load_program(random_program(seed));
+
+        core_env_t env;
+        static_vm_t actual({.emulator_type = type, .quirks = quirks, .cycles_per_frame = cycles_per_frame},
+                           *env.keyboard_system, *env.timers_system, *env.video_system, *env.random_system, *env.sound_system);
+        actual.vm.memory = expected.vm.memory;
+
+        std::mt19937 gen(seed);
+        for (size_t slice = 0; slice < 50; ++slice) {
+            const auto count = 1 + gen() % 64;
+            const auto expected_fault = expected.vm.emulate_instructions(count);
+            ASSERT_EQ(expected_fault, actual.emulate_instructions(count)) << "seed: " << seed;
+            if (expected_fault) {
+                break;
+            }
+        }
+
+        expect_same_state(expected.vm, actual.vm);
+        EXPECT_EQ(expected.video_system->frames, env.video_system->frames);
+        if (::testing::Test::HasFailure()) {
+            FAIL() << "seed: " << seed;
+        }
+    }
+}
+
+TEST(FrameTests, TicksOncePerFrame) {
+    for (auto engine : {chip8::vm_t::settings_t::INTERPRETER, chip8::vm_t::settings_t::JIT, chip8::vm_t::settings_t::BLOCK_CACHE, chip8::vm_t::settings_t::THREADED}) {
+        // DT = 10, then endless loop
+        core_env_t env({.engine = engine, .cycles_per_frame = 10});
+        env.load_program({0x600A, 0xF015, 0x1204});
+
+        EXPECT_FALSE(env.vm.emulate_frames(1)) << "engine: " << engine;
+        EXPECT_EQ(9, env.vm.delay_timer);
+        EXPECT_EQ(0u, env.vm.frame_cycles);
+        EXPECT_EQ(10u, env.vm.instructions_until_tick());
+
+        EXPECT_FALSE(env.vm.emulate_instructions(25));
+        EXPECT_EQ(7, env.vm.delay_timer);
+        EXPECT_EQ(5u, env.vm.frame_cycles);
+
+        EXPECT_FALSE(env.vm.emulate_frames(2));
+        EXPECT_EQ(5, env.vm.delay_timer);
+        EXPECT_EQ(0u, env.vm.frame_cycles);
+    }
+
+    // jumps take 3 cycles, the rest of the frame carries over to the next one
+    auto costs = std::make_unique<chip8::cycle_costs_t>();
+    costs->fill(1);
+    std::fill(costs->begin() + 0x1000, costs->begin() + 0x2000, 3);
+
+    core_env_t env({.engine = chip8::vm_t::settings_t::JIT, .cycles_per_frame = 10, .cycle_costs = costs.get()});
+    env.load_program({0x600A, 0xF015, 0x1204});
+
+    const std::pair<uint8_t, uint64_t> frames[] = {{9, 1}, {8, 0}, {7, 2}, {6, 1}, {5, 0}};
+    for (const auto& [delay_timer, frame_cycles] : frames) {
+        EXPECT_FALSE(env.vm.emulate_frames(1));
+        EXPECT_EQ(delay_timer, env.vm.delay_timer);
+        EXPECT_EQ(frame_cycles, env.vm.frame_cycles);
+    }
+
+    EXPECT_FALSE(env.vm.emulate_duration(env.vm.settings.timer_duration * 2));
+    EXPECT_EQ(3, env.vm.delay_timer);
+    EXPECT_EQ(1u, env.vm.frame_cycles);
+
+    // every opcode has its cost
+    const auto& vip_costs = chip8::get_cosmac_vip_cycle_costs();
+    EXPECT_TRUE(std::none_of(vip_costs.begin(), vip_costs.end(), [](uint16_t cycles) { return cycles == 0; }));
+    EXPECT_GT(vip_costs[0xD01F], vip_costs[0xD011]);
+}
+
+TEST(TimersTests, PacesToAbsoluteDeadlines) {
+    chip8::timers_system_basic_t timers;
+    constexpr auto frame = std::chrono::milliseconds(10);
+
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t tick = 0; tick < 10; ++tick) {
+        // emulation of one frame takes too long, the next frames catch up
+        if (tick == 4) {
+            std::this_thread::sleep_for(frame * 6);
+        }
+        timers.tick(frame);
+    }
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+
+    // relative sleeps would take 6 frames more, half of it is slack for loaded machines
+    EXPECT_GE(elapsed, frame * 10);
+    EXPECT_LT(elapsed, frame * 13);
+
+    const auto& stats = timers.get_stats();
+    EXPECT_EQ(10u, stats.frames);
+    EXPECT_GE(stats.late_frames, 1u);
+    EXPECT_GE(stats.max_lateness, frame);
+    EXPECT_EQ(0u, stats.resyncs);
+}
+
+TEST(RunLoopTests, MultiplexesSessionsOnOneThread) {
+    static constexpr chip8::vm_t::settings_t::engine_t ENGINES[] = {
+        chip8::vm_t::settings_t::INTERPRETER,
+        chip8::vm_t::settings_t::JIT,
+        chip8::vm_t::settings_t::BLOCK_CACHE,
+        chip8::vm_t::settings_t::THREADED,
+    };
+
+    // V0 = key, V1 = 5, then idle forever
+    core_env_t env;
+    env.load_program({0xF00A, 0x6105, 0x1204});
+
+    std::vector<std::unique_ptr<chip8::keyboard_system_queue_t>> keyboards;
+    std::vector<std::unique_ptr<chip8::vm_t>> vms;
+    chip8::run_loop_t loop;
+    for (auto engine : ENGINES) {
+        keyboards.push_back(std::make_unique<chip8::keyboard_system_queue_t>());
+        vms.push_back(std::make_unique<chip8::vm_t>(chip8::vm_t::settings_t{.engine = engine}, *keyboards.back(),
+                                                    *env.timers_system, *env.video_system, *env.random_system, *env.sound_system));
+        vms.back()->memory = env.vm.memory;
+        loop.add_session(*vms.back(), 3);
+    }
+
+    // every session waits for its key, nothing is left to run
+    EXPECT_TRUE(loop.run_once());
+    EXPECT_FALSE(loop.run_once());
+    for (size_t session = 0; session < std::size(ENGINES); ++session) {
+        EXPECT_EQ(chip8::run_state_t::WAITING_FOR_KEY, loop.get_state(session));
+        EXPECT_EQ(0x200, vms[session]->pc);
+    }
+
+    for (size_t session = 0; session < std::size(ENGINES); ++session) {
+        keyboards[session]->press(static_cast<chip8::keyboard_key_t>(session + 7));
+        loop.wake(session);
+    }
+    while (loop.run_once()) {}
+
+    for (size_t session = 0; session < std::size(ENGINES); ++session) {
+        EXPECT_EQ(chip8::run_state_t::FINISHED, loop.get_state(session)) << "engine: " << ENGINES[session];
+        EXPECT_FALSE(loop.get_fault(session));
+        EXPECT_EQ(session + 7, vms[session]->V[0]);
+        EXPECT_EQ(5, vms[session]->V[1]);
+    }
+
+    // guest faults finish the session
+    core_env_t faulting;
+    faulting.load_program({0x00EE});
+    const auto session = loop.add_session(faulting.vm);
+    while (loop.run_once()) {}
+    EXPECT_EQ(chip8::fault_kind_t::STACK_UNDERFLOW, loop.get_fault(session).kind);
+}
+
+TEST(RewindTests, RestoresSnapshots) {
+    struct state_t {
+        std::array<uint8_t, chip8::REGISTERS_SIZE> V;
+        uint16_t I;
+        uint16_t pc;
+        std::array<uint8_t, chip8::MEMORY_SIZE> memory;
+        chip8::video_memory_t video_memory;
+
+        bool operator==(const state_t&) const = default;
+    };
+    const auto get_state = [](const chip8::vm_t& vm) { return state_t{vm.V, vm.I, vm.pc, vm.memory, vm.video_memory}; };
+
+    using settings_t = chip8::vm_t::settings_t;
+    for (auto engine : {settings_t::INTERPRETER, settings_t::JIT, settings_t::BLOCK_CACHE, settings_t::THREADED}) {
+        for (uint32_t seed = 0; seed < 50; ++seed) {
+            // one snapshot every tick, ring is smaller than the distance between keyframes
+            core_env_t env({.engine = engine, .rewind_interval = 1, .rewind_capacity = 10});
+            env.load_program(random_program(seed));
+
+            std::vector<state_t> states;
+            for (size_t tick = 0; tick < 40; ++tick) {
+                if (env.vm.emulate_instructions(env.vm.instructions_until_tick())) {
+                    break;
+                }
+                states.push_back(get_state(env.vm));
+            }
+            if (states.empty()) {
+                continue;
+            }
+            ASSERT_EQ(std::min<size_t>(states.size(), 10), env.vm.rewind->size());
+
+            env.vm.rewind->restore(0);
+            EXPECT_EQ(states.back(), get_state(env.vm)) << "seed: " << seed;
+
+            const size_t steps = std::min<size_t>(states.size(), 10) - 1;
+            env.vm.rewind->restore(steps);
+            EXPECT_EQ(states[states.size() - 1 - steps], get_state(env.vm)) << "seed: " << seed;
+            EXPECT_EQ(1u, env.vm.rewind->size());
+            EXPECT_THROW(env.vm.rewind->restore(1), std::out_of_range);
+        }
+    }
+}
+
+TEST(RewindTests, RestoresLongRuns) {
+    // V0 counts, V2 counts its wraps, both are stored one after another from 0x300 on, so most pages are written
+    // only by engines between ticks; thousands of instructions per tick
+    const std::vector<uint16_t> program = {0x6103, 0xA300, 0xF255, 0xF11E, 0x7001, 0x3000, 0x1204, 0x7201, 0x1202};
+    const chip8::vm_t::settings_t settings = {.op_duration = std::chrono::microseconds(10), .rewind_interval = 1, .rewind_capacity = 100};
+
+    using settings_t = chip8::vm_t::settings_t;
+    for (auto engine : {settings_t::JIT, settings_t::BLOCK_CACHE, settings_t::THREADED}) {
+        core_env_t expected(settings);
+        expected.load_program(program);
+        ASSERT_FALSE(expected.vm.emulate_instructions(100000));
+
+        auto engine_settings = settings;
+        engine_settings.engine = engine;
+        core_env_t actual(std::move(engine_settings));
+        actual.load_program(program);
+        ASSERT_FALSE(actual.vm.emulate_instructions(100000));
+
+        // a snapshot at every tick, the restored one is not a keyframe
+        ASSERT_EQ(expected.vm.rewind->size(), actual.vm.rewind->size()) << "engine: " << engine;
+        expected.vm.rewind->restore(5);
+        actual.vm.rewind->restore(5);
+        expect_same_state(expected.vm, actual.vm);
+    }
+}
+
+TEST(RewindTests, DeltasKeepDrawnRows) {
+    // glyph `0` is drawn over and over into the first rows of the screen
+    core_env_t env({.rewind_interval = 1, .rewind_capacity = 32});
+    env.load_program({0xD005, 0x1200});
+
+    std::vector<chip8::video_memory_t> screens;
+    for (size_t tick = 0; tick < 40; ++tick) {
+        ASSERT_FALSE(env.vm.emulate_instructions(env.vm.instructions_until_tick()));
+        screens.push_back(env.vm.video_memory);
+    }
+
+    // keyframes hold the whole screen, the other snapshots only the rows of the glyph
+    EXPECT_LT(env.vm.rewind->memory_usage(), 32 * sizeof(chip8::video_memory_t));
+
+    env.vm.rewind->restore(20);
+    EXPECT_EQ(screens[screens.size() - 21], env.vm.video_memory);
+}
+
+TEST(ReplayTests, ReplaysRecordedSession) {
+    // live keyboard, that changes its mind all the time
+    struct keyboard_script_t : chip8::keyboard_system_iface_t {
+        bool is_pressed(chip8::keyboard_key_t key) override {
+            ++calls;
+            return (calls / 40 + key) % 3 == 0;
+        }
+
+        chip8::keyboard_key_t wait_for_keypress() override {
+            return static_cast<chip8::keyboard_key_t>(calls++ % chip8::KEYPAD_SIZE);
+        }
+
+        size_t calls = 0;
+    };
+
+    static constexpr uint64_t TICKS = 200;
+
+    // runs tick by tick, false if vm faulted
+    const auto run = [](chip8::vm_t& vm, const auto& peripherals) {
+        while (peripherals.get_tick() < TICKS) {
+            if (vm.emulate_instructions(vm.instructions_until_tick())) {
+                return false;
+            }
+        }
+        return true;
+    };
+
+    for (uint32_t seed = 0; seed < 50; ++seed) {
+        auto program = random_program(seed);
+        for (size_t i = 0; i < program.size(); ++i) {
+            const uint16_t x = program[i] & 0x0F00;
+            if (i % 9 == 0) {
+                program[i] = static_cast<uint16_t>((i % 2 ? 0xE09E : 0xE0A1) | x);
+            } else if (i % 31 == 0) {
+                program[i] = static_cast<uint16_t>(0xF00A | x);
+            } else if (program[i] == 0x00EE || (program[i] & 0xF000) == 0x2000) {
+                program[i] = 0x00E0;
+            }
+        }
+
+        // recorded with the interpreter, replayed with every engine
+        core_env_t live;
+        keyboard_script_t keyboard;
+        chip8::recorder_t recorder(keyboard, *live.random_system, *live.timers_system, 16);
+        chip8::vm_t recorded({}, recorder, recorder, *live.video_system, recorder, *live.sound_system);
+        recorded.load_data(chip8::CHIP8_STANDARD_FONTSET_VIEW, 0);
+        // live vm is not run, it just encodes the program
+        live.load_program(program);
+        recorded.load_data(chip8::bytes_view(live.vm.memory.data() + chip8::ROM_OFFSET, 2 * program.size()), chip8::ROM_OFFSET);
+        recorder.attach(recorded);
+        const bool recorded_ok = run(recorded, recorder);
+
+        chip8::replayer_t replayer(recorder.get_recording());
+        chip8::vm_t replayed({.engine = static_cast<chip8::vm_t::settings_t::engine_t>(seed % 4)}, replayer, replayer, *live.video_system, replayer, *live.sound_system);
+        replayer.attach(replayed);
+        ASSERT_EQ(recorded_ok, run(replayed, replayer)) << "seed: " << seed;
+        expect_same_state(recorded, replayed);
+
+        // seek back to the middle and replay the rest once more
+        const auto middle = recorder.get_tick() / 2 + seed % 8;
+        if (middle >= recorder.get_tick()) {
+            continue;
+        }
+        replayer.seek(middle);
+        EXPECT_EQ(middle, replayer.get_tick());
+        ASSERT_EQ(recorded_ok, run(replayed, replayer)) << "seed: " << seed;
+        expect_same_state(recorded, replayed);
+        if (recorded_ok) {
+            EXPECT_TRUE(replayer.is_finished());
+        }
+
+        if (::testing::Test::HasFailure()) {
+            FAIL() << "seed: " << seed;
+        }
+    }
+}
+
+TEST(ProfilerTests, CountsInstructionsAndPeripherals) {
+    using engine_t = chip8::vm_t::settings_t::engine_t;
+
+    for (auto engine : {engine_t::INTERPRETER, engine_t::JIT, engine_t::BLOCK_CACHE, engine_t::THREADED}) {
+        core_env_t env;
+        chip8::profiler_t profiler(*env.keyboard_system, *env.timers_system, *env.video_system, *env.sound_system);
+        chip8::vm_t vm({.engine = engine}, profiler, profiler, profiler, *env.random_system, profiler);
+
+        // key is never pressed, both ways of SKP_VX end with the same jump
+        env.load_program({0xA000, 0xD015, 0x00E0, 0xE09E, 0x1202, 0x1202});
+        vm.load_data(chip8::bytes_view(env.vm.memory.data() + chip8::ROM_OFFSET, 12), chip8::ROM_OFFSET);
+        profiler.attach(vm);
+
+        // LD_I_ADDR and 24 full rounds of the loop, then DRW, CLS and SKP once more
+        vm.emulate_instructions(100);
+        const auto profile = profiler.get_profile();
+
+        if (PIEX_PROFILING) {
+            EXPECT_EQ(100u, profile.instructions) << "engine: " << engine;
+            ASSERT_EQ(5u, profile.by_instruction.size()) << "engine: " << engine;
+            EXPECT_EQ(25u, profile.by_instruction[0].count);
+            EXPECT_EQ(chip8::instructions::JP_ADDR.name, profile.by_instruction[3].name);
+            EXPECT_EQ(24u, profile.by_instruction[3].count);
+            EXPECT_EQ(chip8::instructions::LD_I_ADDR.name, profile.by_instruction[4].name);
+            EXPECT_EQ(25u, profile.by_address[0x202]);
+            EXPECT_EQ(24u, profile.by_address[0x208]);
+            EXPECT_EQ(0u, profile.by_address[0x20A]);
+        } else {
+            EXPECT_EQ(0u, profile.instructions);
+            EXPECT_TRUE(profile.by_instruction.empty());
+        }
+
+        ASSERT_EQ(4u, profile.peripherals.size());
+        EXPECT_EQ("is_pressed", profile.peripherals[3].name);
+        EXPECT_EQ(25u, profile.peripherals[3].calls) << "engine: " << engine;
+        EXPECT_EQ(env.video_system->frames, profile.peripherals[0].calls);
+        EXPECT_GT(profile.peripherals[1].calls, 0u);
+
+        profiler.reset();
+        EXPECT_EQ(0u, profiler.get_profile().peripherals[3].calls);
+        profiler.detach();
+    }
+}
+
+TEST(BatchTests, MatchesSeparateVms) {
+    static constexpr size_t LANES = 16;
+
+    for (uint32_t seed = 0; seed < 100; ++seed) {
+        const auto type = static_cast<chip8::vm_t::settings_t::emulator_type_t>(seed % 3);
+        const auto quirks = seed % 5 == 0 ? std::optional(CUSTOM_QUIRKS) : std::nullopt;
+        auto program = random_program(seed);
+        for (auto& opcode : program) {
+            // most of programs should live long, instead of faulting on the stack soon
+            if (seed % 4 != 0 && opcode == 0x00EE) {
+                opcode = 0x00E0;
+            }
+            if (seed % 4 != 0 && (opcode & 0xF000) == 0x2000) {
+                opcode = 0x1000 | (opcode & 0x0FFF);
+            }
+        }
+
+        core_env_t prototype({.emulator_type = type, .quirks = quirks});
+        prototype.load_program(program);
+        prototype.random_system->fixed = true;
+        chip8::vm_batch_t batch(
+            LANES,
+            prototype.vm,
+            *prototype.keyboard_system,
+            *prototype.timers_system,
+            *prototype.video_system,
+            *prototype.random_system,
+            *prototype.sound_system
+        );
+
+        // lanes start together, on odd seeds some of them diverge on skips
+        std::vector<std::unique_ptr<core_env_t>> expected;
+        std::mt19937 gen(seed);
+        std::array<uint8_t, chip8::REGISTERS_SIZE> registers;
+        std::generate(registers.begin(), registers.end(), gen);
+        for (size_t lane = 0; lane < LANES; ++lane) {
+            expected.push_back(std::make_unique<core_env_t>(chip8::vm_t::settings_t{.emulator_type = type, .quirks = quirks}));
+            expected.back()->load_program(program);
+            expected.back()->vm.V = registers;
+            expected.back()->random_system->fixed = true;
+            if (seed % 2 == 1 && lane % 2 == 1) {
+                expected.back()->vm.V[gen() % chip8::REGISTERS_SIZE] = static_cast<uint8_t>(gen());
+            }
+            batch.load_lane(lane, expected.back()->vm);
+        }
+
+        std::vector<chip8::fault_t> faults(LANES);
+        for (size_t slice = 0; slice < 20; ++slice) {
+            const auto count = 1 + gen() % 64;
+            batch.run(count);
+            for (size_t lane = 0; lane < LANES; ++lane) {
+                if (!faults[lane]) {
+                    faults[lane] = expected[lane]->vm.emulate_instructions(count);
+                }
+            }
+        }
+
+        for (size_t lane = 0; lane < LANES; ++lane) {
+            core_env_t actual({.emulator_type = type, .quirks = quirks});
+            batch.store_lane(lane, actual.vm);
+
+            ASSERT_EQ(static_cast<bool>(faults[lane]), batch.is_halted(lane)) << "seed: " << seed << ", lane: " << lane;
+            EXPECT_EQ(faults[lane], batch.get_fault(lane));
+            if (faults[lane]) {
+                // clock of the halted lane stopped, but the batch one goes on
+                actual.vm.timers_duration = expected[lane]->vm.timers_duration;
+            }
+
+            expect_same_state(expected[lane]->vm, actual.vm);
+            if (::testing::Test::HasFailure()) {
+                FAIL() << "seed: " << seed << ", lane: " << lane;
+            }
+        }
+    }
+}
+
+TEST(BatchTests, HaltedLanesStayOutOfLockstep) {
+    static constexpr size_t LANES = 4;
+    // lane with V0 != 0 returns with an empty stack and halts, the others loop on at the same pcs
+    const std::vector<uint16_t> program = {
+        0x3000, // 0x200: SE V0, 0
+        0x00EE, // 0x202: RET
+        0x7101, // 0x204: ADD V1, 1
+        0x8124, // 0x206: ADD V1, V2
+        0xF11E, // 0x208: ADD I, V1
+        0x1204, // 0x20A: JP 0x204
+    };
+
+    core_env_t prototype;
+    prototype.load_program(program);
+    prototype.vm.V[2] = 3;
+    chip8::vm_batch_t batch(
+        LANES,
+        prototype.vm,
+        *prototype.keyboard_system,
+        *prototype.timers_system,
+        *prototype.video_system,
+        *prototype.random_system,
+        *prototype.sound_system
+    );
+
+    std::vector<std::unique_ptr<core_env_t>> expected;
+    for (size_t lane = 0; lane < LANES; ++lane) {
+        expected.push_back(std::make_unique<core_env_t>());
+        expected.back()->load_program(program);
+        expected.back()->vm.V[0] = lane == 1;
+        expected.back()->vm.V[2] = 3;
+        batch.load_lane(lane, expected.back()->vm);
+    }
+
+    batch.run(100);
+    for (size_t lane = 0; lane < LANES; ++lane) {
+        const auto fault = expected[lane]->vm.emulate_instructions(100);
+        EXPECT_EQ(lane == 1, batch.is_halted(lane));
+        EXPECT_EQ(fault, batch.get_fault(lane));
+
+        core_env_t actual;
+        batch.store_lane(lane, actual.vm);
+        if (fault) {
+            actual.vm.timers_duration = expected[lane]->vm.timers_duration;
+        }
+        expect_same_state(expected[lane]->vm, actual.vm);
+    }
+}
+
+TEST(SchedulerTests, MatchesSequentialRuns) {
+    static constexpr size_t SESSIONS = 200;
+
+    std::vector<std::unique_ptr<core_env_t>> expected;
+    std::vector<std::unique_ptr<core_env_t>> actual;
+    std::vector<bool> failed(SESSIONS, false);
+    std::vector<uint64_t> budgets(SESSIONS);
+
+    chip8::scheduler_t scheduler({.workers = 4, .quantum = 37});
+    std::vector<chip8::scheduler_t::session_id_t> ids;
+
+    for (uint32_t seed = 0; seed < SESSIONS; ++seed) {
+        const auto type = static_cast<chip8::vm_t::settings_t::emulator_type_t>(seed % 3);
+        const auto engine = static_cast<chip8::vm_t::settings_t::engine_t>(seed % 4);
+        const auto program = random_program(seed);
+        budgets[seed] = seed * 7 % 500;
+
+        expected.push_back(std::make_unique<core_env_t>(chip8::vm_t::settings_t{.emulator_type = type}));
+        expected.back()->load_program(program);
+        failed[seed] = static_cast<bool>(expected.back()->vm.emulate_instructions(budgets[seed]));
+
+        actual.push_back(std::make_unique<core_env_t>(chip8::vm_t::settings_t{.emulator_type = type, .engine = engine}));
+        actual.back()->load_program(program);
+        ids.push_back(scheduler.add_session(actual.back()->vm, budgets[seed], 1 + seed % 3));
+    }
+
+    scheduler.wait();
+
+    uint64_t executed = 0;
+    for (size_t i = 0; i < SESSIONS; ++i) {
+        const auto result = scheduler.get_result(ids[i]);
+        ASSERT_TRUE(result.finished);
+        ASSERT_EQ(failed[i], static_cast<bool>(result.fault)) << "session: " << i;
+        EXPECT_EQ(nullptr, result.exception);
+        if (!failed[i]) {
+            EXPECT_EQ(budgets[i], result.executed);
+        }
+        executed += result.executed;
+
+        expect_same_state(expected[i]->vm, actual[i]->vm);
+        if (::testing::Test::HasFailure()) {
+            FAIL() << "session: " << i;
+        }
+    }
+
+    EXPECT_EQ(executed, scheduler.get_executed_instructions());
+}
+
+TEST(RomLibraryTests, IndexesCorpusByContent) {
+    const auto directory = std::filesystem::temp_directory_path() / ("piex_roms_" + std::to_string(::testing::UnitTest::GetInstance()->random_seed()));
+    std::filesystem::remove_all(directory);
+    std::filesystem::create_directories(directory / "sub");
+    auto write_file = [](const std::filesystem::path& path, const chip8::bytes_owned& data) {
+        std::ofstream file(path, std::ios::out | std::ios::binary);
+        file.write(reinterpret_cast<const char*>(data.data()), static_cast<std::streamsize>(data.size()));
+    };
+    const auto program = to_bytes({0x6005, 0x7001, 0x1202});
+    write_file(directory / "a.ch8", program);
+    write_file(directory / "sub" / "copy.xo8", program);
+    write_file(directory / "sub" / "other.xo8", to_bytes({0x00FF, 0x1202}));
+    write_file(directory / "huge.ch8", chip8::bytes_owned(chip8::MEMORY_SIZE, 0));
+
+    {
+        chip8::rom_library_t library;
+        library.add_directory(directory);
+
+        // the copy is the same image, typed by the file, that was mapped first
+        ASSERT_EQ(2u, library.roms().size());
+        ASSERT_EQ(1u, library.skipped().size());
+        const auto* rom = library.find(chip8::hash_rom(program));
+        ASSERT_NE(nullptr, rom);
+        EXPECT_EQ(rom, library.find(directory / "sub" / "copy.xo8"));
+        EXPECT_EQ(2u, rom->paths.size());
+        EXPECT_EQ(chip8::vm_t::settings_t::CHIP_8, rom->emulator_type);
+        EXPECT_EQ(chip8::vm_t::settings_t::XO_CHIP, library.find(directory / "sub" / "other.xo8")->emulator_type);
+        EXPECT_EQ(nullptr, library.find(directory / "huge.ch8"));
+
+        ASSERT_TRUE(library.set_profile(rom->hash, chip8::vm_t::settings_t::SCHIP1_1, CUSTOM_QUIRKS));
+        core_env_t env(rom->apply_profile({}));
+        EXPECT_EQ(chip8::vm_t::settings_t::SCHIP1_1, env.vm.settings.emulator_type);
+        EXPECT_TRUE(env.vm.quirks == CUSTOM_QUIRKS);
+
+        env.vm.load_data(rom->data, chip8::ROM_OFFSET);
+        ASSERT_FALSE(env.vm.emulate_instructions(3));
+        EXPECT_EQ(6, env.vm.V[0]);
+
+        EXPECT_THROW(library.add_file(directory / "missing.ch8"), std::runtime_error);
+    }
+
+    std::filesystem::remove_all(directory);
+}
@@ -2,7 +2,6 @@
 #include <cstdio>
 #include <filesystem>
 #include <memory>
-#include <fstream>
 #include <sstream>
 #include <string>
 
@@ -10,6 +9,7 @@
 
 #include <core/common.h>
 #include <core/instructions.h>
+#include <core/rom_library.h>
 #include <core/vm.h>
 
 #include <impl_basic/random_crand.h>
@@ -35,9 +35,9 @@ struct video_system_mock_t : chip8::video_system_none_t {
     std::string render_for_test(const chip8::video_memory_t& video_memory) {
         std::stringstream frame;
         
-        for (size_t i = 0; i < chip8::VIDEO_HEIGHT; ++i) {
-            for (size_t j = 0; j < chip8::VIDEO_WIDTH; ++j) {
-                frame << (video_memory[i][j] ? '#' : '.');
+        for (size_t i = 0; i < video_memory.height(); ++i) {
+            for (size_t j = 0; j < video_memory.width(); ++j) {
+                frame << (video_memory.get_pixel(i, j) ? '#' : '.');
             }
             frame << '\n';
         }
@@ -70,33 +70,44 @@ struct env_t {
 };
 
 
-chip8::bytes_owned load_rom(std::string_view filename) {
-    std::ifstream file(filename.data(), std::ios::in | std::ios::binary);
-    if (!file.is_open()) {
+// roms are mapped once for all tests, vms copy them straight from the files
+chip8::bytes_view load_rom(std::string_view filename) {
+    static chip8::rom_library_t library;
+    try {
+        return library.add_file(std::filesystem::path(filename)).data;
+    } catch (const std::runtime_error& e) {
         std::stringstream err;
-        err << "failed to open file: " << filename;
+        err << e.what();
         err << " (" << std::filesystem::current_path() << ")";
 
         throw std::runtime_error(err.str());
     }
-
-    chip8::bytes_owned buffer(std::istreambuf_iterator<char>(file), {});
-    return buffer;
 }
 
+// every rom must give the same image on every engine
+inline constexpr chip8::vm_t::settings_t::engine_t ENGINES[] = {
+    chip8::vm_t::settings_t::INTERPRETER,
+    chip8::vm_t::settings_t::JIT,
+    chip8::vm_t::settings_t::BLOCK_CACHE,
+    chip8::vm_t::settings_t::THREADED,
+};
+
 void launch_rom(std::string_view filename, std::string expected, std::chrono::nanoseconds duration) {
     auto rom_bytes = load_rom(filename);
 
-    env_t env({
-        .emulator_type = chip8::vm_t::settings_t::CHIP_8,
-    });
-    env.vm.load_data(rom_bytes, chip8::ROM_OFFSET);
+    for (auto engine : ENGINES) {
+        env_t env({
+            .emulator_type = chip8::vm_t::settings_t::CHIP_8,
+            .engine = engine,
+        });
+        env.vm.load_data(rom_bytes, chip8::ROM_OFFSET);
 
-    env.vm.emulate_duration(duration);
+        env.vm.emulate_duration(duration);
 
-    auto actual = env.video_system->render_for_test(env.vm.video_memory);
+        auto actual = env.video_system->render_for_test(env.vm.video_memory);
 
-    ASSERT_EQ(expected, actual);
+        ASSERT_EQ(expected, actual) << "engine: " << engine;
+    }
 }
 
 
@@ -299,20 +310,23 @@ TEST(RomTests, Quirks) {
 
     auto rom_bytes = load_rom("tests/data/5-quirks.ch8");
 
-    env_t env({
-        .emulator_type = chip8::vm_t::settings_t::CHIP_8,
-    });
-    env.vm.load_data(rom_bytes, chip8::ROM_OFFSET);
+    for (auto engine : ENGINES) {
+        env_t env({
+            .emulator_type = chip8::vm_t::settings_t::CHIP_8,
+            .engine = engine,
+        });
+        env.vm.load_data(rom_bytes, chip8::ROM_OFFSET);
 
-    env.keyboard_system->pressed_keys[chip8::keyboard_key_t::KEY_1] = true;
-    env.vm.emulate_duration(std::chrono::seconds(1));
+        env.keyboard_system->pressed_keys[chip8::keyboard_key_t::KEY_1] = true;
+        env.vm.emulate_duration(std::chrono::seconds(1));
 
-    env.keyboard_system->pressed_keys[chip8::keyboard_key_t::KEY_1] = false;
-    env.vm.emulate_duration(std::chrono::seconds(5));
+        env.keyboard_system->pressed_keys[chip8::keyboard_key_t::KEY_1] = false;
+        env.vm.emulate_duration(std::chrono::seconds(5));
 
-    auto actual = env.video_system->render_for_test(env.vm.video_memory);
+        auto actual = env.video_system->render_for_test(env.vm.video_memory);
 
-    printf("actual:\n%s\n", actual.data());
+        printf("actual:\n%s\n", actual.data());
 
-    ASSERT_EQ(expected_image, actual);
+        ASSERT_EQ(expected_image, actual) << "engine: " << engine;
+    }
 }